@@ -1,6 +1,9 @@
+#include <iostream>
 #include "../framework/vulkanApp.h"
+#include "../framework/pipelineStatistics.h"
 #include "quadric/include/teapot.h"
 
+// Use Up/Down to change subdivision degree of the mesh
 class MeshApp : public VulkanApp
 {
     struct DescriptorSetTable
@@ -12,8 +15,11 @@ class MeshApp : public VulkanApp
     std::unique_ptr<magma::UniformBuffer<rapid::matrix>> uniformBuffer;
     std::unique_ptr<magma::DescriptorSet> descriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> wireframePipeline;
+    std::unique_ptr<PipelineStatistics> pipelineStatistics;
 
     rapid::matrix viewProj;
+    uint16_t subdivisionDegree = 4;
+    uint32_t lastPrintFrame = 0;
 
 public:
     MeshApp(const AppEntry& entry):
@@ -25,6 +31,7 @@ public:
         createUniformBuffer();
         setupDescriptorSet();
         setupPipeline();
+        createPipelineStatistics();
         for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
             recordCommandBuffer(i);
         timer->run();
@@ -33,9 +40,37 @@ public:
     void render(uint32_t bufferIndex) override
     {
         updatePerspectiveTransform();
+        if (pipelineStatistics)
+        {
+            printPipelineStatistics();
+            pipelineStatistics->submitted(bufferIndex, frameCount);
+        }
         submitCommandBuffer(bufferIndex);
     }
 
+    void onKeyDown(char key, int repeat, uint32_t flags) override
+    {
+        constexpr uint16_t maxSubdivisionDegree = 32;
+        switch (key)
+        {
+        case AppKey::Up:
+            if (subdivisionDegree < maxSubdivisionDegree)
+            {
+                ++subdivisionDegree;
+                recreateMesh();
+            }
+            break;
+        case AppKey::Down:
+            if (subdivisionDegree > 1)
+            {
+                --subdivisionDegree;
+                recreateMesh();
+            }
+            break;
+        }
+        VulkanApp::onKeyDown(key, repeat, flags);
+    }
+
     void onResize(uint32_t width, uint32_t height) override
     {
         VulkanApp::onResize(width, height);
@@ -72,10 +107,20 @@ public:
 
     void createMesh()
     {
-        constexpr uint16_t subdivisionDegree = 4;
         mesh = std::make_unique<quadric::Teapot>(subdivisionDegree, cmdBufferCopy);
     }
 
+    void recreateMesh()
+    {
+        device->waitIdle();
+        createMesh();
+        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+        {
+            commandBuffers[i]->reset();
+            recordCommandBuffer(i);
+        }
+    }
+
     void createUniformBuffer()
     {
         uniformBuffer = std::make_unique<magma::UniformBuffer<rapid::matrix>>(device);
@@ -106,11 +151,30 @@ public:
             pipelineCache);
     }
 
+    void createPipelineStatistics()
+    {   // Not every device is able to count pipeline statistics
+        if (PipelineStatistics::supported(physicalDevice))
+            pipelineStatistics = std::make_unique<PipelineStatistics>(device, (uint32_t)commandBuffers.size());
+    }
+
+    void printPipelineStatistics()
+    {   // Print once in a while to not flood the console
+        constexpr uint32_t printInterval = 100; // In frames
+        if (pipelineStatistics->resolve() && (frameCount - lastPrintFrame >= printInterval))
+        {
+            std::cout << "Subdivision degree " << subdivisionDegree << ", frame " << pipelineStatistics->getFrame()
+                << ": " << pipelineStatistics->getCounters() << std::endl;
+            lastPrintFrame = frameCount;
+        }
+    }
+
     void recordCommandBuffer(uint32_t index)
     {
         auto& cmdBuffer = commandBuffers[index];
         cmdBuffer->begin();
         {
+            if (pipelineStatistics)
+                pipelineStatistics->begin(cmdBuffer, index);
             cmdBuffer->beginRenderPass(renderPass, framebuffers[index],
                 {
                     magma::clear::gray,
@@ -124,6 +188,8 @@ public:
                 mesh->draw(cmdBuffer);
             }
             cmdBuffer->endRenderPass();
+            if (pipelineStatistics)
+                pipelineStatistics->end(cmdBuffer, index);
         }
         cmdBuffer->end();
     }
@@ -1,11 +1,17 @@
-#include <fstream>
 #include "../framework/vulkanApp.h"
 #include "../framework/utilities.h"
+#include "../framework/textureStreamer.h"
+#include "../framework/progressiveTexture.h"
 
-/* Place all texture data (with mipmaps) into one large
-   source transfer buffer and copy all textures to device
-   using single vkQueueSubmit() call. */
+/* Place mip tails of all textures into staging ring
+   and copy them to device using single vkQueueSubmit()
+   call. Larger mip levels are uploaded one per frame. */
 #define BATCH_LOAD
+/* Draw with placeholder textures from the first frame and
+   load texture data in the background. Takes precedence
+   over BATCH_LOAD, so it is off to show progressive mip levels
+   (texture cube and array samples stream by default). */
+//#define ASYNC_LOAD
 
 // Use Space to enable/disable multitexturing
 class TextureApp : public VulkanApp
@@ -14,6 +20,8 @@ class TextureApp : public VulkanApp
     {
         float lod;
         bool multitexture;
+        float diffuseMinLod;
+        float lightmapMinLod;
     };
 
     struct DescriptorSetTable
@@ -30,8 +38,16 @@ class TextureApp : public VulkanApp
     std::unique_ptr<magma::UniformBuffer<UniformBlock>> uniformBuffer;
     std::unique_ptr<magma::DescriptorSet> descriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> graphicsPipeline;
+#if defined(ASYNC_LOAD)
+    std::unique_ptr<TextureStreamer> textureStreamer;
+#elif defined(BATCH_LOAD)
+    std::unique_ptr<ProgressiveTexture> diffuseMips;
+    std::unique_ptr<ProgressiveTexture> lightmapMips;
+#endif
 
     float lod = 0.f;
+    float diffuseMinLod = 0.f;
+    float lightmapMinLod = 0.f;
     bool multitexture = true;
 
 public:
@@ -51,6 +67,16 @@ public:
 
     void render(uint32_t bufferIndex) override
     {
+    #ifdef ASYNC_LOAD
+        if (textureStreamer->update())
+        {   // Replace placeholders
+            descriptorSet->update();
+            for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+                recordCommandBuffer(i);
+        }
+    #elif defined(BATCH_LOAD)
+        streamMipLevels();
+    #endif // ASYNC_LOAD
         submitCommandBuffer(bufferIndex);
     }
 
@@ -94,51 +120,11 @@ public:
             {
                 block->lod = lod;
                 block->multitexture = multitexture;
+                block->diffuseMinLod = diffuseMinLod;
+                block->lightmapMinLod = lightmapMinLod;
             });
     }
 
-    std::unique_ptr<magma::ImageView> loadTextureBatch(const std::string& filename, const std::unique_ptr<magma::SrcTransferBuffer>& buffer)
-    {
-        std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-        if (!file.is_open())
-            throw std::runtime_error("failed to open file \"" + filename + "\"");
-        const std::streamoff size = file.tellg();
-        file.seekg(0, std::ios::beg);
-        gliml::context ctx;
-        ctx.enable_dxt(true);
-        VkDeviceSize bufferOffset = buffer->getPrivateData();
-        VkDeviceSize baseMipOffset = 0;
-        magma::mapRange<uint8_t>(buffer, bufferOffset, (VkDeviceSize)size,
-            [&](uint8_t *data)
-            {   // Read data to buffer
-                file.read(reinterpret_cast<char *>(data), size);
-                file.close();
-                if (!ctx.load(data, static_cast<unsigned>(size)))
-                    throw std::runtime_error("failed to load DDS texture");
-                // Skip DDS header
-                baseMipOffset = reinterpret_cast<const uint8_t *>(ctx.image_data(0, 0)) - data;
-            });
-        buffer->setPrivateData(bufferOffset + size);
-        // Setup texture data description
-        const uint8_t *firstMipData = (const uint8_t *)ctx.image_data(0, 0);
-        magma::Mipmap mipMap;
-        mipMap.reserve(ctx.num_mipmaps(0));
-        for (int level = 0; level < ctx.num_mipmaps(0); ++level)
-        {
-            const ptrdiff_t offset = (const uint8_t *)ctx.image_data(0, level) - firstMipData;
-            mipMap.emplace_back(
-                ctx.image_width(0, level),
-                ctx.image_height(0, level),
-                (VkDeviceSize)offset);
-        }
-        // Upload texture data from buffer
-        const magma::Image::CopyLayout bufferLayout{bufferOffset + baseMipOffset, 0, 0};
-        const VkFormat format = utilities::getBlockCompressedFormat(ctx);
-        auto image = std::make_unique<magma::Image2D>(cmdImageCopy, format, std::move(buffer), mipMap, bufferLayout);
-        // Create image view for shader
-        return std::make_unique<magma::UniqueImageView>(std::move(image));
-    }
-
     std::unique_ptr<magma::ImageView> loadTextureFromData(const std::string& filename)
     {   // Simple, but suboptimal way to load texture from host memory
         auto buffer = utilities::loadBinaryFile(filename);
@@ -167,21 +153,69 @@ public:
 
     void loadTextures()
     {
-    #ifdef BATCH_LOAD
-        constexpr VkDeviceSize bufferSize = 1024 * 1024;
-        auto buffer = std::make_unique<magma::SrcTransferBuffer>(device, bufferSize);
+    #if defined(ASYNC_LOAD)
         cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
         {
-            diffuse = loadTextureBatch("brick.dds", buffer);
-            lightmap = loadTextureBatch("spot.dds", buffer);
+            diffuse = TextureStreamer::createPlaceholder(cmdImageCopy, stagingRing, VK_IMAGE_VIEW_TYPE_2D);
+            lightmap = TextureStreamer::createPlaceholder(cmdImageCopy, stagingRing, VK_IMAGE_VIEW_TYPE_2D);
+        }
+        cmdImageCopy->end();
+        submitCopyImageCommands();
+        textureStreamer = std::make_unique<TextureStreamer>(device, graphicsQueue, stagingRing);
+        textureStreamer->load("brick.dds",
+            [this](std::unique_ptr<magma::ImageView> imageView)
+            {
+                diffuse = std::move(imageView);
+                setTable.diffuseImage = {diffuse, bilinearSampler};
+                createVertexBuffer(); // Aspect ratio of texture
+            });
+        textureStreamer->load("spot.dds",
+            [this](std::unique_ptr<magma::ImageView> imageView)
+            {
+                lightmap = std::move(imageView);
+                setTable.lightmapImage = {lightmap, bilinearSampler};
+            });
+    #elif defined(BATCH_LOAD)
+        cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        {   // Only mip tails are copied before the first frame
+            diffuseMips = std::make_unique<ProgressiveTexture>(device, "brick.dds", stagingRing, cmdImageCopy);
+            lightmapMips = std::make_unique<ProgressiveTexture>(device, "spot.dds", stagingRing, cmdImageCopy);
         }
         cmdImageCopy->end();
         submitCopyImageCommands();
+        diffuse = std::make_unique<magma::SharedImageView>(diffuseMips->getImage());
+        lightmap = std::make_unique<magma::SharedImageView>(lightmapMips->getImage());
+        diffuseMinLod = diffuseMips->getMinLod();
+        lightmapMinLod = lightmapMips->getMinLod();
     #else
         diffuse = loadTextureFromData("brick.dds");
         lightmap = loadTextureFromData("spot.dds");
-    #endif // BATCH_LOAD
+    #endif // ASYNC_LOAD
+    }
+
+#if !defined(ASYNC_LOAD) && defined(BATCH_LOAD)
+    void streamMipLevels()
+    {   // Raise resolution by one mip level per frame
+        if (diffuseMips->resident() && lightmapMips->resident())
+            return;
+        cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        {
+            diffuseMips->update(cmdImageCopy);
+            lightmapMips->update(cmdImageCopy);
+        }
+        cmdImageCopy->end();
+        submitCopyImageCommands();
+        if (diffuseMips->resident() && lightmapMips->resident())
+        {   // Copies have been completed, don't keep host copies of the largest levels
+            diffuseMips->releaseStagingBuffer();
+            lightmapMips->releaseStagingBuffer();
+        }
+        // Sample levels that have been uploaded
+        diffuseMinLod = diffuseMips->getMinLod();
+        lightmapMinLod = lightmapMips->getMinLod();
+        updateUniforms();
     }
+#endif // BATCH_LOAD
 
     void createSampler()
     {
@@ -3,6 +3,8 @@
 layout(binding = 0) uniform TexParameters {
     float lod;
     bool multitexture;
+    float diffuseMinLod;
+    float lightmapMinLod;
 } texParameters;
 
 layout(binding = 1) uniform sampler2D diffuse;
@@ -13,8 +15,9 @@ layout(location = 0) out vec4 oColor;
 
 void main()
 {
-    vec4 color = textureLod(diffuse, texCoord, texParameters.lod);
-    float mask = textureLod(lightmap, texCoord, texParameters.lod).r;
+    // Don't sample mip levels that are not uploaded yet
+    vec4 color = textureLod(diffuse, texCoord, max(texParameters.lod, texParameters.diffuseMinLod));
+    float mask = textureLod(lightmap, texCoord, max(texParameters.lod, texParameters.lightmapMinLod)).r;
     if (texParameters.multitexture)
         oColor = vec4(color.rgb * mask, 1.);
     else
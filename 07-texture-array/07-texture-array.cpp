@@ -1,8 +1,15 @@
-#include <fstream>
 #include "../framework/vulkanApp.h"
 #include "../framework/utilities.h"
+#include "../framework/textureStreamer.h"
 #include "quadric/include/cube.h"
 
+/* Map, parse and copy layers of texture array on all CPU cores
+   instead of loading them one after another. */
+#define PARALLEL_LOAD
+/* Repeat dice textures to measure how loading of texture array
+   scales with the number of layers (at most 256 are guaranteed). */
+//#define BENCHMARK_LAYER_COUNT 256
+
 // Use PgUp/PgDown to select texture lod
 class TextureArrayApp : public VulkanApp
 {
@@ -25,6 +32,7 @@ class TextureArrayApp : public VulkanApp
     std::unique_ptr<magma::UniformBuffer<TexParameters>> uniformTexParameters;
     std::unique_ptr<magma::DescriptorSet> descriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> graphicsPipeline;
+    std::unique_ptr<TextureStreamer> textureStreamer;
 
     rapid::matrix viewProj;
     float lod = 0.f;
@@ -49,6 +57,12 @@ public:
     void render(uint32_t bufferIndex) override
     {
         updatePerspectiveTransform();
+        if (textureStreamer->update())
+        {   // Replace placeholder
+            descriptorSet->update();
+            for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+                recordCommandBuffer(i);
+        }
         submitCommandBuffer(bufferIndex);
     }
 
@@ -129,73 +143,39 @@ public:
 
     void loadTextureArray(const std::initializer_list<std::string>& filenames)
     {
-        std::list<std::ifstream> files;
-        std::streamoff totalSize = 0;
+        std::vector<std::string> paths;
         for (const std::string& filename: filenames)
-        {   // Open binary stream
-            files.emplace_back("textures/" + filename, std::ios::in | std::ios::binary | std::ios::ate);
-            if (!files.back().is_open())
-                throw std::runtime_error("failed to open file \"" + filename + "\"");
-            totalSize += files.back().tellg();
-        }
-        std::list<gliml::context> ctxArray;
-        auto buffer = std::make_unique<magma::SrcTransferBuffer>(device, totalSize);
-        VkDeviceSize baseMipOffset = 0ull;
-        magma::map<uint8_t>(buffer, [&](uint8_t *data)
-        {   // Read all data to single buffer
-            for (auto& file: files)
-            {
-                const std::streamoff size = file.tellg();
-                file.seekg(0, std::ios::beg);
-                file.read(reinterpret_cast<char *>(data), size);
-                file.close();
-                ctxArray.emplace_back();
-                gliml::context& ctx = ctxArray.back();
-                ctx.enable_dxt(true);
-                if (!ctx.load(data, static_cast<unsigned>(size)))
-                    throw std::runtime_error("failed to load DDS texture");
-                // Skip DDS header of the first file
-                if (0ull == baseMipOffset)
-                    baseMipOffset = reinterpret_cast<const uint8_t *>(ctx.image_data(0, 0)) - data;
-                data += size;
-            }
-        });
-        const VkFormat format = utilities::getBlockCompressedFormat(ctxArray.front());
-        const VkExtent2D extent = {
-            (uint32_t)ctxArray.front().image_width(0, 0),
-            (uint32_t)ctxArray.front().image_height(0, 0)
-        };
-        // Assert that all files have the same format and dimensions
-        for (const auto& ctx: ctxArray)
-        {
-            MAGMA_ASSERT(utilities::getBlockCompressedFormat(ctx) == format);
-            MAGMA_ASSERT(static_cast<uint32_t>(ctx.image_width(0, 0)) == extent.width);
-            MAGMA_ASSERT(static_cast<uint32_t>(ctx.image_height(0, 0)) == extent.height);
-        }
-        // Setup texture array data description
-        const uint8_t *frontImageFirstMipData = (const uint8_t *)ctxArray.front().image_data(0, 0);
-        magma::Mipmap mipMap;
-        for (const auto& ctx: ctxArray)
-        {
-            for (int level = 0; level < ctx.num_mipmaps(0); ++level)
-            {
-                const ptrdiff_t offset = (const uint8_t *)ctx.image_data(0, level) - frontImageFirstMipData;
-                MAGMA_ASSERT(offset < (VkDeviceSize)totalSize);
-                mipMap.emplace_back(
-                    ctx.image_width(0, level),
-                    ctx.image_height(0, level),
-                    (VkDeviceSize)offset);
-            }
-        }
-        // Upload texture array data from buffer
+            paths.push_back("textures/" + filename);
+    #ifdef BENCHMARK_LAYER_COUNT
+        for (uint32_t i = (uint32_t)paths.size(); i < BENCHMARK_LAYER_COUNT; ++i)
+            paths.push_back(paths[i % filenames.size()]);
+    #endif
+        // Draw with placeholder until texture array is loaded in the background
         cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-        const magma::Image::CopyLayout bufferLayout{baseMipOffset, 0, 0};
-        auto imageArray = std::make_unique<magma::Image2DArray>(cmdImageCopy,
-            format, magma::core::countof(ctxArray), buffer, mipMap, bufferLayout);
+        imageArrayView = TextureStreamer::createPlaceholder(cmdImageCopy, stagingRing,
+            VK_IMAGE_VIEW_TYPE_2D_ARRAY, magma::core::countof(paths));
         cmdImageCopy->end();
         submitCopyImageCommands();
-        // Create image view for fragment shader
-        imageArrayView = std::make_unique<magma::UniqueImageView>(std::move(imageArray));
+    #ifdef PARALLEL_LOAD
+        constexpr bool parallel = true;
+    #else
+        constexpr bool parallel = false;
+    #endif
+        textureStreamer = std::make_unique<TextureStreamer>(device, graphicsQueue, stagingRing);
+        const uint32_t layerCount = magma::core::countof(paths);
+        const auto start = std::chrono::high_resolution_clock::now();
+        textureStreamer->loadArray(paths,
+            [this, layerCount, start, parallel](std::unique_ptr<magma::ImageView> imageView)
+            {   // Includes time of transfer and waiting for the next frame
+                const auto end = std::chrono::high_resolution_clock::now();
+                const auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+                std::cout << layerCount << " layers loaded "
+                    << (parallel ? "in parallel" : "serially") << " in "
+                    << us.count() * 0.001f << " ms" << std::endl;
+                imageArrayView = std::move(imageView);
+                setTable.imageArray = {imageArrayView, anisotropicSampler};
+            },
+            parallel);
     }
 
     void createSampler()
@@ -1,8 +1,22 @@
-#include <fstream>
 #include "../framework/vulkanApp.h"
 #include "../framework/utilities.h"
+#include "../framework/textureStreamer.h"
+#include "../framework/environmentPrefilter.h"
 #include "quadric/include/teapot.h"
 
+/* Generate diffuse and specular maps from environment
+   on GPU at load time instead of loading pre-baked ones. */
+#define PREFILTER_ENVIRONMENT
+/* Save prefiltered maps to disk and load them
+   next time until environment is modified. */
+#define CACHE_PREFILTERED
+
+#ifdef PREFILTER_ENVIRONMENT
+constexpr const char *environmentFileName = "spec.dds"; // Base level is mirror reflection
+constexpr const char *diffuseCacheFileName = "diff.prefiltered.ktx2";
+constexpr const char *specularCacheFileName = "spec.prefiltered.ktx2";
+#endif
+
 // Use L button + mouse to rotate scene
 class TextureCubeApp : public VulkanApp
 {
@@ -21,12 +35,14 @@ class TextureCubeApp : public VulkanApp
     } setTable;
 
     std::unique_ptr<quadric::Teapot> mesh;
-    std::unique_ptr<magma::ImageView> diffuse;
-    std::unique_ptr<magma::ImageView> specular;
+    std::shared_ptr<magma::ImageView> diffuse;
+    std::shared_ptr<magma::ImageView> specular;
     std::unique_ptr<magma::Sampler> anisotropicSampler;
     std::unique_ptr<magma::UniformBuffer<TransformMatrices>> uniformTransforms;
     std::unique_ptr<magma::DescriptorSet> descriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> graphicsPipeline;
+    std::unique_ptr<TextureStreamer> textureStreamer;
+    std::unique_ptr<EnvironmentPrefilter> environmentPrefilter;
 
     rapid::matrix view;
     rapid::matrix proj;
@@ -50,6 +66,12 @@ public:
     void render(uint32_t bufferIndex) override
     {
         updatePerspectiveTransform();
+        if (textureStreamer->update())
+        {   // Replace placeholders
+            descriptorSet->update();
+            for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+                recordCommandBuffer(i);
+        }
         submitCommandBuffer(bufferIndex);
     }
 
@@ -94,61 +116,79 @@ public:
         mesh = std::make_unique<quadric::Teapot>(subdivisionDegree, cmdBufferCopy);
     }
 
-    std::unique_ptr<magma::ImageView> loadCubeMap(const std::string& filename, const std::unique_ptr<magma::SrcTransferBuffer>& buffer)
-    {
-        std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-        if (!file.is_open())
-            throw std::runtime_error("failed to open file \"" + filename + "\"");
-        const std::streamoff size = file.tellg();
-        file.seekg(0, std::ios::beg);
-        gliml::context ctx;
-        ctx.enable_dxt(true);
-        VkDeviceSize bufferOffset = buffer->getPrivateData();
-        VkDeviceSize baseMipOffset = 0;
-        magma::mapRange<uint8_t>(buffer, bufferOffset, (VkDeviceSize)size,
-            [&](uint8_t *data)
-            {   // Read data from file
-                file.read(reinterpret_cast<char *>(data), size);
-                if (!ctx.load(data, static_cast<unsigned>(size)))
-                    throw std::runtime_error("failed to load DDS texture");
-                // Skip DDS header
-                baseMipOffset = reinterpret_cast<const uint8_t *>(ctx.image_data(0, 0)) - data;
-            });
-        buffer->setPrivateData(bufferOffset + size);
-        // Setup texture data description
-        const uint32_t dimension = ctx.image_width(0, 0);
-        const uint8_t *firstMipData = (const uint8_t *)ctx.image_data(0, 0);
-        magma::Mipmap mipMap;
-        mipMap.reserve(ctx.num_faces() * ctx.num_mipmaps(0));
-        for (int face = 0; face < ctx.num_faces(); ++face)
+    void loadCubeMaps()
+    {   // Draw with placeholders until cube maps are loaded in the background
+        cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
         {
-            for (int level = 0; level < ctx.num_mipmaps(face); ++level)
-            {
-                const ptrdiff_t offset = (const uint8_t *)ctx.image_data(face, level) - firstMipData;
-                mipMap.emplace_back(dimension, dimension, (VkDeviceSize)offset);
-            }
+            diffuse = TextureStreamer::createPlaceholder(cmdImageCopy, stagingRing, VK_IMAGE_VIEW_TYPE_CUBE);
+            specular = TextureStreamer::createPlaceholder(cmdImageCopy, stagingRing, VK_IMAGE_VIEW_TYPE_CUBE);
         }
-        // Upload texture data from buffer
-        const magma::Image::CopyLayout bufferLayout{bufferOffset + baseMipOffset, 0, 0};
-        const VkFormat format = utilities::getBlockCompressedFormat(ctx);
-        auto image = std::make_unique<magma::ImageCube>(cmdImageCopy,
-            format, std::move(buffer), mipMap, bufferLayout);
-        // Create image view for fragment shader
-        return std::make_unique<magma::UniqueImageView>(std::move(image));
+        cmdImageCopy->end();
+        submitCopyImageCommands();
+        textureStreamer = std::make_unique<TextureStreamer>(device, graphicsQueue, stagingRing);
+    #ifdef PREFILTER_ENVIRONMENT
+    #ifdef CACHE_PREFILTERED
+        if (EnvironmentPrefilter::cacheValid(diffuseCacheFileName, environmentFileName) &&
+            EnvironmentPrefilter::cacheValid(specularCacheFileName, environmentFileName))
+        {   // Prefiltered maps are loaded like pre-baked ones
+            streamCubeMaps(diffuseCacheFileName, specularCacheFileName);
+            return;
+        }
+    #endif // CACHE_PREFILTERED
+        textureStreamer->load(environmentFileName,
+            [this](std::unique_ptr<magma::ImageView> environment)
+            {
+                prefilterEnvironment(std::move(environment));
+            });
+    #else
+        streamCubeMaps("diff.dds", "spec.dds");
+    #endif // PREFILTER_ENVIRONMENT
     }
 
-    void loadCubeMaps()
+    void streamCubeMaps(const char *diffuseFileName, const char *specularFileName)
     {
-        constexpr VkDeviceSize bufferSize = 1024 * 1024;
-        auto buffer = std::make_unique<magma::SrcTransferBuffer>(device, bufferSize);
-        cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        textureStreamer->load(diffuseFileName,
+            [this](std::unique_ptr<magma::ImageView> imageView)
+            {
+                diffuse = std::move(imageView);
+                setTable.diffuse = {diffuse, anisotropicSampler};
+            });
+        textureStreamer->load(specularFileName,
+            [this](std::unique_ptr<magma::ImageView> imageView)
+            {
+                specular = std::move(imageView);
+                setTable.specular = {specular, anisotropicSampler};
+            });
+    }
+
+#ifdef PREFILTER_ENVIRONMENT
+    void prefilterEnvironment(std::shared_ptr<magma::ImageView> environment)
+    {   // Called by texture streamer when environment has been loaded
+        environmentPrefilter = std::make_unique<EnvironmentPrefilter>(device, std::move(environment), pipelineCache);
+        std::shared_ptr<magma::CommandBuffer> cmdBuffer = commandPools[0]->allocateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+        cmdBuffer->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
         {
-            diffuse = loadCubeMap("diff.dds", buffer);
-            specular = loadCubeMap("spec.dds", buffer);
+            environmentPrefilter->prefilter(cmdBuffer);
+        #ifdef CACHE_PREFILTERED
+            environmentPrefilter->readback(cmdBuffer);
+        #endif
         }
-        cmdImageCopy->end();
-        submitCopyImageCommands();
+        cmdBuffer->end();
+        const auto start = std::chrono::high_resolution_clock::now();
+        // Block until prefiltering is complete
+        magma::finish(cmdBuffer);
+        const auto end = std::chrono::high_resolution_clock::now();
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        std::cout << "environment prefiltered in " << ms.count() << " ms" << std::endl;
+    #ifdef CACHE_PREFILTERED
+        environmentPrefilter->save(diffuseCacheFileName, specularCacheFileName);
+    #endif
+        diffuse = environmentPrefilter->getIrradiance();
+        specular = environmentPrefilter->getSpecular();
+        setTable.diffuse = {diffuse, anisotropicSampler};
+        setTable.specular = {specular, anisotropicSampler};
     }
+#endif // PREFILTER_ENVIRONMENT
 
     void createSampler()
     {
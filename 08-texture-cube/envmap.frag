@@ -23,6 +23,9 @@ void main()
     float power = 2.0;
     float factor = fresnelApprox(I, N, bias, scale, power);
     vec3 diff = texture(envDiff, R).rgb;
-    vec3 spec = texture(envSpec, R).rgb;
+    // Levels of specular map are prefiltered with increasing roughness
+    const float roughness = 0.2;
+    float lod = roughness * float(textureQueryLevels(envSpec) - 1);
+    vec3 spec = textureLod(envSpec, R, lod).rgb;
     oColor = vec4(mix(diff, spec, factor), 1.);
 }
@@ -1,13 +1,25 @@
 #include <fstream>
+#include <cmath>
 #include "../framework/vulkanApp.h"
+#include "../framework/dynamicResolution.h"
+#include "brickedVolume.h"
 
 // Use PgUp/PgDown to change accomodation power
+// Space toggles adaptive resolution, Tab switches upscale filter
+// Press 1 to toggle empty space skipping, 2 - early ray termination, 3 - adaptive sampling
 class TextureVolumeApp : public VulkanApp
 {
     struct alignas(16) UniformParameters
     {
         float power;
         float aspectRatio;
+        VkBool32 skipEmptySpace;
+        VkBool32 earlyTermination;
+        VkBool32 adaptiveSampling;
+        float terminationOpacity;
+        float maxStepScale;
+        float padding;
+        rapid::float4 volumeExtent;
     };
 
     struct DescriptorSetTable
@@ -16,9 +28,11 @@ class TextureVolumeApp : public VulkanApp
         magma::descriptor::UniformBuffer integrationParameters = 1;
         magma::descriptor::CombinedImageSampler volume = 2;
         magma::descriptor::CombinedImageSampler lookup = 3;
+        magma::descriptor::CombinedImageSampler occupancy = 4;
+        magma::descriptor::CombinedImageSampler pageTable = 5;
     } setTable;
 
-    std::unique_ptr<magma::ImageView> volume;
+    std::unique_ptr<BrickedVolume> volume;
     std::unique_ptr<magma::ImageView> lookup;
     std::unique_ptr<magma::Sampler> nearestSampler;
     std::unique_ptr<magma::Sampler> trilinearSampler;
@@ -26,27 +40,47 @@ class TextureVolumeApp : public VulkanApp
     std::unique_ptr<magma::UniformBuffer<UniformParameters>> uniformParameters;
     std::unique_ptr<magma::DescriptorSet> descriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> graphicsPipeline;
+    std::unique_ptr<DynamicResolution> dynamicResolution;
 
+    std::vector<bool> outdatedCommandBuffers;
+    std::vector<uint8_t> opacity;
     float power = 0.4f;
+    bool skipEmptySpace = true;
+    bool earlyTermination = true;
+    bool adaptiveSampling = true;
+    float baselineGpuTime = 0.f;
+    float baselineScale = 0.f;
+    uint32_t lastPrintFrame = 0;
 
 public:
     TextureVolumeApp(const AppEntry& entry):
         VulkanApp(entry, TEXT("09 - Volume texture"), 512, 512)
     {
         initialize();
+        createDynamicResolution();
         loadTextures();
         createSampler();
         createUniformBuffers();
         setupDescriptorSet();
         setupPipeline();
-        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
-            recordCommandBuffer(i);
+        outdatedCommandBuffers.resize(commandBuffers.size(), true);
     }
 
     void render(uint32_t bufferIndex) override
     {
         updateTransform();
+        if (volume->stream(cmdImageCopy))
+            submitCopyImageCommands();
+        if (dynamicResolution->update())
+            invalidateCommandBuffers();
+        if (outdatedCommandBuffers[bufferIndex])
+        {
+            recordCommandBuffer(bufferIndex);
+            outdatedCommandBuffers[bufferIndex] = false;
+        }
         submitCommandBuffer(bufferIndex);
+        dynamicResolution->submitted(bufferIndex);
+        printStatistics();
     }
 
     void onKeyDown(char key, int repeat, uint32_t flags) override
@@ -68,6 +102,25 @@ public:
             }
             break;
         case AppKey::Space:
+            dynamicResolution->setAdaptive(!dynamicResolution->getAdaptive());
+            std::cout << "adaptive resolution " << (dynamicResolution->getAdaptive() ? "on" : "off") << std::endl;
+            invalidateCommandBuffers();
+            break;
+        case '1':
+            toggleOption(skipEmptySpace, "empty space skipping");
+            break;
+        case '2':
+            toggleOption(earlyTermination, "early ray termination");
+            break;
+        case '3':
+            toggleOption(adaptiveSampling, "adaptive sampling");
+            break;
+        case AppKey::Tab:
+            if (DynamicResolution::Filter::Bilinear == dynamicResolution->getFilter())
+                dynamicResolution->setFilter(DynamicResolution::Filter::EdgeAware);
+            else
+                dynamicResolution->setFilter(DynamicResolution::Filter::Bilinear);
+            invalidateCommandBuffers();
             break;
         }
         VulkanApp::onKeyDown(key, repeat, flags);
@@ -76,21 +129,69 @@ public:
     void onResize(uint32_t width, uint32_t height) override
     {
         VulkanApp::onResize(width, height);
+        dynamicResolution->resize({width, height});
+        updateUniforms();
+        invalidateCommandBuffers();
+    }
+
+    void toggleOption(bool& option, const char *name)
+    {   // Compare GPU time before and after at the same render scale
+        option = !option;
+        std::cout << name << " " << (option ? "on" : "off") << std::endl;
+        baselineGpuTime = dynamicResolution->getGpuTime();
+        baselineScale = dynamicResolution->getScale();
+        lastPrintFrame = frameCount;
         updateUniforms();
-        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
-            recordCommandBuffer(i);
+    }
+
+    void invalidateCommandBuffers()
+    {   // Re-record lazily before the next submission of each buffer
+        std::fill(outdatedCommandBuffers.begin(), outdatedCommandBuffers.end(), true);
+    }
+
+    void printStatistics()
+    {   // Print once in a while to not flood the console
+        constexpr uint32_t printInterval = 100; // In frames
+        if (frameCount - lastPrintFrame >= printInterval)
+        {
+            const VkExtent2D renderExtent = dynamicResolution->getRenderExtent();
+            std::cout << "GPU time: " << dynamicResolution->getGpuTime() << " ms, "
+                << "render scale: " << dynamicResolution->getScale()
+                << " (" << renderExtent.width << "x" << renderExtent.height << ")" << std::endl;
+            std::cout << "bricks: " << volume->getResidentCount() << " resident, "
+                << volume->getEmptyCount() << " empty of " << volume->getBrickCount() << ", "
+                << "pool: " << volume->getSlotCount() << " slots ("
+                << volume->getPoolSize()/(1024 * 1024) << " MB)" << std::endl;
+            if (baselineGpuTime > 0.f)
+            {
+                if (dynamicResolution->getScale() == baselineScale)
+                    std::cout << "GPU time delta: " << dynamicResolution->getGpuTime() - baselineGpuTime << " ms" << std::endl;
+                else // Turn adaptive resolution off with Space for comparison
+                    std::cout << "render scale changed, GPU time delta is unavailable" << std::endl;
+                baselineGpuTime = 0.f;
+            }
+            lastPrintFrame = frameCount;
+        }
     }
 
     void updateTransform()
     {
-        const rapid::matrix pitch = rapid::rotationX(rapid::radians(-spinY/2.f));
-        const rapid::matrix yaw = rapid::rotationY(rapid::radians(spinX/2.f));
+        const float pitchAngle = rapid::radians(-spinY/2.f);
+        const float yawAngle = rapid::radians(spinX/2.f);
+        const rapid::matrix pitch = rapid::rotationX(pitchAngle);
+        const rapid::matrix yaw = rapid::rotationY(yawAngle);
         const rapid::matrix world = pitch * yaw;
         magma::map(uniformBuffer,
             [this, &world](auto *normal)
             {
                 *normal = rapid::transpose(rapid::inverse(world));
             });
+        // Ray origin (0, 0, -5) transformed to local space of the volume, see raycast.frag
+        const rapid::float3 eye(
+            -5.f * std::cos(pitchAngle) * std::sin(yawAngle),
+            5.f * std::sin(pitchAngle),
+            -5.f * std::cos(pitchAngle) * std::cos(yawAngle));
+        volume->updateVisibility(eye, width/(float)height);
     }
 
     void updateUniforms()
@@ -100,82 +201,82 @@ public:
             {
                 block->power = power;
                 block->aspectRatio = width/(float)height;
+                block->skipEmptySpace = skipEmptySpace;
+                block->earlyTermination = earlyTermination;
+                block->adaptiveSampling = adaptiveSampling;
+                block->terminationOpacity = 0.95f;
+                block->maxStepScale = 4.f; // One voxel
+                const VkExtent3D& extent = volume->getExtent();
+                block->volumeExtent = rapid::float4((float)extent.width, (float)extent.height, (float)extent.depth, 0.f);
             });
     }
 
-    std::unique_ptr<magma::ImageView> loadVolumeTexture(const std::string& filename, uint32_t width, uint32_t height, uint32_t depth, const std::unique_ptr<magma::SrcTransferBuffer>& buffer)
-    {
-        std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-        if (!file.is_open())
-        {
-            std::ifstream zipfile(filename + ".zip", std::ios::in | std::ios::binary | std::ios::ate);
-            if (!zipfile.is_open())
-                throw std::runtime_error("failed to open file \"" + filename + "\"");
-            else
-                throw std::runtime_error("unpack \"" + filename + ".zip\" before running sample");
-        }
-        const std::streamoff size = file.tellg();
-        MAGMA_ASSERT(size == width * height * depth);
-        file.seekg(0, std::ios::beg);
-        VkDeviceSize bufferOffset = buffer->getPrivateData();
-        magma::mapRange<uint8_t>(buffer, bufferOffset, (VkDeviceSize)size,
-            [&file, size](uint8_t *data)
-            {   // Read data to buffer
-                file.read(reinterpret_cast<char *>(data), size);
-                file.close();
-            });
-        buffer->setPrivateData(bufferOffset + size);
-        // Setup texture data description
-        magma::Image::Mip volumeMip;
-        volumeMip.extent = VkExtent3D{width, height, depth};
-        volumeMip.bufferOffset = 0;
-        const magma::Mipmap mipMap = {volumeMip};
-        const magma::Image::CopyLayout bufferLayout{bufferOffset, 0, 0};
-        // Upload volume data from buffer
-        auto image = std::make_unique<magma::Image3D>(cmdImageCopy, VK_FORMAT_R8_UNORM, std::move(buffer), mipMap, bufferLayout);
-        // Create image view for shader
-        return std::make_unique<magma::UniqueImageView>(std::move(image));
-    }
-
-    std::unique_ptr<magma::ImageView> loadTransferFunctionTexture(const std::string& filename, uint32_t width, const std::unique_ptr<magma::SrcTransferBuffer>& buffer)
+    std::unique_ptr<magma::ImageView> loadTransferFunctionTexture(const std::string& filename, uint32_t width)
     {
         std::ifstream file(filename, std::ifstream::in);
         if (!file.is_open())
             throw std::runtime_error("failed to open file \"" + filename + "\"");
         const VkDeviceSize size = width * sizeof(uint32_t);
-        VkDeviceSize bufferOffset = buffer->getPrivateData();
-        magma::mapRange<uint8_t>(buffer, bufferOffset, size,
-            [&file, size](uint8_t *data)
-            {
-                memset(data, 0, size); // Clear first as not an entire buffer may be filled
-                file.read(reinterpret_cast<char *>(data), size);
-                file.close();
-            });
-        buffer->setPrivateData(bufferOffset + size);
+        std::vector<uint8_t> colors((size_t)size, 0); // Not an entire table may be filled
+        file.read(reinterpret_cast<char *>(colors.data()), size);
+        file.close();
+        // Keep opacity to find out empty bricks and macro cells
+        opacity.resize(width);
+        for (uint32_t i = 0; i < width; ++i)
+            opacity[i] = colors[i * 4 + 3];
+        const StagingRing::Allocation staging = stagingRing->allocate(size, cmdImageCopy);
+        memcpy(staging.data, colors.data(), colors.size());
         // Upload texture data from buffer
         magma::Image::Mip mip;
         mip.extent = {width, 1, 1};
         mip.bufferOffset = 0;
         const magma::Mipmap mipMap = {mip};
-        const magma::Image::CopyLayout bufferLayout{bufferOffset, 0, 0};
-        auto image = std::make_unique<magma::Image1D>(cmdImageCopy, VK_FORMAT_R8G8B8A8_UNORM, std::move(buffer), mipMap, bufferLayout);
+        const magma::Image::CopyLayout bufferLayout{staging.offset, 0, 0};
+        auto image = std::make_unique<magma::Image1D>(cmdImageCopy, VK_FORMAT_R8G8B8A8_UNORM, stagingRing->getBuffer(), mipMap, bufferLayout);
         // Create image view for shader
         return std::make_unique<magma::UniqueImageView>(std::move(image));
     }
 
     void loadTextures()
     {
-        constexpr VkDeviceSize bufferSize = 16 * 1024 * 1024;
-        auto buffer = std::make_unique<magma::SrcTransferBuffer>(device, bufferSize);
         cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
         {
-            volume = loadVolumeTexture("head256.raw", 256, 256, 225, buffer);
-            lookup = loadTransferFunctionTexture("tff.dat", 256, buffer);
+            lookup = loadTransferFunctionTexture("tff.dat", 256);
+            /* Volume is streamed brick by brick from mapped file, nothing is read here.
+               Pool of 8x8x8 bricks is enough to keep this dataset entirely,
+               larger ones are kept partially, nearest to the viewer first. */
+            constexpr uint32_t bricksPerFrame = 32;
+            volume = std::make_unique<BrickedVolume>(device, "head256.raw",
+                VkExtent3D{256, 256, 225}, VkExtent3D{8, 8, 8},
+                bricksPerFrame, opacity, stagingRing, cmdImageCopy);
         }
         cmdImageCopy->end();
         submitCopyImageCommands();
     }
 
+    void createDynamicResolution()
+    {   // Ray marching is fill-rate bound, so trade resolution for stable frame rate
+        constexpr float frameTimeBudget = 8.f; // In milliseconds
+        dynamicResolution = std::make_unique<DynamicResolution>(device, descriptorPool,
+            renderPass, pipelineCache,
+            "quad",
+            VkExtent2D{width, height},
+            (uint32_t)commandBuffers.size(),
+            frameTimeBudget);
+        if (!dynamicResolution->timestampsSupported())
+            std::cout << "timestamps not supported, render scale is fixed" << std::endl;
+    }
+
+    void createDescriptorPool() override
+    {   // Ray marching and upscale sets
+        constexpr uint32_t maxDescriptorSets = 2;
+        descriptorPool = std::make_shared<magma::DescriptorPool>(device, maxDescriptorSets,
+            std::initializer_list<VkDescriptorPoolSize>{
+                magma::descriptor::UniformBufferPoolSize(2),
+                magma::descriptor::CombinedImageSamplerPoolSize(5)
+            });
+    }
+
     void createSampler()
     {
         nearestSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipNearestClampToEdge);
@@ -193,8 +294,10 @@ public:
     {
         setTable.normalMatrix = uniformBuffer;
         setTable.integrationParameters = uniformParameters;
-        setTable.volume = {volume, trilinearSampler};
+        setTable.volume = {volume->getPool(), trilinearSampler};
         setTable.lookup = {lookup, nearestSampler};
+        setTable.occupancy = {volume->getOccupancy(), nearestSampler};
+        setTable.pageTable = {volume->getPageTable(), nearestSampler};
         descriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
             setTable, VK_SHADER_STAGE_FRAGMENT_BIT,
             nullptr, 0, shaderReflectionFactory, "raycast");
@@ -212,23 +315,27 @@ public:
             magma::renderstate::depthAlwaysDontWrite,
             magma::renderstate::dontBlendRgb,
             std::move(layout),
-            renderPass, 0,
+            dynamicResolution->getRenderPass(), 0,
             pipelineCache);
     }
 
     void recordCommandBuffer(uint32_t index)
     {
         auto& cmdBuffer = commandBuffers[index];
+        cmdBuffer->reset(false);
         cmdBuffer->begin();
-        {
-            cmdBuffer->beginRenderPass(renderPass, framebuffers[index], {magma::clear::white});
+        {   // Ray march at render scale, viewport is set by dynamic resolution
+            dynamicResolution->beginScene(cmdBuffer, index, magma::clear::white);
             {
-                cmdBuffer->setViewport(0, 0, width, height);
-                cmdBuffer->setScissor(0, 0, width, height);
                 cmdBuffer->bindDescriptorSet(graphicsPipeline, 0, descriptorSet);
                 cmdBuffer->bindPipeline(graphicsPipeline);
                 cmdBuffer->draw(4, 0);
             }
+            dynamicResolution->endScene(cmdBuffer, index);
+            cmdBuffer->beginRenderPass(renderPass, framebuffers[index], {magma::clear::white});
+            {
+                dynamicResolution->upscale(cmdBuffer, {width, height});
+            }
             cmdBuffer->endRenderPass();
         }
         cmdBuffer->end();
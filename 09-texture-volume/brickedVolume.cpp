@@ -0,0 +1,340 @@
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include "brickedVolume.h"
+
+constexpr VkDeviceSize brickBytes = BrickedVolume::physicalBrickSize * BrickedVolume::physicalBrickSize * BrickedVolume::physicalBrickSize;
+
+BrickedVolume::BrickedVolume(std::shared_ptr<magma::Device> device,
+    const std::string& filename,
+    const VkExtent3D& extent,
+    const VkExtent3D& poolExtent,
+    uint32_t bricksPerFrame,
+    const std::vector<uint8_t>& opacity,
+    std::shared_ptr<StagingRing> stagingRing,
+    const std::shared_ptr<magma::CommandBuffer>& cmdImageCopy):
+    device(std::move(device)),
+    stagingRing(std::move(stagingRing)),
+    extent(extent),
+    bricksPerFrame(bricksPerFrame)
+{
+    if (!file.map(filename, utilities::FileView::Access::Random)) // Bricks are scattered across the file
+    {
+        std::ifstream zipfile(filename + ".zip", std::ios::in | std::ios::binary | std::ios::ate);
+        if (!zipfile.is_open())
+            throw std::runtime_error("failed to open file \"" + filename + "\"");
+        else
+            throw std::runtime_error("unpack \"" + filename + ".zip\" before running sample");
+    }
+    if (file.size() < (std::size_t)extent.width * extent.height * extent.depth)
+        throw std::runtime_error("size of file \"" + filename + "\" doesn't match volume extent");
+    brickGrid.width = (extent.width + brickSize - 1)/brickSize;
+    brickGrid.height = (extent.height + brickSize - 1)/brickSize;
+    brickGrid.depth = (extent.depth + brickSize - 1)/brickSize;
+    bricks.resize(brickGrid.width * brickGrid.height * brickGrid.depth);
+    // Pool is a single 3D image, so its size is limited by the device
+    const VkPhysicalDeviceProperties properties = this->device->getPhysicalDevice()->getProperties();
+    const uint32_t maxBricks = properties.limits.maxImageDimension3D/physicalBrickSize;
+    this->poolExtent.width = std::min(poolExtent.width, maxBricks);
+    this->poolExtent.height = std::min(poolExtent.height, maxBricks);
+    this->poolExtent.depth = std::min(poolExtent.depth, maxBricks);
+    slots.resize(this->poolExtent.width * this->poolExtent.height * this->poolExtent.depth, InvalidIndex);
+    // Cell is empty if transfer function is transparent in the whole intensity range of the cell
+    const uint32_t tableSize = (uint32_t)opacity.size();
+    opaqueCount.resize(tableSize + 1, 0);
+    for (uint32_t i = 0; i < tableSize; ++i)
+        opaqueCount[i + 1] = opaqueCount[i] + (opacity[i] ? 1 : 0);
+    constexpr VkDeviceSize cellBytes = cellsPerBrick * cellsPerBrick * cellsPerBrick;
+    const VkDeviceSize pageTableSize = bricks.size() * sizeof(PageEntry);
+    const VkDeviceSize occupancySize = bricks.size() * cellBytes;
+    const StagingRing::Allocation staging = this->stagingRing->allocate(pageTableSize + occupancySize, cmdImageCopy);
+    // No brick is resident and all cells are empty
+    memset(staging.data, 0, (std::size_t)(pageTableSize + occupancySize));
+    pageTable = createTexture(VK_FORMAT_R8G8B8A8_UINT, brickGrid, staging.offset, cmdImageCopy);
+    const VkExtent3D gridExtent = {
+        brickGrid.width * cellsPerBrick,
+        brickGrid.height * cellsPerBrick,
+        brickGrid.depth * cellsPerBrick};
+    occupancy = createTexture(VK_FORMAT_R8_UNORM, gridExtent, staging.offset + pageTableSize, cmdImageCopy);
+    // Content of the pool is filled on demand and never sampled until brick becomes resident
+    const VkExtent3D poolVoxels = {
+        this->poolExtent.width * physicalBrickSize,
+        this->poolExtent.height * physicalBrickSize,
+        this->poolExtent.depth * physicalBrickSize};
+    std::unique_ptr<magma::Image> image = std::make_unique<magma::Image3D>(this->device, VK_FORMAT_R8_UNORM, poolVoxels);
+    image->layoutTransition(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, cmdImageCopy);
+    pool = std::make_unique<magma::UniqueImageView>(std::move(image));
+}
+
+VkDeviceSize BrickedVolume::getPoolSize() const noexcept
+{
+    return slots.size() * brickBytes;
+}
+
+void BrickedVolume::updateVisibility(const rapid::float3& eye, float aspectRatio)
+{   // Camera looks at the center of the volume, ray directions are (x * aspectRatio, y, 3), see raycast.frag
+    const float tanHalfAngle = std::sqrt(aspectRatio * aspectRatio + 1.f)/3.f;
+    const float cosHalfAngle = 1.f/std::sqrt(1.f + tanHalfAngle * tanHalfAngle);
+    const float sinHalfAngle = tanHalfAngle * cosHalfAngle;
+    // To texture space: [-1, 1] -> [0, 1], swap Y/Z axes
+    const float ex = eye.x * .5f + .5f;
+    const float ey = eye.z * .5f + .5f;
+    const float ez = eye.y * .5f + .5f;
+    const float eyeDistance = std::sqrt((.5f - ex) * (.5f - ex) + (.5f - ey) * (.5f - ey) + (.5f - ez) * (.5f - ez));
+    const float ax = (.5f - ex)/eyeDistance;
+    const float ay = (.5f - ey)/eyeDistance;
+    const float az = (.5f - ez)/eyeDistance;
+    ++frame;
+    requests.clear();
+    uint32_t index = 0;
+    for (uint32_t bz = 0; bz < brickGrid.depth; ++bz)
+    for (uint32_t by = 0; by < brickGrid.height; ++by)
+    for (uint32_t bx = 0; bx < brickGrid.width; ++bx, ++index)
+    {   // Bounding box of the brick in texture space, last bricks may be partial
+        const float x0 = bx * brickSize/(float)extent.width;
+        const float y0 = by * brickSize/(float)extent.height;
+        const float z0 = bz * brickSize/(float)extent.depth;
+        const float x1 = std::min((bx + 1) * brickSize, extent.width)/(float)extent.width;
+        const float y1 = std::min((by + 1) * brickSize, extent.height)/(float)extent.height;
+        const float z1 = std::min((bz + 1) * brickSize, extent.depth)/(float)extent.depth;
+        const float radius = std::sqrt((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0) + (z1 - z0) * (z1 - z0)) * .5f;
+        const float vx = (x0 + x1) * .5f - ex;
+        const float vy = (y0 + y1) * .5f - ey;
+        const float vz = (z0 + z1) * .5f - ez;
+        const float distanceSquared = vx * vx + vy * vy + vz * vz;
+        const float along = vx * ax + vy * ay + vz * az;
+        const float across = std::sqrt(std::max(distanceSquared - along * along, 0.f));
+        // Conservative test of bounding sphere against view cone
+        if (across * cosHalfAngle - along * sinHalfAngle > radius)
+            continue;
+        Brick& brick = bricks[index];
+        brick.lastVisibleFrame = frame;
+        brick.distance = std::sqrt(distanceSquared);
+        if (PageState::NotResident == brick.state)
+            requests.push_back(index);
+    }
+    // Front-to-back, nearest bricks occlude the rest
+    std::sort(requests.begin(), requests.end(),
+        [this](uint32_t a, uint32_t b)
+        {
+            return bricks[a].distance < bricks[b].distance;
+        });
+}
+
+bool BrickedVolume::stream(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+{
+    if (requests.empty())
+        return false;
+    constexpr uint32_t cellCount = cellsPerBrick * cellsPerBrick * cellsPerBrick;
+    const VkDeviceSize occupancyOffset = bricksPerFrame * brickBytes;
+    const VkDeviceSize pageOffset = occupancyOffset + bricksPerFrame * cellCount;
+    const VkDeviceSize streamingSize = pageOffset + bricksPerFrame * sizeof(PageEntry) * 2;
+    std::vector<VkBufferImageCopy> brickRegions, cellRegions, pageRegions;
+    VkBufferImageCopy region = {};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    pageUpdates.clear();
+    // Staging memory is reclaimed when copy commands are completed
+    const StagingRing::Allocation staging = stagingRing->allocate(streamingSize, cmdBuffer);
+    uint8_t *data = staging.data;
+    // Gather to system memory first as staging buffer may be write-combined
+    std::vector<uint8_t> brickVoxels((std::size_t)brickBytes);
+    MacroCell cells[cellCount];
+    uint32_t processedCount = 0;
+    for (uint32_t index: requests)
+    {
+        if (processedCount == bricksPerFrame)
+            break;
+        ++processedCount;
+        const uint32_t bx = index % brickGrid.width;
+        const uint32_t by = index/brickGrid.width % brickGrid.height;
+        const uint32_t bz = index/(brickGrid.width * brickGrid.height);
+        gatherBrick(bx, by, bz, brickVoxels.data());
+        computeMacroCells(brickVoxels.data(), cells);
+        Brick& brick = bricks[index];
+        if (std::all_of(cells, cells + cellCount, [this](const MacroCell& cell) { return transparent(cell); }))
+        {   // Never occupies the pool
+            brick.state = PageState::Empty;
+            ++emptyCount;
+            updatePage(index);
+            continue;
+        }
+        const uint32_t slot = allocateSlot(brick.distance);
+        if (InvalidIndex == slot)
+            break; // Pool is occupied by nearer bricks
+        slots[slot] = index;
+        brick.state = PageState::Resident;
+        brick.slot = slot;
+        ++residentCount;
+        updatePage(index);
+        const uint32_t uploadIndex = (uint32_t)brickRegions.size();
+        memcpy(data + uploadIndex * brickBytes, brickVoxels.data(), (std::size_t)brickBytes);
+        uint8_t *cellData = data + occupancyOffset + uploadIndex * cellCount;
+        for (const MacroCell& cell: cells)
+            *cellData++ = transparent(cell) ? 0 : 255;
+        region.bufferOffset = staging.offset + uploadIndex * brickBytes;
+        region.imageOffset.x = slot % poolExtent.width * physicalBrickSize;
+        region.imageOffset.y = slot/poolExtent.width % poolExtent.height * physicalBrickSize;
+        region.imageOffset.z = slot/(poolExtent.width * poolExtent.height) * physicalBrickSize;
+        region.imageExtent = {physicalBrickSize, physicalBrickSize, physicalBrickSize};
+        brickRegions.push_back(region);
+        region.bufferOffset = staging.offset + occupancyOffset + uploadIndex * cellCount;
+        region.imageOffset = {int32_t(bx * cellsPerBrick), int32_t(by * cellsPerBrick), int32_t(bz * cellsPerBrick)};
+        region.imageExtent = {cellsPerBrick, cellsPerBrick, cellsPerBrick};
+        cellRegions.push_back(region);
+    }
+    // Update page table entry by entry, evicted bricks are included
+    for (uint32_t index: pageUpdates)
+    {
+        const Brick& brick = bricks[index];
+        PageEntry entry = {};
+        if (PageState::Resident == brick.state)
+        {
+            entry.x = uint8_t(brick.slot % poolExtent.width);
+            entry.y = uint8_t(brick.slot/poolExtent.width % poolExtent.height);
+            entry.z = uint8_t(brick.slot/(poolExtent.width * poolExtent.height));
+        }
+        entry.state = brick.state;
+        const VkDeviceSize entryOffset = pageOffset + pageRegions.size() * sizeof(PageEntry);
+        memcpy(data + entryOffset, &entry, sizeof(PageEntry));
+        region.bufferOffset = staging.offset + entryOffset;
+        region.imageOffset.x = index % brickGrid.width;
+        region.imageOffset.y = index/brickGrid.width % brickGrid.height;
+        region.imageOffset.z = index/(brickGrid.width * brickGrid.height);
+        region.imageExtent = {1, 1, 1};
+        pageRegions.push_back(region);
+    }
+    // Not yet streamed bricks will be requested again
+    requests.clear();
+    if (pageRegions.empty())
+    {
+        stagingRing->release(cmdBuffer);
+        return false;
+    }
+    cmdBuffer->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    {
+        copyRegions(cmdBuffer, pool, brickRegions);
+        copyRegions(cmdBuffer, occupancy, cellRegions);
+        copyRegions(cmdBuffer, pageTable, pageRegions);
+    }
+    cmdBuffer->end();
+    return true;
+}
+
+void BrickedVolume::gatherBrick(uint32_t bx, uint32_t by, uint32_t bz, uint8_t *data) const noexcept
+{   // Apron outside of the volume replicates edge voxels like clamp-to-edge sampler does
+    const int32_t x0 = int32_t(bx * brickSize) - int32_t(apron);
+    const int32_t y0 = int32_t(by * brickSize) - int32_t(apron);
+    const int32_t z0 = int32_t(bz * brickSize) - int32_t(apron);
+    const int32_t first = std::max(x0, 0);
+    const int32_t last = std::min(x0 + int32_t(physicalBrickSize), int32_t(extent.width)) - 1;
+    for (int32_t z = z0; z < z0 + int32_t(physicalBrickSize); ++z)
+    for (int32_t y = y0; y < y0 + int32_t(physicalBrickSize); ++y)
+    {
+        const std::size_t sz = std::clamp(z, 0, int32_t(extent.depth) - 1);
+        const std::size_t sy = std::clamp(y, 0, int32_t(extent.height) - 1);
+        const uint8_t *row = file.data() + (sz * extent.height + sy) * extent.width;
+        // Interior of the row is contiguous in the file
+        memcpy(data + (first - x0), row + first, last - first + 1);
+        for (int32_t x = x0; x < first; ++x)
+            data[x - x0] = row[0];
+        for (int32_t x = last + 1; x < x0 + int32_t(physicalBrickSize); ++x)
+            data[x - x0] = row[extent.width - 1];
+        data += physicalBrickSize;
+    }
+}
+
+void BrickedVolume::computeMacroCells(const uint8_t *data, MacroCell *cells) const noexcept
+{   /* Trilinear filter blends voxels of adjacent cells,
+       so range of each cell is extended by one voxel in every direction.
+       Apron of the brick provides voxels of neighbour bricks. */
+    for (uint32_t cz = 0; cz < cellsPerBrick; ++cz)
+    for (uint32_t cy = 0; cy < cellsPerBrick; ++cy)
+    for (uint32_t cx = 0; cx < cellsPerBrick; ++cx, ++cells)
+    {
+        uint8_t minIntensity = 255, maxIntensity = 0;
+        for (uint32_t z = cz * cellSize; z < (cz + 1) * cellSize + apron * 2; ++z)
+        for (uint32_t y = cy * cellSize; y < (cy + 1) * cellSize + apron * 2; ++y)
+        {
+            const uint8_t *row = data + (z * physicalBrickSize + y) * physicalBrickSize;
+            for (uint32_t x = cx * cellSize; x < (cx + 1) * cellSize + apron * 2; ++x)
+            {
+                minIntensity = std::min(minIntensity, row[x]);
+                maxIntensity = std::max(maxIntensity, row[x]);
+            }
+        }
+        cells->minIntensity = minIntensity;
+        cells->maxIntensity = maxIntensity;
+    }
+}
+
+bool BrickedVolume::transparent(const MacroCell& cell) const noexcept
+{   // Lookup texture is sampled with nearest filter
+    const uint32_t tableSize = (uint32_t)opaqueCount.size() - 1;
+    const uint32_t first = std::min(cell.minIntensity * tableSize/255, tableSize - 1);
+    const uint32_t last = std::min(cell.maxIntensity * tableSize/255, tableSize - 1);
+    return opaqueCount[last + 1] == opaqueCount[first];
+}
+
+uint32_t BrickedVolume::allocateSlot(float distance)
+{   // Prefer least recently visible brick, otherwise the farthest one
+    uint32_t victim = InvalidIndex;
+    uint32_t oldestFrame = frame;
+    float farthest = distance;
+    for (uint32_t slot = 0; slot < (uint32_t)slots.size(); ++slot)
+    {
+        if (InvalidIndex == slots[slot])
+            return slot;
+        const Brick& brick = bricks[slots[slot]];
+        if (brick.lastVisibleFrame < oldestFrame)
+        {
+            oldestFrame = brick.lastVisibleFrame;
+            victim = slot;
+        }
+        else if (oldestFrame == frame && brick.distance > farthest)
+        {
+            farthest = brick.distance;
+            victim = slot;
+        }
+    }
+    if (victim != InvalidIndex)
+        evict(victim);
+    return victim;
+}
+
+void BrickedVolume::evict(uint32_t slot)
+{
+    const uint32_t index = slots[slot];
+    bricks[index].state = PageState::NotResident;
+    --residentCount;
+    updatePage(index);
+    slots[slot] = InvalidIndex;
+}
+
+void BrickedVolume::updatePage(uint32_t brick)
+{
+    pageUpdates.push_back(brick);
+}
+
+void BrickedVolume::copyRegions(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, const std::unique_ptr<magma::ImageView>& imageView,
+    const std::vector<VkBufferImageCopy>& regions) const
+{
+    if (regions.empty())
+        return;
+    imageView->getImage()->layoutTransition(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cmdBuffer);
+    vkCmdCopyBufferToImage(cmdBuffer->getHandle(), stagingRing->getBuffer()->getHandle(), imageView->getImage()->getHandle(),
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+    imageView->getImage()->layoutTransition(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, cmdBuffer);
+}
+
+std::unique_ptr<magma::ImageView> BrickedVolume::createTexture(VkFormat format, const VkExtent3D& extent, VkDeviceSize bufferOffset,
+    const std::shared_ptr<magma::CommandBuffer>& cmdImageCopy) const
+{
+    magma::Image::Mip mip;
+    mip.extent = extent;
+    mip.bufferOffset = 0;
+    const magma::Mipmap mipMap = {mip};
+    const magma::Image::CopyLayout bufferLayout{bufferOffset, 0, 0};
+    auto image = std::make_unique<magma::Image3D>(cmdImageCopy, format, stagingRing->getBuffer(), mipMap, bufferLayout);
+    return std::make_unique<magma::UniqueImageView>(std::move(image));
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "magma/magma.h"
+#include "rapid/rapid.h"
+#include "../framework/fileView.h"
+#include "../framework/stagingRing.h"
+
+/* Volume that is split into bricks and streamed on demand from memory-mapped
+   raw file into a fixed-size pool (3D atlas), so GPU memory is bounded regardless
+   of volume size and nothing has to be read before the first frame.
+   Each brick is stored with one voxel apron for seamless trilinear filtering.
+   Page table maps virtual brick to physical slot of the pool; bricks that are
+   transparent for the transfer function are marked as empty and never occupy a slot.
+   Bricks intersected by the view are requested front-to-back and uploaded within
+   per-frame budget; slots of bricks that are out of view are recycled in LRU order,
+   and if the whole pool is in view, farthest bricks give way to the nearer ones.
+   Along with bricks, macro cell occupancy grid for empty space skipping is updated. */
+class BrickedVolume
+{
+public:
+    static constexpr uint32_t brickSize = 32; // In voxels
+    static constexpr uint32_t cellSize = 8; // Should match CELL_SIZE in raycast.frag
+    static constexpr uint32_t apron = 1;
+    static constexpr uint32_t physicalBrickSize = brickSize + apron * 2;
+
+    enum class PageState : uint8_t
+    {
+        NotResident = 0, Resident = 1, Empty = 2
+    };
+
+    explicit BrickedVolume(std::shared_ptr<magma::Device> device,
+        const std::string& filename,
+        const VkExtent3D& extent,
+        const VkExtent3D& poolExtent, // In bricks
+        uint32_t bricksPerFrame,
+        const std::vector<uint8_t>& opacity,
+        std::shared_ptr<StagingRing> stagingRing,
+        const std::shared_ptr<magma::CommandBuffer>& cmdImageCopy);
+    void updateVisibility(const rapid::float3& eye, float aspectRatio); // Eye is in local space of [-1, 1] box
+    bool stream(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer);
+    const std::unique_ptr<magma::ImageView>& getPool() const noexcept { return pool; }
+    const std::unique_ptr<magma::ImageView>& getPageTable() const noexcept { return pageTable; }
+    const std::unique_ptr<magma::ImageView>& getOccupancy() const noexcept { return occupancy; }
+    const VkExtent3D& getExtent() const noexcept { return extent; }
+    VkDeviceSize getPoolSize() const noexcept;
+    uint32_t getBrickCount() const noexcept { return (uint32_t)bricks.size(); }
+    uint32_t getResidentCount() const noexcept { return residentCount; }
+    uint32_t getEmptyCount() const noexcept { return emptyCount; }
+    uint32_t getSlotCount() const noexcept { return (uint32_t)slots.size(); }
+
+private:
+    struct MacroCell
+    {
+        uint8_t minIntensity;
+        uint8_t maxIntensity;
+    };
+
+    struct Brick
+    {
+        PageState state = PageState::NotResident;
+        uint32_t slot = 0;
+        uint32_t lastVisibleFrame = 0;
+        float distance = 0.f;
+    };
+
+    struct PageEntry
+    {
+        uint8_t x, y, z;
+        PageState state;
+    };
+
+    void gatherBrick(uint32_t bx, uint32_t by, uint32_t bz, uint8_t *data) const noexcept;
+    void computeMacroCells(const uint8_t *data, MacroCell *cells) const noexcept;
+    bool transparent(const MacroCell& cell) const noexcept;
+    uint32_t allocateSlot(float distance);
+    void evict(uint32_t slot);
+    void updatePage(uint32_t brick);
+    void copyRegions(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, const std::unique_ptr<magma::ImageView>& imageView,
+        const std::vector<VkBufferImageCopy>& regions) const;
+    std::unique_ptr<magma::ImageView> createTexture(VkFormat format, const VkExtent3D& extent, VkDeviceSize bufferOffset,
+        const std::shared_ptr<magma::CommandBuffer>& cmdImageCopy) const;
+
+    static constexpr uint32_t InvalidIndex = ~0u;
+    static constexpr uint32_t cellsPerBrick = brickSize/cellSize;
+    std::shared_ptr<magma::Device> device;
+    std::shared_ptr<StagingRing> stagingRing;
+    utilities::FileView file;
+    const VkExtent3D extent;
+    VkExtent3D brickGrid;
+    VkExtent3D poolExtent;
+    const uint32_t bricksPerFrame;
+    std::vector<uint32_t> opaqueCount; // Prefix sum of non-zero opacity of transfer function
+    std::vector<Brick> bricks;
+    std::vector<uint32_t> slots; // Brick that occupies the slot
+    std::vector<uint32_t> requests;
+    std::vector<uint32_t> pageUpdates;
+    std::unique_ptr<magma::ImageView> pool;
+    std::unique_ptr<magma::ImageView> pageTable;
+    std::unique_ptr<magma::ImageView> occupancy;
+    uint32_t frame = 0;
+    uint32_t residentCount = 0;
+    uint32_t emptyCount = 0;
+};
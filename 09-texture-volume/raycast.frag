@@ -1,6 +1,11 @@
 #version 450
 
 #define MAX_SAMPLES 1024.
+#define CELL_SIZE 8. // in voxels
+#define BRICK_SIZE 32. // in voxels
+#define APRON 1. // in voxels
+#define RESIDENT 1u
+#define TARGET_OPACITY .05 // per step when sampling is adaptive
 
 layout(binding = 0) uniform Transforms {
     mat4 normal;
@@ -9,10 +14,18 @@ layout(binding = 0) uniform Transforms {
 layout(binding = 1) uniform UniformParameters {
     float power;
     float aspectRatio;
+    bool skipEmptySpace;
+    bool earlyTermination;
+    bool adaptiveSampling;
+    float terminationOpacity;
+    float maxStepScale;
+    vec4 volumeExtent; // in voxels
 };
 
-layout(binding = 2) uniform sampler3D volume;
+layout(binding = 2) uniform sampler3D volume; // brick pool
 layout(binding = 3) uniform sampler1D lookup;
+layout(binding = 4) uniform sampler3D occupancy;
+layout(binding = 5) uniform usampler3D pageTable;
 
 layout(location = 0) in vec2 pos;
 layout(location = 0) out vec4 oColor;
@@ -45,21 +58,86 @@ vec3 rayPoint(Ray r, float t)
     return p * .5 + .5; // [-1,1] -> [0,1]
 }
 
-vec4 accumVolume(vec3 pos, vec3 step, int steps)
+float stepsToExit(vec3 region, vec3 tc, vec3 dt, vec3 regionScale)
+{   // distance to the exit face of the region measured in steps
+    vec3 exitFace = (region + step(0., dt))/regionScale;
+    vec3 t = (exitFace - tc)/dt;
+    float n = min(min(t.x, t.y), t.z);
+    // keep samples at the same positions as without skipping
+    return max(floor(n) + 1., 1.);
+}
+
+float skipEmptyCell(vec3 tc, vec3 dt, vec3 cellScale)
+{
+    vec3 cell = floor(tc * cellScale);
+    // ray ends may be slightly outside of the volume
+    ivec3 texel = clamp(ivec3(cell), ivec3(0), textureSize(occupancy, 0) - 1);
+    if (texelFetch(occupancy, texel, 0).r > 0.)
+        return 0.;
+    return stepsToExit(cell, tc, dt, cellScale);
+}
+
+float sampleBrick(uvec3 slot, vec3 local)
+{   // apron provides voxels of neighbour bricks for trilinear filter
+    vec3 texel = vec3(slot) * (BRICK_SIZE + APRON * 2.) + APRON + local;
+    return texture(volume, texel/vec3(textureSize(volume, 0))).r;
+}
+
+float adaptStepScale(float alpha)
+{   // number of base steps that accumulate target opacity,
+    // so translucent matter is sampled sparsely, dense one at full rate
+    if (alpha <= 0.)
+        return maxStepScale;
+    float n = log(1. - TARGET_OPACITY)/log(1. - min(alpha, .999));
+    return clamp(n, 1., maxStepScale);
+}
+
+vec4 accumVolume(vec3 pos, vec3 delta, int steps)
 {
     vec4 accum = vec4(0.);
+    vec3 tc = pos.xzy; // swap Y/Z axes
+    vec3 dt = delta.xzy;
+    vec3 cellScale = volumeExtent.xyz/CELL_SIZE;
+    vec3 brickScale = volumeExtent.xyz/BRICK_SIZE;
+    ivec3 lastBrick = textureSize(pageTable, 0) - 1;
+    float stepScale = 1.; // in base steps
     // front-to-back integration
-    for (int i = 0; i < steps; ++i, pos += step)
+    for (float t = 0.; t < float(steps); )
     {
-        float intensity = texture(volume, pos.xzy).r; // swap Y/Z axes
+        vec3 p = tc + dt * t;
+        vec3 brick = clamp(floor(p * brickScale), vec3(0.), vec3(lastBrick));
+        uvec4 page = texelFetch(pageTable, ivec3(brick), 0);
+        if (page.a != RESIDENT)
+        {   // brick is either transparent or isn't streamed in yet
+            t += stepsToExit(brick, p, dt, brickScale);
+            continue;
+        }
+        if (skipEmptySpace)
+        {   // leap over macro cell where opacity is zero for any intensity
+            float skip = skipEmptyCell(p, dt, cellScale);
+            if (skip > 0.)
+            {
+                t += skip;
+                continue;
+            }
+        }
+        float intensity = sampleBrick(page.xyz, p * volumeExtent.xyz - brick * BRICK_SIZE);
         vec4 color = texture(lookup, intensity);
+        float baseAlpha = 0.;
         if (color.a > 0.)
-        {   // accomodate for variable sampling rates
-            color.a = 1. - pow(1. - color.a, power);
+        {   // accomodate for variable sampling rates,
+            // sample stands for the whole step
+            baseAlpha = 1. - pow(1. - color.a, power);
+            color.a = 1. - pow(1. - color.a, power * stepScale);
             float alpha = (1. - accum.a) * color.a;
             accum.rgb += color.rgb * alpha;
             accum.a += alpha;
+            if (earlyTermination && accum.a >= terminationOpacity)
+                break; // further samples are occluded
         }
+        t += stepScale;
+        if (adaptiveSampling)
+            stepScale = adaptStepScale(baseAlpha);
     }
     return accum;
 }
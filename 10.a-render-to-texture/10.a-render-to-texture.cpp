@@ -1,14 +1,32 @@
 #include "../framework/vulkanApp.h"
 #include "../framework/utilities.h"
+#include "../framework/mipmapGenerator.h"
+#include "../framework/storageColorAttachment.h"
+
+/* Generate mip chain of render target on GPU after each
+   render pass, so that minified texture isn't aliased. */
+#define GENERATE_MIPMAPS
+/* Compare GPU time of mipmap generation with
+   box filter generation of the same chain on CPU. */
+//#define BENCHMARK_MIPMAPS
+/* Downsample mip levels by compute shader instead of blits
+   (if render target format supports storage usage). */
+//#define COMPUTE_MIPMAPS
 
 class RenderToTextureApp : public VulkanApp
 {
     struct Framebuffer
     {
+    #ifdef GENERATE_MIPMAPS
+        constexpr static uint32_t width = 1024; // Minified on screen
+        constexpr static uint32_t height = 1024;
+    #else
         constexpr static uint32_t width = 128;
         constexpr static uint32_t height = 128;
+    #endif
 
         std::shared_ptr<magma::ImageView> colorView;
+        std::shared_ptr<magma::ImageView> colorAttachmentView;
         std::shared_ptr<magma::ImageView> depthView;
         std::shared_ptr<magma::RenderPass> renderPass;
         std::unique_ptr<magma::Framebuffer> framebuffer;
@@ -26,8 +44,16 @@ class RenderToTextureApp : public VulkanApp
 
     std::unique_ptr<magma::VertexBuffer> vertexBuffer;
     std::unique_ptr<magma::UniformBuffer<rapid::matrix>> uniformBuffer;
-    std::unique_ptr<magma::Sampler> nearestSampler;
-    std::unique_ptr<magma::CommandBuffer> rtCmdBuffer;
+    std::unique_ptr<magma::Sampler> rtSampler;
+    std::unique_ptr<MipmapGenerator> mipmapGenerator;
+#ifdef BENCHMARK_MIPMAPS
+    std::unique_ptr<magma::TimestampQuery> timestampQuery;
+    float timestampPeriod = 0.f;
+    float gpuTime = 0.f;
+    float cpuTime = 0.f;
+    uint32_t sampleCount = 0;
+#endif
+    std::shared_ptr<magma::CommandBuffer> rtCmdBuffer;
     std::unique_ptr<magma::Semaphore> rtSemaphore;
     std::unique_ptr<magma::DescriptorSet> rtDescriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> rtPipeline;
@@ -40,6 +66,10 @@ public:
     {
         initialize();
         createFramebuffer({fb.width, fb.height});
+    #ifdef BENCHMARK_MIPMAPS
+        createTimestampQuery();
+        benchmarkCpuMipmaps({fb.width, fb.height});
+    #endif
         createVertexBuffer();
         createUniformBuffer();
         createSampler();
@@ -54,6 +84,9 @@ public:
     void render(uint32_t bufferIndex) override
     {
         updateWorldTransform();
+    #ifdef BENCHMARK_MIPMAPS
+        readGpuTime();
+    #endif
         constexpr VkPipelineStageFlags stageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
         graphicsQueue->submit(rtCmdBuffer, stageMask,
             presentFinished[frameIndex], // Wait for swapchain
@@ -93,8 +126,34 @@ public:
         constexpr bool dontSampled = false;
         constexpr VkFormat colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
         // Create color attachment
-        std::unique_ptr<magma::Image> color = std::make_unique<magma::ColorAttachment>(device, colorFormat, extent, 1, 1, sampled);
-        fb.colorView = std::make_shared<magma::UniqueImageView>(std::move(color));
+    #ifdef GENERATE_MIPMAPS
+        const uint32_t mipLevels = MipmapGenerator::fullMipChainLevels(extent);
+    #else
+        constexpr uint32_t mipLevels = 1;
+    #endif
+        std::shared_ptr<magma::Image> color;
+        const VkFormatProperties properties = physicalDevice->getFormatProperties(colorFormat);
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)
+        {   // Mip chain may be either blitted or written by compute shader
+            color = std::make_shared<StorageColorAttachment>(device, colorFormat, extent, mipLevels);
+        }
+        else
+        {
+            constexpr bool blitted = true; // Transfer usage for mip chain blits
+            color = std::make_shared<magma::ColorAttachment>(device, colorFormat, extent, mipLevels, 1, sampled,
+                nullptr, blitted);
+        }
+        // Texture view includes all mip levels, but framebuffer attachment should have single one
+        fb.colorView = std::make_shared<magma::SharedImageView>(color);
+        fb.colorAttachmentView = std::make_shared<magma::SharedImageView>(color, 0, 1);
+    #ifdef GENERATE_MIPMAPS
+    #ifdef COMPUTE_MIPMAPS
+        constexpr bool preferCompute = true;
+    #else
+        constexpr bool preferCompute = false;
+    #endif
+        mipmapGenerator = std::make_unique<MipmapGenerator>(device, color, pipelineCache, "downsample", preferCompute);
+    #endif
         // Create depth attachment
         const VkFormat depthFormat = utilities::getSupportedDepthFormat(physicalDevice, false, true);
         std::unique_ptr<magma::Image> depth = std::make_unique<magma::DepthStencilAttachment>(device, depthFormat, extent, 1, 1, dontSampled);
@@ -118,8 +177,79 @@ public:
             device, {colorAttachment, depthAttachment}));
         // Framebuffer defines render pass, color/depth/stencil image views and dimensions
         fb.framebuffer = std::unique_ptr<magma::Framebuffer>(new magma::Framebuffer(
-            fb.renderPass, {fb.colorView, fb.depthView}));
+            fb.renderPass, {fb.colorAttachmentView, fb.depthView}));
+    }
+
+#ifdef BENCHMARK_MIPMAPS
+    void createTimestampQuery()
+    {
+        const VkPhysicalDeviceProperties properties = physicalDevice->getProperties();
+        if (!properties.limits.timestampComputeAndGraphics)
+            throw std::runtime_error("timestamps not supported");
+        timestampPeriod = properties.limits.timestampPeriod;
+        timestampQuery = std::make_unique<magma::TimestampQuery>(device, 2);
+    }
+
+    void benchmarkCpuMipmaps(const VkExtent2D& extent)
+    {   // Box filter of RGBA8 image of the same size as render target
+        constexpr uint32_t iterationCount = 10;
+        std::vector<uint8_t> baseLevel(extent.width * extent.height * 4);
+        for (std::size_t i = 0; i < baseLevel.size(); ++i)
+            baseLevel[i] = static_cast<uint8_t>(i * 7919);
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t i = 0; i < iterationCount; ++i)
+        {
+            const uint8_t *src = baseLevel.data();
+            std::vector<uint8_t> level, prevLevel;
+            uint32_t srcWidth = extent.width, srcHeight = extent.height;
+            while (srcWidth > 1 || srcHeight > 1)
+            {
+                const uint32_t width = std::max(srcWidth >> 1, 1u);
+                const uint32_t height = std::max(srcHeight >> 1, 1u);
+                level.resize(width * height * 4);
+                for (uint32_t y = 0; y < height; ++y)
+                {   // Last row/column of odd-sized level is clamped
+                    const uint32_t y0 = std::min(y * 2, srcHeight - 1), y1 = std::min(y * 2 + 1, srcHeight - 1);
+                    for (uint32_t x = 0; x < width; ++x)
+                    {
+                        const uint32_t x0 = std::min(x * 2, srcWidth - 1), x1 = std::min(x * 2 + 1, srcWidth - 1);
+                        for (uint32_t c = 0; c < 4; ++c)
+                        {
+                            const uint32_t sum =
+                                src[(y0 * srcWidth + x0) * 4 + c] + src[(y0 * srcWidth + x1) * 4 + c] +
+                                src[(y1 * srcWidth + x0) * 4 + c] + src[(y1 * srcWidth + x1) * 4 + c];
+                            level[(y * width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+                        }
+                    }
+                }
+                prevLevel.swap(level);
+                src = prevLevel.data();
+                srcWidth = width;
+                srcHeight = height;
+            }
+        }
+        const auto end = std::chrono::high_resolution_clock::now();
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        cpuTime = us.count() * 0.001f / iterationCount;
+    }
+
+    void readGpuTime()
+    {   // Device is idle when the frame begins, so results of the previous frame are ready
+        constexpr uint32_t printInterval = 100;
+        const std::vector<magma::QueryPool::Result<uint64_t, uint64_t>> timestamps =
+            timestampQuery->getResultsWithAvailability<uint64_t>(0, 2);
+        if (!timestamps[0].availability || !timestamps[1].availability)
+            return;
+        gpuTime += (timestamps[1].result - timestamps[0].result) * timestampPeriod * 1e-6f;
+        if (++sampleCount < printInterval)
+            return;
+        std::cout << fb.width << "x" << fb.height << " mip chain: "
+            << (MipmapGenerator::Method::Blit == mipmapGenerator->getMethod() ? "GPU blit " : "GPU compute ")
+            << gpuTime/sampleCount << " ms, CPU box filter " << cpuTime << " ms" << std::endl;
+        gpuTime = 0.f;
+        sampleCount = 0;
     }
+#endif // BENCHMARK_MIPMAPS
 
     void createVertexBuffer()
     {
@@ -139,8 +269,12 @@ public:
     }
 
     void createSampler()
-    {
-        nearestSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipNearestClampToEdge);
+    {   // Trilinear filtering of mip chain, otherwise texels of small target are magnified
+    #ifdef GENERATE_MIPMAPS
+        rtSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipLinearClampToEdge);
+    #else
+        rtSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipNearestClampToEdge);
+    #endif
     }
 
     void setupDescriptorSets()
@@ -149,7 +283,7 @@ public:
         rtDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
             setTableRt, VK_SHADER_STAGE_VERTEX_BIT,
             nullptr, 0, shaderReflectionFactory, "triangle");
-        setTableTx.texture = {fb.colorView, nearestSampler};
+        setTableTx.texture = {fb.colorView, rtSampler};
         txDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
             setTableTx, VK_SHADER_STAGE_FRAGMENT_BIT,
             nullptr, 0, shaderReflectionFactory, "tex");
@@ -188,9 +322,12 @@ public:
         /* VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT specifies that
            a command buffer can be resubmitted to a queue while it is in
            the pending state, and recorded into multiple primary command buffers. */
-        rtCmdBuffer = std::make_unique<magma::PrimaryCommandBuffer>(commandPools[0]);
+        rtCmdBuffer = std::make_shared<magma::PrimaryCommandBuffer>(commandPools[0]);
         rtCmdBuffer->begin(VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
         {
+        #ifdef BENCHMARK_MIPMAPS
+            rtCmdBuffer->resetQueryPool(timestampQuery, 0, 2);
+        #endif
             rtCmdBuffer->beginRenderPass(fb.renderPass, fb.framebuffer,
                 {
                     magma::ClearColor(0.35f, 0.53f, 0.7f, 1.f),
@@ -204,6 +341,16 @@ public:
                 rtCmdBuffer->draw(3, 0);
             }
             rtCmdBuffer->endRenderPass();
+        #ifdef BENCHMARK_MIPMAPS
+            rtCmdBuffer->writeTimestamp(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQuery, 0);
+        #endif
+        #ifdef GENERATE_MIPMAPS
+            // Render pass has transitioned base level to read-only layout
+            mipmapGenerator->generate(rtCmdBuffer);
+        #endif
+        #ifdef BENCHMARK_MIPMAPS
+            rtCmdBuffer->writeTimestamp(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQuery, 1);
+        #endif
         }
         rtCmdBuffer->end();
         rtSemaphore = std::make_unique<magma::Semaphore>(device);
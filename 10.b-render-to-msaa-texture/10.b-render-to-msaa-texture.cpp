@@ -1,21 +1,31 @@
 #include "../framework/vulkanApp.h"
 #include "../framework/utilities.h"
+#include "../framework/mipmapGenerator.h"
 
 /* MSAA resolve operation may happen in the end of render pass
    if resolve attachment is specified or programmer may perform
    an explicit resolve using vkCmdResolveImage() call. */
 #define MSAA_EXPLICIT_RESOLVE 0
+/* Generate mip chain of resolved texture on GPU,
+   so that minified texture isn't aliased. */
+#define GENERATE_MIPMAPS
 
 class RenderToMsaaTextureApp : public VulkanApp
 {
     struct Framebuffer
     {
+    #ifdef GENERATE_MIPMAPS
+        constexpr static uint32_t width = 1024; // Minified on screen
+        constexpr static uint32_t height = 1024;
+    #else
         constexpr static uint32_t width = 128;
         constexpr static uint32_t height = 128;
+    #endif
 
         std::shared_ptr<magma::SharedImageView> colorMsaaView;
         std::shared_ptr<magma::ImageView> depthMsaaView;
         std::shared_ptr<magma::SharedImageView> colorResolveView;
+        std::shared_ptr<magma::SharedImageView> colorResolveAttachmentView;
         std::shared_ptr<magma::RenderPass> renderPass;
         std::unique_ptr<magma::Framebuffer> framebuffer;
         uint32_t sampleCount = 0;
@@ -33,8 +43,9 @@ class RenderToMsaaTextureApp : public VulkanApp
 
     std::unique_ptr<magma::VertexBuffer> vertexBuffer;
     std::unique_ptr<magma::UniformBuffer<rapid::matrix>> uniformBuffer;
-    std::unique_ptr<magma::Sampler> nearestSampler;
-    std::unique_ptr<magma::CommandBuffer> rtCmdBuffer;
+    std::unique_ptr<magma::Sampler> rtSampler;
+    std::unique_ptr<MipmapGenerator> mipmapGenerator;
+    std::shared_ptr<magma::CommandBuffer> rtCmdBuffer;
     std::unique_ptr<magma::Semaphore> rtSemaphore;
     std::unique_ptr<magma::DescriptorSet> rtDescriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> rtPipeline;
@@ -110,9 +121,21 @@ public:
         std::unique_ptr<magma::Image> depthMsaa = std::make_unique<magma::DepthStencilAttachment>(device, depthFormat, extent, 1, fb.sampleCount, dontSampled);
         fb.depthMsaaView = std::make_shared<magma::UniqueImageView>(std::move(depthMsaa));
         // Create color resolve attachment
-        std::unique_ptr<magma::Image> colorResolve = std::make_unique<magma::ColorAttachment>(device, colorFormat, extent, 1, 1, sampled,
-            nullptr, MSAA_EXPLICIT_RESOLVE);
-        fb.colorResolveView = std::make_shared<magma::SharedImageView>(std::move(colorResolve));
+    #ifdef GENERATE_MIPMAPS
+        const uint32_t mipLevels = MipmapGenerator::fullMipChainLevels(extent);
+        constexpr bool blitted = true; // Transfer usage for mip chain blits
+    #else
+        constexpr uint32_t mipLevels = 1;
+        constexpr bool blitted = MSAA_EXPLICIT_RESOLVE;
+    #endif
+        std::shared_ptr<magma::Image> colorResolve = std::make_shared<magma::ColorAttachment>(device, colorFormat, extent, mipLevels, 1, sampled,
+            nullptr, blitted);
+        // Texture view includes all mip levels, but resolve attachment should have single one
+        fb.colorResolveView = std::make_shared<magma::SharedImageView>(colorResolve);
+        fb.colorResolveAttachmentView = std::make_shared<magma::SharedImageView>(colorResolve, 0, 1);
+    #ifdef GENERATE_MIPMAPS
+        mipmapGenerator = std::make_unique<MipmapGenerator>(device, colorResolve);
+    #endif
         // Don't care about initial layout
         constexpr VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         // Define that multisample color attachment can be cleared and can store shader output
@@ -149,7 +172,7 @@ public:
             device, {colorMsaaAttachment, depthMsaaAttachment, colorResolveAttachment}));
         // Framebuffer defines render pass, color/depth/stencil image views and dimensions
         fb.framebuffer = std::unique_ptr<magma::Framebuffer>(new magma::Framebuffer(
-            fb.renderPass, {fb.colorMsaaView, fb.depthMsaaView, fb.colorResolveView}));
+            fb.renderPass, {fb.colorMsaaView, fb.depthMsaaView, fb.colorResolveAttachmentView}));
     #endif // MSAA_EXPLICIT_RESOLVE
     }
 
@@ -171,8 +194,12 @@ public:
     }
 
     void createSampler()
-    {
-        nearestSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipNearestClampToEdge);
+    {   // Trilinear filtering of mip chain, otherwise texels of small target are magnified
+    #ifdef GENERATE_MIPMAPS
+        rtSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipLinearClampToEdge);
+    #else
+        rtSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipNearestClampToEdge);
+    #endif
     }
 
     void setupDescriptorSet()
@@ -181,7 +208,7 @@ public:
         rtDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
             setTableRt, VK_SHADER_STAGE_VERTEX_BIT,
             nullptr, 0, shaderReflectionFactory, "triangle");
-        setTableTx.texture = {fb.colorResolveView, nearestSampler};
+        setTableTx.texture = {fb.colorResolveView, rtSampler};
         txDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
             setTableTx, VK_SHADER_STAGE_FRAGMENT_BIT,
             nullptr, 0, shaderReflectionFactory, "tex");
@@ -231,7 +258,7 @@ public:
         /* VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT specifies that
            a command buffer can be resubmitted to a queue while it is in
            the pending state, and recorded into multiple primary command buffers. */
-        rtCmdBuffer = std::make_unique<magma::PrimaryCommandBuffer>(commandPools[0]);
+        rtCmdBuffer = std::make_shared<magma::PrimaryCommandBuffer>(commandPools[0]);
         rtCmdBuffer->begin(VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT);
         {
             rtCmdBuffer->beginRenderPass(fb.renderPass, fb.framebuffer,
@@ -254,6 +281,15 @@ public:
                vkCmdResolveImage() call. */
             msaaResolve(fb);
         #endif // MSAA_EXPLICIT_RESOLVE
+        #ifdef GENERATE_MIPMAPS
+            // Base level has been written either by resolve attachment or by resolve command
+            mipmapGenerator->generate(rtCmdBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            #if MSAA_EXPLICIT_RESOLVE
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+            #else
+                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+            #endif
+        #endif // GENERATE_MIPMAPS
         }
         rtCmdBuffer->end();
         rtSemaphore = std::make_unique<magma::Semaphore>(device);
@@ -1,6 +1,9 @@
 #include "../framework/vulkanApp.h"
+#include "../framework/utilities.h"
+#include "../framework/indirectStorageBuffer.h"
 #include "quadric/include/plane.h"
 #include "quadric/include/teapot.h"
+#include "quadric/include/cube.h"
 
 #define NON_COHERENT_UNIFORM_BUFFER 0
 
@@ -11,9 +14,71 @@ template<class Type> using DynamicUniformBuffer =
     magma::DynamicUniformBuffer<Type>;
 #endif
 
+#ifdef VK_EXT_conditional_rendering
+/* Holds 32-bit predicate per occludee. Predicates are
+   copied from query pool, so buffer is also transfer destination. */
+class ConditionalRenderingBuffer : public magma::Buffer
+{
+public:
+    explicit ConditionalRenderingBuffer(std::shared_ptr<magma::Device> device, VkDeviceSize size):
+        magma::Buffer(std::move(device), size, 0, // flags
+            VK_BUFFER_USAGE_CONDITIONAL_RENDERING_BIT_EXT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            magma::Buffer::Initializer(),
+            magma::Sharing(),
+            nullptr)
+    {}
+};
+#endif // VK_EXT_conditional_rendering
+
 // Use L button + mouse to rotate scene
+// Use Space to enable/disable occlusion culling
+// Use Tab to switch between Hi-Z and occlusion query culling
 class OcclusionQueryApp : public VulkanApp
 {
+    enum class CullingMode : uint8_t
+    {
+        HiZ = 0, Queries
+    };
+
+    struct alignas(16) CullParameters
+    {
+        rapid::matrix viewProj;
+        rapid::matrix prevViewProj;
+        uint32_t instanceCount;
+        uint32_t pyramidLevels;
+        uint32_t width;
+        uint32_t height;
+        VkBool32 negateViewport;
+        VkBool32 occlusionCulling;
+    };
+
+    struct DepthReduceConstants
+    {
+        uint32_t srcOffset;
+        uint32_t srcWidth;
+        uint32_t srcHeight;
+        uint32_t dstOffset;
+        uint32_t dstWidth;
+        uint32_t dstHeight;
+        VkBool32 firstLevel;
+    };
+
+    struct PyramidLevel
+    {
+        uint32_t offset;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct QueryStatistics
+    {
+        uint64_t resolvedCount = 0;
+        uint64_t latencySum = 0; // In frames
+        uint64_t maxLatency = 0;
+        uint64_t fallbackCount = 0; // Frames without new result
+    };
+
     struct TransformSetTable
     {
         magma::descriptor::DynamicUniformBuffer worldViewProj = 0;
@@ -24,9 +89,44 @@ class OcclusionQueryApp : public VulkanApp
         magma::descriptor::DynamicUniformBuffer color = 0;
     } setTable1;
 
+    struct InstanceSetTable
+    {
+        magma::descriptor::UniformBuffer parameters = 0;
+        magma::descriptor::StorageBuffer instances = 1;
+        magma::descriptor::StorageBuffer visibleInstances = 2;
+    } setTableInstances;
+
+    struct CullSetTable
+    {
+        magma::descriptor::UniformBuffer parameters = 0;
+        magma::descriptor::StorageBuffer instances = 1;
+        magma::descriptor::StorageBuffer visibleInstances = 2;
+        magma::descriptor::StorageBuffer drawCommand = 3;
+        magma::descriptor::StorageBuffer depthPyramid = 4;
+    } setTableCull;
+
+    struct DepthReduceSetTable
+    {
+        magma::descriptor::CombinedImageSampler depthBuffer = 0;
+        magma::descriptor::StorageBuffer depthPyramid = 1;
+    } setTableReduce;
+
+    struct OccludeeSetTable
+    {
+        magma::descriptor::UniformBuffer parameters = 0;
+        magma::descriptor::StorageBuffer instances = 1;
+    } setTableOccludee;
+
+    // Block of small teapots behind the occluder
+    const uint32_t gridX = 12, gridY = 12, gridZ = 16;
+
     std::unique_ptr<quadric::Plane> plane;
     std::unique_ptr<quadric::Teapot> teapot;
-    std::unique_ptr<magma::OcclusionQuery> occlusionQuery;
+    // Query pool per command buffer, so that recording doesn't reset results in flight
+    std::vector<std::unique_ptr<magma::OcclusionQuery>> occlusionQueries;
+    std::vector<uint64_t> querySubmitFrames;
+    // Precise query counts samples of all occludees to measure culling efficiency
+    std::vector<std::unique_ptr<magma::OcclusionQuery>> fragmentQueries;
     std::unique_ptr<DynamicUniformBuffer<rapid::matrix>> transformUniforms;
     std::unique_ptr<DynamicUniformBuffer<rapid::vector4>> colorUniforms;
     std::unique_ptr<magma::DescriptorSet> descriptorSets[2];
@@ -34,7 +134,46 @@ class OcclusionQueryApp : public VulkanApp
     std::unique_ptr<magma::GraphicsPipeline> teapotPipeline;
     std::unique_ptr<magma::GraphicsPipeline> planePipeline;
 
+    std::unique_ptr<quadric::Teapot> smallTeapot;
+    std::unique_ptr<magma::UniformBuffer<CullParameters>> cullParameters;
+    std::unique_ptr<magma::StorageBuffer> instanceBuffer;
+    std::unique_ptr<magma::StorageBuffer> visibleInstances;
+    std::unique_ptr<IndirectStorageBuffer> drawCommand;
+    std::unique_ptr<magma::StorageBuffer> depthPyramid;
+    std::vector<std::unique_ptr<magma::DstTransferBuffer>> readbackBuffers;
+    std::unique_ptr<magma::Sampler> nearestSampler;
+    std::unique_ptr<magma::DescriptorSet> instanceDescriptorSet;
+    std::unique_ptr<magma::DescriptorSet> cullDescriptorSet;
+    std::unique_ptr<magma::DescriptorSet> reduceDescriptorSet;
+    std::unique_ptr<magma::GraphicsPipeline> instancedPipeline;
+    std::unique_ptr<magma::ComputePipeline> cullPipeline;
+    std::unique_ptr<magma::ComputePipeline> reducePipeline;
+
+    std::unique_ptr<quadric::Cube> proxyCube;
+    std::unique_ptr<magma::DescriptorSet> occludeeDescriptorSet;
+    std::unique_ptr<magma::GraphicsPipeline> occludeePipeline;
+    std::unique_ptr<magma::GraphicsPipeline> proxyPipeline;
+#ifdef VK_EXT_conditional_rendering
+    std::unique_ptr<ConditionalRenderingBuffer> predicateBuffer;
+#endif
+
     rapid::matrix viewProj;
+    rapid::matrix sceneViewProj;
+    rapid::matrix prevSceneViewProj;
+    std::vector<PyramidLevel> pyramidLevels;
+    uint32_t instanceCount = 0;
+    uint32_t drawnInstanceCount = 0;
+    bool occlusionCulling = true;
+    CullingMode cullingMode = CullingMode::HiZ;
+    bool conditionalRendering = false;
+    // Last known visibility of occludees, used when conditional rendering isn't supported
+    std::vector<bool> occludeeVisible;
+    uint64_t occludeeSampleCount = 0;
+    static constexpr uint64_t NotSubmitted = ~0ull;
+    uint64_t lastResultFrame = NotSubmitted;
+    uint64_t sampleCount = 0;
+    bool teapotVisible = true;
+    QueryStatistics queryStatistics;
 
 public:
     OcclusionQueryApp(const AppEntry& entry):
@@ -45,6 +184,12 @@ public:
         createOcclusionQuery();
         createMeshes();
         createUniformBuffers();
+        createInstances();
+        createCullingBuffers();
+        createDepthPyramid();
+        createReadbackBuffers();
+        createSampler();
+        createPredicateBuffer();
         setupDescriptorSet();
         setupPipeline();
         for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
@@ -53,40 +198,198 @@ public:
 
     void render(uint32_t bufferIndex) override
     {
+        if (CullingMode::HiZ == cullingMode)
+            readDrawnInstanceCount(bufferIndex);
         updatePerspectiveTransform();
+        resolveOcclusionQueries();
+        if ((CullingMode::Queries == cullingMode) && occlusionCulling && !conditionalRendering)
+        {   // Skip occludees on the CPU using the most recent available results
+            commandBuffers[bufferIndex]->reset();
+            recordCommandBuffer(bufferIndex);
+        }
+        querySubmitFrames[bufferIndex] = frameCount;
         submitCommandBuffer(bufferIndex);
-        constexpr bool waitForResult = true;
-        showOcclusionResult(waitForResult);
+        showOcclusionResult();
+    }
+
+    void onKeyDown(char key, int repeat, uint32_t flags) override
+    {
+        switch (key)
+        {
+        case AppKey::Space:
+            occlusionCulling = !occlusionCulling;
+            if (CullingMode::Queries == cullingMode)
+                rerecordCommandBuffers();
+            break;
+        case AppKey::Tab:
+            cullingMode = (CullingMode::HiZ == cullingMode) ? CullingMode::Queries : CullingMode::HiZ;
+            rerecordCommandBuffers();
+            break;
+        }
+        VulkanApp::onKeyDown(key, repeat, flags);
     }
 
     void onResize(uint32_t width, uint32_t height) override
     {
         VulkanApp::onResize(width, height);
         setupView();
+        createDepthPyramid();
+        // Depth buffer and pyramid were re-created
+        setTableReduce.depthBuffer = {depthStencilView, nearestSampler};
+        setTableReduce.depthPyramid = depthPyramid;
+        setTableCull.depthPyramid = depthPyramid;
         for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
             recordCommandBuffer(i);
     }
 
-    void showOcclusionResult(bool waitForResult)
-    {
-        uint64_t sampleCount = 0;
-        if (waitForResult)
-            sampleCount = occlusionQuery->getResults<uint64_t>(0, 1, true).front();
-        else
+    void resolveOcclusionQueries()
+    {   /* Poll each query pool in flight without waiting.
+           Result of the most recent frame wins; if nothing new is
+           available, last known visibility is used instead. */
+        bool newResult = false;
+        for (uint32_t i = 0; i < (uint32_t)occlusionQueries.size(); ++i)
         {
-            const magma::QueryPool::Result<uint64_t, uint64_t> result = occlusionQuery->getResultsWithAvailability<uint64_t>(0, 1).front();
-            if (result.availability > 0)
+            if (NotSubmitted == querySubmitFrames[i])
+                continue;
+            // Results of proxies are fetched only if they have been issued
+            const uint32_t queryCount = (CullingMode::Queries == cullingMode) ? occlusionQueries[i]->getQueryCount() : 1;
+            const std::vector<magma::QueryPool::Result<uint64_t, uint64_t>> results = occlusionQueries[i]->getResultsWithAvailability<uint64_t>(0, queryCount);
+            const magma::QueryPool::Result<uint64_t, uint64_t>& result = results.front();
+            if (!result.availability)
+                continue; // Not ready
+            const uint64_t submitFrame = querySubmitFrames[i];
+            querySubmitFrames[i] = NotSubmitted;
+            const uint64_t latency = frameCount - submitFrame;
+            ++queryStatistics.resolvedCount;
+            queryStatistics.latencySum += latency;
+            queryStatistics.maxLatency = std::max(queryStatistics.maxLatency, latency);
+            if ((NotSubmitted == lastResultFrame) || (submitFrame > lastResultFrame))
+            {
                 sampleCount = result.result;
-            std::cout << "Query result: ";
-            if (result.availability > 0)
-                std::cout << sampleCount << std::endl;
-            else // Not ready
-                std::cout << "---" << std::endl;
+                teapotVisible = (sampleCount > 0);
+                lastResultFrame = submitFrame;
+                newResult = true;
+                if (CullingMode::Queries == cullingMode)
+                    updateOccludeeVisibility(results);
+                const magma::QueryPool::Result<uint64_t, uint64_t> fragmentResult = fragmentQueries[i]->getResultsWithAvailability<uint64_t>(0, 1).front();
+                if (fragmentResult.availability)
+                    occludeeSampleCount = fragmentResult.result;
+            }
+        }
+        if (!newResult)
+            ++queryStatistics.fallbackCount;
+    }
+
+    void updateOccludeeVisibility(const std::vector<magma::QueryPool::Result<uint64_t, uint64_t>>& results)
+    {   /* Query of each proxy follows the query of the big teapot.
+           Proxy which wasn't drawn yet (e.g. after mode switch)
+           is considered visible to be conservative. */
+        drawnInstanceCount = 0;
+        for (uint32_t i = 0; i < instanceCount; ++i)
+        {
+            const magma::QueryPool::Result<uint64_t, uint64_t>& result = results[1 + i];
+            occludeeVisible[i] = !result.availability || (result.result > 0);
+            if (occludeeVisible[i] || !occlusionCulling)
+                ++drawnInstanceCount;
+        }
+    }
+
+    void showOcclusionResult()
+    {
+        std::tstring caption = TEXT("11 - Occlusion query samples: ") + std::to_tstring(sampleCount);
+        caption += teapotVisible ? TEXT(" (visible") : TEXT(" (occluded");
+        if (queryStatistics.resolvedCount)
+        {   // Average and max number of frames between submission and available result
+            const float averageLatency = queryStatistics.latencySum / (float)queryStatistics.resolvedCount;
+            caption += TEXT(", latency ") + std::to_tstring(averageLatency) + TEXT("/") + std::to_tstring(queryStatistics.maxLatency);
         }
-        const std::tstring caption = TEXT("11 - Occlusion query samples: ") + std::to_tstring(sampleCount);
+        caption += TEXT(", fallback ") + std::to_tstring(queryStatistics.fallbackCount) + TEXT(")");
+        if (CullingMode::HiZ == cullingMode)
+            caption += occlusionCulling ? TEXT(", Hi-Z drawn ") : TEXT(", frustum drawn ");
+        else if (!occlusionCulling)
+            caption += TEXT(", unculled drawn ");
+        else
+            caption += conditionalRendering ? TEXT(", conditional drawn ") : TEXT(", query drawn ");
+        caption += std::to_tstring(drawnInstanceCount) + TEXT(" of ") + std::to_tstring(instanceCount);
+        caption += TEXT(", samples ") + std::to_tstring(occludeeSampleCount);
         setWindowCaption(caption);
     }
 
+#ifdef VK_EXT_conditional_rendering
+    void enableExtensions(magma::NullTerminatedStringArray& enabledExtensions) override
+    {
+        if (extensions->EXT_conditional_rendering)
+            enabledExtensions.push_back(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME);
+    }
+
+    void enableFeatures(magma::StructureChain& extendedFeatures) override
+    {   // Feature is mandatory if extension is supported
+        if (extensions->EXT_conditional_rendering)
+        {
+            VkPhysicalDeviceConditionalRenderingFeaturesEXT conditionalRenderingFeatures = {};
+            conditionalRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_CONDITIONAL_RENDERING_FEATURES_EXT;
+            conditionalRenderingFeatures.conditionalRendering = VK_TRUE;
+            extendedFeatures.linkNode(conditionalRenderingFeatures);
+        }
+    }
+#endif // VK_EXT_conditional_rendering
+
+    void createRenderPass() override
+    {   // Depth buffer is left in read-only layout to build depth pyramid
+        const magma::AttachmentDescription colorAttachment(swapchain->getSurfaceFormat().format, 1,
+            magma::op::clearStore, // Color clear, store
+            magma::op::dontCare,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+        const VkFormat depthFormat = utilities::getSupportedDepthFormat(physicalDevice, false, true);
+        const magma::AttachmentDescription depthAttachment(depthFormat, 1,
+            magma::op::clearStore, // Depth clear, store
+            magma::op::dontCare, // Stencil don't care
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        const magma::SubpassDescription subpass(
+            magma::AttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+            magma::AttachmentReference(1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL));
+        // Implicit external dependency ends at bottom of pipe, so depth reduction would not wait for layout transition
+        const magma::SubpassDependency depthReadDependency(0, VK_SUBPASS_EXTERNAL,
+            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_ACCESS_SHADER_READ_BIT);
+        renderPass = std::make_unique<magma::RenderPass>(device,
+            std::initializer_list<magma::AttachmentDescription>{colorAttachment, depthAttachment},
+            std::initializer_list<magma::SubpassDescription>{subpass},
+            std::initializer_list<magma::SubpassDependency>{depthReadDependency});
+    }
+
+    void createFramebuffer() override
+    {   // Same as in VulkanApp, but depth buffer is sampled
+        const VkSurfaceCapabilitiesKHR surfaceCaps = physicalDevice->getSurfaceCapabilities(surface);
+        const VkFormat depthFormat = utilities::getSupportedDepthFormat(physicalDevice, false, true);
+        constexpr bool sampled = true;
+        std::unique_ptr<magma::Image> depthStencil = std::make_unique<magma::DepthStencilAttachment>(device, depthFormat, surfaceCaps.currentExtent, 1, 1, sampled);
+        depthStencilView = std::make_shared<magma::UniqueImageView>(std::move(depthStencil));
+        for (const auto& image : swapchain->getImages())
+        {
+            std::vector<std::shared_ptr<magma::ImageView>> attachments;
+            attachments.emplace_back(std::make_shared<magma::SharedImageView>(std::move(image)));
+            attachments.push_back(depthStencilView);
+            framebuffers.emplace_back(std::make_unique<magma::Framebuffer>(renderPass, attachments));
+        }
+    }
+
+    void createDescriptorPool() override
+    {   // Transform, color, instance, cull, depth reduction and occludee sets
+        constexpr uint32_t maxDescriptorSets = 6;
+        descriptorPool = std::make_shared<magma::DescriptorPool>(device, maxDescriptorSets,
+            std::initializer_list<VkDescriptorPoolSize>{
+                magma::descriptor::UniformBufferPoolSize(3),
+                magma::descriptor::DynamicUniformBufferPoolSize(2),
+                magma::descriptor::StorageBufferPoolSize(9),
+                magma::descriptor::CombinedImageSamplerPoolSize(1)
+            });
+    }
+
     void setupView()
     {
         const rapid::vector3 eye(0.f, 0.f, 10.f);
@@ -114,6 +417,21 @@ public:
                 transforms[0] = worldPlane * viewProj;
                 transforms[1] = worldMesh * viewProj;
             });
+        // Depth pyramid has been built with transform of the previous frame
+        prevSceneViewProj = sceneViewProj;
+        sceneViewProj = pitch * yaw * viewProj;
+        magma::map(cullParameters,
+            [this](auto *parameters)
+            {
+                parameters->viewProj = sceneViewProj;
+                parameters->prevViewProj = prevSceneViewProj;
+                parameters->instanceCount = instanceCount;
+                parameters->pyramidLevels = (uint32_t)pyramidLevels.size();
+                parameters->width = width;
+                parameters->height = height;
+                parameters->negateViewport = negateViewport;
+                parameters->occlusionCulling = occlusionCulling;
+            });
     }
 
     void createOcclusionQuery()
@@ -124,7 +442,14 @@ public:
           In this case, some implementations may only return zero or one,
           indifferent to the actual number of samples passing the per-fragment tests. */
         constexpr bool precise = false;
-        occlusionQuery = std::make_unique<magma::OcclusionQuery>(device, 1, precise);
+        // Big teapot followed by a proxy of each small teapot
+        const uint32_t queryCount = 1 + gridX * gridY * gridZ;
+        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+        {
+            occlusionQueries.push_back(std::make_unique<magma::OcclusionQuery>(device, queryCount, precise));
+            fragmentQueries.push_back(std::make_unique<magma::OcclusionQuery>(device, 1, !precise));
+            querySubmitFrames.push_back(NotSubmitted);
+        }
     }
 
     void createMeshes()
@@ -133,6 +458,9 @@ public:
         plane = std::make_unique<quadric::Plane>(6.f, 6.f, twoSided, cmdBufferCopy);
         constexpr uint16_t subdivisionDegree = 16;
         teapot = std::make_unique<quadric::Teapot>(subdivisionDegree, cmdBufferCopy);
+        constexpr uint16_t smallSubdivisionDegree = 4;
+        smallTeapot = std::make_unique<quadric::Teapot>(smallSubdivisionDegree, cmdBufferCopy);
+        proxyCube = std::make_unique<quadric::Cube>(cmdBufferCopy);
     }
 
     void createUniformBuffers()
@@ -150,7 +478,100 @@ public:
                 colors[0] = rapid::vector4(0.f, 0.f, 1.f, 1.f);
                 colors[1] = rapid::vector4(1.f, 0.f, 0.f, 1.f);
             });
+        cullParameters = std::make_unique<magma::UniformBuffer<CullParameters>>(device);
         updatePerspectiveTransform();
+        prevSceneViewProj = sceneViewProj;
+    }
+
+    void createInstances()
+    {
+        constexpr float scale = 0.12f;
+        constexpr float spacing = 1.1f;
+        std::vector<rapid::float4> instances;
+        instances.reserve(gridX * gridY * gridZ);
+        for (uint32_t z = 0; z < gridZ; ++z)
+        {
+            for (uint32_t y = 0; y < gridY; ++y)
+            {
+                for (uint32_t x = 0; x < gridX; ++x)
+                {
+                    instances.emplace_back(
+                        (x - (gridX - 1) * .5f) * spacing,
+                        (y - (gridY - 1) * .5f) * spacing,
+                        -1.f - z * spacing,
+                        scale);
+                }
+            }
+        }
+        instanceCount = (uint32_t)instances.size();
+        instanceBuffer = std::make_unique<magma::StorageBuffer>(cmdBufferCopy, instances.size() * sizeof(rapid::float4), instances.data());
+        occludeeVisible.resize(instanceCount, true);
+    }
+
+    void createCullingBuffers()
+    {   // Compacted list of instance indices that passed culling
+        visibleInstances = std::make_unique<magma::StorageBuffer>(device, instanceCount * sizeof(uint32_t));
+        drawCommand = std::make_unique<IndirectStorageBuffer>(device, sizeof(VkDrawIndexedIndirectCommand));
+    }
+
+    void createDepthPyramid()
+    {   // Each level is half size of the previous one, rounded up
+        pyramidLevels.clear();
+        uint32_t offset = 0;
+        uint32_t levelWidth = width, levelHeight = height;
+        do
+        {
+            levelWidth = (levelWidth + 1) / 2;
+            levelHeight = (levelHeight + 1) / 2;
+            pyramidLevels.push_back({offset, levelWidth, levelHeight});
+            offset += levelWidth * levelHeight;
+        } while (levelWidth > 1 || levelHeight > 1);
+        // Far depth doesn't occlude anything in the first frame
+        const std::vector<float> farDepth(offset, 1.f);
+        depthPyramid = std::make_unique<magma::StorageBuffer>(cmdBufferCopy, farDepth.size() * sizeof(float), farDepth.data());
+    }
+
+    void createReadbackBuffers()
+    {   // Draw command is copied back only to display statistics
+        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+        {
+            auto buffer = std::make_unique<magma::DstTransferBuffer>(device, sizeof(VkDrawIndexedIndirectCommand));
+            magma::map<VkDrawIndexedIndirectCommand>(buffer,
+                [](VkDrawIndexedIndirectCommand *drawCommand)
+                {   // Nothing was drawn yet
+                    drawCommand->instanceCount = 0;
+                });
+            readbackBuffers.push_back(std::move(buffer));
+        }
+    }
+
+    void readDrawnInstanceCount(uint32_t bufferIndex)
+    {   // Previous submission of command buffer has been completed
+        magma::map<VkDrawIndexedIndirectCommand>(readbackBuffers[bufferIndex],
+            [this](const VkDrawIndexedIndirectCommand *drawCommand)
+            {
+                drawnInstanceCount = drawCommand->instanceCount;
+            });
+    }
+
+    void createSampler()
+    {
+        nearestSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipNearestClampToEdge);
+    }
+
+    void createPredicateBuffer()
+    {
+    #ifdef VK_EXT_conditional_rendering
+        conditionalRendering = extensions->EXT_conditional_rendering;
+        if (!conditionalRendering)
+            return;
+        predicateBuffer = std::make_unique<ConditionalRenderingBuffer>(device, instanceCount * sizeof(uint32_t));
+        // Everything is visible until the first results are copied.
+        // Unlike vkCmdUpdateBuffer(), staging ring isn't limited to 64 KB
+        const std::vector<uint32_t> visible(instanceCount, 1);
+        stagingRing->copyBuffer(transferQueue, cmdBufferCopy, visible.data(),
+            predicateBuffer, visible.size() * sizeof(uint32_t));
+    #endif // VK_EXT_conditional_rendering
     }
 
     void setupDescriptorSet()
@@ -163,6 +584,30 @@ public:
         descriptorSets[1] = std::make_unique<magma::DescriptorSet>(descriptorPool,
             setTable1, VK_SHADER_STAGE_VERTEX_BIT,
             nullptr, 0, shaderReflectionFactory, "transform", 1);
+        setTableInstances.parameters = cullParameters;
+        setTableInstances.instances = instanceBuffer;
+        setTableInstances.visibleInstances = visibleInstances;
+        instanceDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
+            setTableInstances, VK_SHADER_STAGE_VERTEX_BIT,
+            nullptr, 0, shaderReflectionFactory, "instanced");
+        setTableCull.parameters = cullParameters;
+        setTableCull.instances = instanceBuffer;
+        setTableCull.visibleInstances = visibleInstances;
+        setTableCull.drawCommand = drawCommand;
+        setTableCull.depthPyramid = depthPyramid;
+        cullDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
+            setTableCull, VK_SHADER_STAGE_COMPUTE_BIT,
+            nullptr, 0, shaderReflectionFactory, "hizCull");
+        setTableReduce.depthBuffer = {depthStencilView, nearestSampler};
+        setTableReduce.depthPyramid = depthPyramid;
+        reduceDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
+            setTableReduce, VK_SHADER_STAGE_COMPUTE_BIT,
+            nullptr, 0, shaderReflectionFactory, "depthReduce");
+        setTableOccludee.parameters = cullParameters;
+        setTableOccludee.instances = instanceBuffer;
+        occludeeDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
+            setTableOccludee, VK_SHADER_STAGE_VERTEX_BIT,
+            nullptr, 0, shaderReflectionFactory, "occludee");
     }
 
     void setupPipeline()
@@ -196,6 +641,181 @@ public:
             sharedLayout,
             renderPass, 0,
             pipelineCache);
+        auto instancedLayout = std::make_unique<magma::PipelineLayout>(instanceDescriptorSet->getLayout());
+        instancedPipeline = std::make_unique<GraphicsPipeline>(device,
+            "instanced", "fill",
+            smallTeapot->getVertexInput(),
+            magma::renderstate::triangleList,
+            negateViewport ? magma::renderstate::fillCullBackCcw
+                           : magma::renderstate::fillCullBackCw,
+            magma::renderstate::dontMultisample,
+            magma::renderstate::depthLessOrEqual,
+            magma::renderstate::dontBlendRgb,
+            std::move(instancedLayout),
+            renderPass, 0,
+            pipelineCache);
+        auto cullLayout = std::make_unique<magma::PipelineLayout>(cullDescriptorSet->getLayout());
+        cullPipeline = std::make_unique<ComputePipeline>(device,
+            "hizCull", std::move(cullLayout), pipelineCache);
+        constexpr magma::push::ComputeConstantRange<DepthReduceConstants> pushConstantRange;
+        auto reduceLayout = std::make_unique<magma::PipelineLayout>(reduceDescriptorSet->getLayout(), pushConstantRange);
+        reducePipeline = std::make_unique<ComputePipeline>(device,
+            "depthReduce", std::move(reduceLayout), pipelineCache);
+        auto occludeeLayout = std::make_shared<magma::PipelineLayout>(occludeeDescriptorSet->getLayout());
+        occludeePipeline = std::make_unique<GraphicsPipeline>(device,
+            "occludee", "fill",
+            smallTeapot->getVertexInput(),
+            magma::renderstate::triangleList,
+            negateViewport ? magma::renderstate::fillCullBackCcw
+                           : magma::renderstate::fillCullBackCw,
+            magma::renderstate::dontMultisample,
+            magma::renderstate::depthLessOrEqual,
+            magma::renderstate::dontBlendRgb,
+            occludeeLayout,
+            renderPass, 0,
+            pipelineCache);
+        /* Proxies shouldn't occlude each other, so depth isn't written.
+           Back faces are rasterized as well, so that proxy is visible
+           when the camera is inside of its bounding box. Color writes
+           are masked, but samples are still counted by the query. */
+        const magma::ColorBlendState dontWriteColor(magma::ColorBlendAttachmentState(0));
+        proxyPipeline = std::make_unique<GraphicsPipeline>(device,
+            "proxy", "transparent",
+            proxyCube->getVertexInput(),
+            magma::renderstate::triangleList,
+            negateViewport ? magma::renderstate::fillCullNoneCcw
+                           : magma::renderstate::fillCullNoneCw,
+            magma::renderstate::dontMultisample,
+            magma::renderstate::depthLessOrEqualDontWrite,
+            dontWriteColor,
+            occludeeLayout,
+            renderPass, 0,
+            pipelineCache);
+    }
+
+    void cullInstances(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+    {   // Reset draw parameters, visible instance count will be accumulated by compute shader
+        VkDrawIndexedIndirectCommand drawIndexed;
+        drawIndexed.indexCount = smallTeapot->getIndexBuffer()->getIndexCount();
+        drawIndexed.instanceCount = 0;
+        drawIndexed.firstIndex = 0;
+        drawIndexed.vertexOffset = 0;
+        drawIndexed.firstInstance = 0;
+        cmdBuffer->updateBuffer(drawCommand, sizeof(VkDrawIndexedIndirectCommand), &drawIndexed);
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            magma::BufferMemoryBarrier(drawCommand.get(),
+                magma::MemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)));
+        // Test bounding sphere of each instance against view frustum and depth pyramid
+        constexpr uint32_t workgroupSize = 64;
+        cmdBuffer->bindDescriptorSet(cullPipeline, 0, cullDescriptorSet);
+        cmdBuffer->bindPipeline(cullPipeline);
+        cmdBuffer->dispatch((instanceCount + workgroupSize - 1) / workgroupSize, 1, 1);
+        // Ensure that visible list and draw parameters are written before indirect draw and readback
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            {
+                {drawCommand.get(), magma::MemoryBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT)},
+                {visibleInstances.get(), magma::MemoryBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)}
+            });
+    }
+
+    void buildDepthPyramid(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+    {   /* Depth buffer has been transitioned to read-only layout by external dependency of render pass.
+           Culling of this frame should finish reading the pyramid before it is overwritten. */
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            magma::MemoryBarrier(VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT));
+        constexpr uint32_t workgroupSize = 8;
+        cmdBuffer->bindDescriptorSet(reducePipeline, 0, reduceDescriptorSet);
+        cmdBuffer->bindPipeline(reducePipeline);
+        for (uint32_t i = 0; i < (uint32_t)pyramidLevels.size(); ++i)
+        {   // First level is reduced from depth buffer, next ones from previous level
+            const PyramidLevel& dst = pyramidLevels[i];
+            DepthReduceConstants constants;
+            constants.srcOffset = i ? pyramidLevels[i - 1].offset : 0;
+            constants.srcWidth = i ? pyramidLevels[i - 1].width : width;
+            constants.srcHeight = i ? pyramidLevels[i - 1].height : height;
+            constants.dstOffset = dst.offset;
+            constants.dstWidth = dst.width;
+            constants.dstHeight = dst.height;
+            constants.firstLevel = (0 == i);
+            cmdBuffer->pushConstantBlock(reducePipeline->getLayout(), VK_SHADER_STAGE_COMPUTE_BIT, constants);
+            cmdBuffer->dispatch((dst.width + workgroupSize - 1) / workgroupSize, (dst.height + workgroupSize - 1) / workgroupSize, 1);
+            cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                magma::BufferMemoryBarrier(depthPyramid.get(), magma::MemoryBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)));
+        }
+    }
+
+    void readbackDrawCommand(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t index)
+    {
+        cmdBuffer->copyBuffer(drawCommand, readbackBuffers[index]);
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            magma::BufferMemoryBarrier(readbackBuffers[index].get(), magma::barrier::buffer::transferWriteHostRead));
+    }
+
+    void drawOccludees(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+    {   // Each occludee is predicated by query result of its proxy from the previous frame
+        const uint32_t indexCount = smallTeapot->getIndexBuffer()->getIndexCount();
+        cmdBuffer->bindDescriptorSet(occludeePipeline, 0, occludeeDescriptorSet);
+        cmdBuffer->bindPipeline(occludeePipeline);
+        cmdBuffer->bindVertexBuffer(0, smallTeapot->getVertexBuffer());
+        cmdBuffer->bindIndexBuffer(smallTeapot->getIndexBuffer());
+        for (uint32_t i = 0; i < instanceCount; ++i)
+        {
+            if (!occlusionCulling)
+                cmdBuffer->drawIndexedInstanced(indexCount, 1, 0, 0, i);
+        #ifdef VK_EXT_conditional_rendering
+            else if (conditionalRendering)
+            {
+                cmdBuffer->beginConditionalRendering(predicateBuffer, i * sizeof(uint32_t));
+                cmdBuffer->drawIndexedInstanced(indexCount, 1, 0, 0, i);
+                cmdBuffer->endConditionalRendering();
+            }
+        #endif // VK_EXT_conditional_rendering
+            else if (occludeeVisible[i])
+                cmdBuffer->drawIndexedInstanced(indexCount, 1, 0, 0, i);
+        }
+    }
+
+    void drawProxies(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, const std::unique_ptr<magma::OcclusionQuery>& occlusionQuery)
+    {   // Bounding box of each occludee is tested against depth of the current frame
+        const uint32_t indexCount = proxyCube->getIndexBuffer()->getIndexCount();
+        cmdBuffer->bindDescriptorSet(proxyPipeline, 0, occludeeDescriptorSet);
+        cmdBuffer->bindPipeline(proxyPipeline);
+        cmdBuffer->bindVertexBuffer(0, proxyCube->getVertexBuffer());
+        cmdBuffer->bindIndexBuffer(proxyCube->getIndexBuffer());
+        for (uint32_t i = 0; i < instanceCount; ++i)
+        {
+            cmdBuffer->beginQuery(occlusionQuery, 1 + i);
+            {
+                cmdBuffer->drawIndexedInstanced(indexCount, 1, 0, 0, i);
+            }
+            cmdBuffer->endQuery(occlusionQuery, 1 + i);
+        }
+    }
+
+#ifdef VK_EXT_conditional_rendering
+    void copyPredicates(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, const std::unique_ptr<magma::OcclusionQuery>& occlusionQuery)
+    {   // Predicates of this frame should be consumed before they are overwritten
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_CONDITIONAL_RENDERING_BIT_EXT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            magma::BufferMemoryBarrier(predicateBuffer.get(),
+                magma::MemoryBarrier(VK_ACCESS_CONDITIONAL_RENDERING_READ_BIT_EXT, VK_ACCESS_TRANSFER_WRITE_BIT)));
+        // Non-zero sample count is treated as true
+        constexpr bool wait = true;
+        cmdBuffer->copyQueryResults<uint32_t>(occlusionQuery, predicateBuffer, wait, 1, instanceCount);
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_CONDITIONAL_RENDERING_BIT_EXT,
+            magma::BufferMemoryBarrier(predicateBuffer.get(),
+                magma::MemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_CONDITIONAL_RENDERING_READ_BIT_EXT)));
+    }
+#endif // VK_EXT_conditional_rendering
+
+    void rerecordCommandBuffers()
+    {
+        device->waitIdle();
+        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+        {
+            commandBuffers[i]->reset();
+            recordCommandBuffer(i);
+        }
     }
 
     void recordCommandBuffer(uint32_t index)
@@ -203,7 +823,12 @@ public:
         auto& cmdBuffer = commandBuffers[index];
         cmdBuffer->begin();
         {
+            auto& occlusionQuery = occlusionQueries[index];
+            auto& fragmentQuery = fragmentQueries[index];
             cmdBuffer->resetQueryPool(occlusionQuery, 0, occlusionQuery->getQueryCount());
+            cmdBuffer->resetQueryPool(fragmentQuery, 0, 1);
+            if (CullingMode::HiZ == cullingMode)
+                cullInstances(cmdBuffer);
             cmdBuffer->beginRenderPass(renderPass, framebuffers[index],
                 {
                     magma::clear::gray,
@@ -228,8 +853,30 @@ public:
                     teapot->draw(cmdBuffer);
                 }
                 cmdBuffer->endQuery(occlusionQuery, 0);
+                cmdBuffer->beginQuery(fragmentQuery, 0);
+                if (CullingMode::HiZ == cullingMode)
+                {   // Instances that passed culling
+                    cmdBuffer->bindDescriptorSet(instancedPipeline, 0, instanceDescriptorSet);
+                    cmdBuffer->bindPipeline(instancedPipeline);
+                    cmdBuffer->bindVertexBuffer(0, smallTeapot->getVertexBuffer());
+                    cmdBuffer->bindIndexBuffer(smallTeapot->getIndexBuffer());
+                    cmdBuffer->drawIndexedIndirect(drawCommand, 1);
+                }
+                else
+                    drawOccludees(cmdBuffer);
+                cmdBuffer->endQuery(fragmentQuery, 0);
+                if (CullingMode::Queries == cullingMode)
+                    drawProxies(cmdBuffer, occlusionQuery);
             }
             cmdBuffer->endRenderPass();
+            // Depth pyramid will be used to cull instances in the next frame
+            buildDepthPyramid(cmdBuffer);
+            if (CullingMode::HiZ == cullingMode)
+                readbackDrawCommand(cmdBuffer, index);
+        #ifdef VK_EXT_conditional_rendering
+            else if (conditionalRendering)
+                copyPredicates(cmdBuffer, occlusionQuery);
+        #endif
         }
         cmdBuffer->end();
     }
@@ -0,0 +1,26 @@
+#version 450
+
+layout(binding = 0) uniform CullParameters {
+    mat4 viewProj;
+};
+
+layout(binding = 1) readonly buffer Instances {
+   vec4 instances[]; // xyz - origin, w - scale
+};
+
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 texCoord;
+
+layout(location = 0) out vec4 oColor;
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main()
+{   // Each occludee is drawn separately, instance is selected by first instance
+    vec4 originScale = instances[gl_InstanceIndex];
+    vec3 pos = position.xyz * originScale.w + originScale.xyz;
+    oColor = vec4(normal * .5 + .5, 1.);
+    gl_Position = viewProj * vec4(pos, 1.);
+}
@@ -0,0 +1,27 @@
+#version 450
+
+layout(binding = 0) uniform CullParameters {
+    mat4 viewProj;
+};
+
+layout(binding = 1) readonly buffer Instances {
+   vec4 instances[]; // xyz - origin, w - scale
+};
+
+// Bounding box of the teapot in object space
+const vec3 boxCenter = vec3(0.2625, 1.575, 0.);
+const vec3 boxExtent = vec3(3.2625, 1.575, 2.);
+
+layout(location = 0) in vec4 position;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main()
+{   // Unit cube is stretched to the bounding box of occludee
+    vec4 originScale = instances[gl_InstanceIndex];
+    vec3 box = position.xyz * boxExtent + boxCenter;
+    vec3 pos = box * originScale.w + originScale.xyz;
+    gl_Position = viewProj * vec4(pos, 1.);
+}
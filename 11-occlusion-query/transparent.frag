@@ -0,0 +1,5 @@
+#version 450
+
+void main()
+{   // Color writes are masked, only samples that pass depth test are counted
+}
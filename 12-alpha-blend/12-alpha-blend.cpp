@@ -1,19 +1,28 @@
 #include "../framework/vulkanApp.h"
 #include "../framework/utilities.h"
+#include "../framework/progressiveTexture.h"
 #include "quadric/include/cube.h"
 
 class AlphaBlendApp : public VulkanApp
 {
+    struct alignas(16) TexParameters
+    {
+        float minLod;
+    };
+
     struct DescriptorSetTable
     {
         magma::descriptor::UniformBuffer worldViewProj = 0;
         magma::descriptor::CombinedImageSampler diffuse = 1;
+        magma::descriptor::UniformBuffer texParameters = 2;
     } setTable;
 
     std::unique_ptr<quadric::Cube> mesh;
+    std::unique_ptr<ProgressiveTexture> logoMips;
     std::unique_ptr<magma::ImageView> logo;
     std::unique_ptr<magma::Sampler> anisotropicSampler;
     std::unique_ptr<magma::UniformBuffer<rapid::matrix>> uniformWorldViewProj;
+    std::unique_ptr<magma::UniformBuffer<TexParameters>> uniformTexParameters;
     std::unique_ptr<magma::DescriptorSet> descriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> cullFrontPipeline;
     std::unique_ptr<magma::GraphicsPipeline> cullBackPipeline;
@@ -41,6 +50,7 @@ public:
     void render(uint32_t bufferIndex) override
     {
         updatePerspectiveTransform();
+        streamMipLevels();
         submitCommandBuffer(bufferIndex);
     }
 
@@ -87,63 +97,44 @@ public:
         mesh = std::make_unique<quadric::Cube>(cmdBufferCopy);
     }
 
-    std::unique_ptr<magma::ImageView> loadTexture(const std::string& filename, const std::unique_ptr<magma::SrcTransferBuffer>& buffer)
+    void loadTextures()
     {
-        std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-        if (!file.is_open())
-            throw std::runtime_error("failed to open file \"" + filename + "\"");
-        const std::streamoff size = file.tellg();
-        file.seekg(0, std::ios::beg);
-        gliml::context ctx;
-        ctx.enable_dxt(true);
-        VkDeviceSize bufferOffset = buffer->getPrivateData();
-        VkDeviceSize baseMipOffset = 0;
-        magma::mapRange<uint8_t>(buffer, bufferOffset, (VkDeviceSize)size,
-            [&](uint8_t *data)
-            {   // Read data to buffer
-                file.read(reinterpret_cast<char *>(data), size);
-                file.close();
-                if (!ctx.load(data, static_cast<unsigned>(size)))
-                    throw std::runtime_error("failed to load DDS texture");
-                // Skip DDS header
-                baseMipOffset = reinterpret_cast<const uint8_t *>(ctx.image_data(0, 0)) - data;
-            });
-        buffer->setPrivateData(bufferOffset + size);
-        // Setup texture data description
-        const uint8_t *firstMipData = (const uint8_t *)ctx.image_data(0, 0);
-        magma::Mipmap mipMap;
-        mipMap.reserve(ctx.num_mipmaps(0));
-        for (int level = 0; level < ctx.num_mipmaps(0); ++level)
-        {
-            const ptrdiff_t offset = (const uint8_t *)ctx.image_data(0, level) - firstMipData;
-            mipMap.emplace_back(
-                ctx.image_width(0, level),
-                ctx.image_height(0, level),
-                (VkDeviceSize)offset);
+        cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        {   // Only mip tail is copied before the first frame
+            logoMips = std::make_unique<ProgressiveTexture>(device, "logo.dds", stagingRing, cmdImageCopy);
         }
-        // Upload texture data from buffer
-        const magma::Image::CopyLayout bufferLayout{bufferOffset + baseMipOffset, 0, 0};
-        const VkFormat format = utilities::getBlockCompressedFormat(ctx);
-        std::unique_ptr<magma::Image> image = std::make_unique<magma::Image2D>(cmdImageCopy, format, std::move(buffer), mipMap, bufferLayout);
-        // Create image view for shader
-        return std::make_unique<magma::UniqueImageView>(std::move(image));
+        cmdImageCopy->end();
+        submitCopyImageCommands();
+        logo = std::make_unique<magma::SharedImageView>(logoMips->getImage());
     }
 
-    void loadTextures()
-    {
-        constexpr VkDeviceSize bufferSize = 1024 * 1024;
-        auto buffer = std::make_unique<magma::SrcTransferBuffer>(device, bufferSize);
+    void streamMipLevels()
+    {   // Raise resolution by one mip level per frame
+        if (logoMips->resident())
+            return;
         cmdImageCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
         {
-            logo = loadTexture("logo.dds", buffer);
+            logoMips->update(cmdImageCopy);
         }
         cmdImageCopy->end();
         submitCopyImageCommands();
+        updateTexParameters();
+    }
+
+    void updateTexParameters()
+    {
+        magma::map(uniformTexParameters,
+            [this](auto *block)
+            {   // Sample levels that have been uploaded
+                block->minLod = logoMips->getMinLod();
+            });
     }
 
     void createUniformBuffers()
     {
         uniformWorldViewProj = std::make_unique<magma::UniformBuffer<rapid::matrix>>(device);
+        uniformTexParameters = std::make_unique<magma::UniformBuffer<TexParameters>>(device);
+        updateTexParameters();
     }
 
     void createSampler()
@@ -155,6 +146,7 @@ public:
     {
         setTable.worldViewProj = uniformWorldViewProj;
         setTable.diffuse = {logo, anisotropicSampler};
+        setTable.texParameters = uniformTexParameters;
         descriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
             setTable, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
             nullptr, 0, shaderReflectionFactory, "texture");
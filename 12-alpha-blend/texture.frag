@@ -1,6 +1,9 @@
 #version 450
 
 layout(binding = 1) uniform sampler2D diffuse;
+layout(binding = 2) uniform TexParameters {
+    float minLod;
+} texParameters;
 
 layout(location = 0) in vec2 texCoord;
 layout(location = 1) in vec3 faceColor;
@@ -9,7 +12,19 @@ layout(location = 0) out vec4 oColor;
 
 void main()
 {
-    vec4 color = texture(diffuse, texCoord);
+    vec4 color;
+    if (texParameters.minLod > 0.)
+    {   // Don't sample mip levels that are not uploaded yet.
+        // Anisotropic filter selects level by the minor axis
+        // of footprint, so scale gradients to clamp it.
+        vec2 size = vec2(textureSize(diffuse, 0));
+        vec2 dx = dFdx(texCoord), dy = dFdy(texCoord);
+        float minorLod = log2(min(length(dx * size), length(dy * size)));
+        float scale = exp2(max(texParameters.minLod - minorLod, 0.));
+        color = textureGrad(diffuse, texCoord, dx * scale, dy * scale);
+    }
+    else
+        color = texture(diffuse, texCoord);
     float alpha = min(color.a + 0.1, 1.); // make geometry visible
     if (gl_FrontFacing)
         oColor = vec4(color.rgb + texCoord.sts, alpha);
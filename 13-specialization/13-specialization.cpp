@@ -170,7 +170,7 @@ public:
 
     void loadShaders()
     {
-        aligned_vector<char> bytecode = utilities::loadBinaryFile("transform.o");
+        utilities::FileView bytecode = utilities::loadBinaryFile("transform.o");
         vertexShader = std::make_shared<magma::ShaderModule>(device, (const magma::SpirvWord *)bytecode.data(), bytecode.size());
         bytecode = utilities::loadBinaryFile("specialized.o");
         fragmentShader = std::make_shared<magma::ShaderModule>(device, (const magma::SpirvWord *)bytecode.data(), bytecode.size());
@@ -1,4 +1,6 @@
+#include <iostream>
 #include "../framework/vulkanApp.h"
+#include "../framework/pipelineStatistics.h"
 #include "particlesystem.h"
 
 // Use Space to reset particles + mouse to rotate scene
@@ -13,9 +15,11 @@ class ParticlesApp : public VulkanApp
     std::unique_ptr<magma::UniformBuffer<rapid::matrix>> uniformBuffer;
     std::unique_ptr<magma::DescriptorSet> descriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> graphicsPipeline;
+    std::unique_ptr<PipelineStatistics> pipelineStatistics;
 
     static constexpr float fov = rapid::radians(60.f);
     rapid::matrix viewProj;
+    uint32_t lastPrintFrame = 0;
 
 public:
     ParticlesApp(const AppEntry& entry):
@@ -27,6 +31,7 @@ public:
         createUniformBuffer();
         setupDescriptorSet();
         setupPipeline();
+        createPipelineStatistics();
         for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
             recordCommandBuffer(i);
         timer->run();
@@ -36,6 +41,11 @@ public:
     {
         particles->update(timer->secondsElapsed());
         updatePerspectiveTransform();
+        if (pipelineStatistics)
+        {
+            printPipelineStatistics();
+            pipelineStatistics->submitted(bufferIndex, frameCount);
+        }
         submitCommandBuffer(bufferIndex);
     }
 
@@ -138,11 +148,32 @@ public:
             pipelineCache);
     }
 
+    void createPipelineStatistics()
+    {   // Not every device is able to count pipeline statistics
+        if (PipelineStatistics::supported(physicalDevice))
+            pipelineStatistics = std::make_unique<PipelineStatistics>(device, (uint32_t)commandBuffers.size());
+    }
+
+    void printPipelineStatistics()
+    {   // Print once in a while to not flood the console
+        constexpr uint32_t printInterval = 100; // In frames
+        if (pipelineStatistics->resolve() && (frameCount - lastPrintFrame >= printInterval))
+        {   // Average number of fragments shaded per pixel of the screen
+            const PipelineStatistics::Counters& counters = pipelineStatistics->getCounters();
+            const float overdraw = counters.fragmentShaderInvocations / float(width * height);
+            std::cout << "Frame " << pipelineStatistics->getFrame() << ": " << counters
+                << ", overdraw: " << overdraw << std::endl;
+            lastPrintFrame = frameCount;
+        }
+    }
+
     void recordCommandBuffer(uint32_t index)
     {
         auto& cmdBuffer = commandBuffers[index];
         cmdBuffer->begin();
         {
+            if (pipelineStatistics)
+                pipelineStatistics->begin(cmdBuffer, index);
             cmdBuffer->beginRenderPass(renderPass, framebuffers[index],
                 {
                     magma::clear::black,
@@ -155,6 +186,8 @@ public:
                 particles->draw(cmdBuffer, graphicsPipeline);
             }
             cmdBuffer->endRenderPass();
+            if (pipelineStatistics)
+                pipelineStatistics->end(cmdBuffer, index);
         }
         cmdBuffer->end();
     }
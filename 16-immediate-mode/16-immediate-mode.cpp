@@ -1,16 +1,25 @@
+#include <iostream>
+#include <algorithm>
 #include "../framework/vulkanApp.h"
+#include "../framework/immediateDraw.h"
 
+// Use Space to toggle overlay of 100K lines
 class ImmediateModeApp : public VulkanApp
 {
-    std::unique_ptr<magma::aux::ImmediateRender> ir;
+    std::unique_ptr<ImmediateDraw> ir;
+    std::vector<std::shared_ptr<magma::CommandBuffer>> secondaryCommandBuffers;
+    bool lineField = false;
+    float time = 0.f;
+    uint32_t lastPrintFrame = 0;
 
 public:
     ImmediateModeApp(const AppEntry& entry):
         VulkanApp(entry, TEXT("16 - Immediate mode"), 512, 512)
     {
         initialize();
-        createImmediateRender();
-        drawImmediate();
+        createImmediateDraw();
+        createSecondaryCommandBuffers();
+        timer->run();
     }
 
     void createLogicalDevice() override
@@ -35,28 +44,57 @@ public:
         device = physicalDevice->createDevice({graphicsQueueDesc}, {}, enabledExtensions, features);
     }
 
-    void createImmediateRender()
-    {
-        constexpr uint32_t maxVertexCount = 1024;
-        ir = std::make_unique<magma::aux::ImmediateRender>(maxVertexCount, std::move(renderPass), nullptr);
-        ir->setLineWidth(2.f);
+    void createImmediateDraw()
+    {   // Frame slot per command buffer, vertex arena will grow on demand
+        const uint32_t frameSlotCount = (uint32_t)commandBuffers.size();
+        ir = std::make_unique<ImmediateDraw>(device, renderPass, pipelineCache, "immediate", "vertexColor", frameSlotCount);
+    }
+
+    void createSecondaryCommandBuffers()
+    {   // Debug draws are recorded into secondary command buffer every frame
+        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+            secondaryCommandBuffers.push_back(std::make_shared<magma::SecondaryCommandBuffer>(commandPools[0]));
     }
 
     void render(uint32_t bufferIndex) override
-    {
+    {   /* Previous submission of this command buffer has been completed,
+           so its frame slot can be overwritten while other ones are in flight. */
+        time += timer->secondsElapsed();
+        drawImmediate(bufferIndex);
+        recordCommandBuffer(bufferIndex);
         submitCommandBuffer(bufferIndex);
+        printStatistics();
     }
 
-    void onResize(uint32_t width, uint32_t height) override
+    void onKeyDown(char key, int repeat, uint32_t flags) override
     {
-        createRenderPass();
-        VulkanApp::onResize(width, height);
-        createImmediateRender();
-        drawImmediate();
+        switch (key)
+        {
+        case AppKey::Space:
+            lineField = !lineField;
+            break;
+        }
+        VulkanApp::onKeyDown(key, repeat, flags);
     }
 
-    void drawImmediate()
-    {
+    void printStatistics()
+    {   // Print once in a while to not flood the console
+        constexpr uint32_t printInterval = 100; // In frames
+        if (frameCount - lastPrintFrame >= printInterval)
+        {
+            std::cout << ir->getVertexCount() << " vertices, " << ir->getPrimitiveCount() << " primitives in "
+                << ir->getDrawCount() << " draw calls, " << ir->getUploadSize() / 1024 << " KB uploaded" << std::endl;
+            lastPrintFrame = frameCount;
+        }
+    }
+
+    void drawImmediate(uint32_t frameSlot)
+    {   // Everything is emitted from scratch every frame
+        ir->reset();
+        ir->setRasterizationState(magma::renderstate::fillCullNoneCcw);
+        ir->setLineWidth(2.f);
+        if (lineField)
+            drawLineField();
         drawPoints();
         drawLines();
         drawLineStrip();
@@ -67,14 +105,67 @@ public:
         drawTriangles();
         drawTriangleStrip();
         drawTriangleFan();
-        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
-            recordCommandBuffer(i);
-        ir->reset();
+        drawParticles();
+        ir->upload(frameSlot);
+    }
+
+    void drawParticles()
+    {   // Dynamic content: orbiting particles with velocity vectors and their bounds
+        constexpr uint32_t particleCount = 16;
+        constexpr float cx = 0.08f, cy = -0.7f;
+        constexpr float twoPi = 6.2831853f;
+        float minX = cx, maxX = cx, minY = cy, maxY = cy;
+        ir->setRasterizationState(magma::renderstate::lineCullNoneCcw);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Lines);
+        for (uint32_t i = 0; i < particleCount; ++i)
+        {   // Inner and outer orbits
+            const float radius = (i & 1) ? 0.12f : 0.06f;
+            const float angle = time / radius * 0.1f + i * twoPi / particleCount;
+            const float x = cx + cosf(angle) * radius;
+            const float y = cy + sinf(angle) * radius;
+            const float vx = -sinf(angle) * 0.05f;
+            const float vy = cosf(angle) * 0.05f;
+            ir->color(1.f, 1.f, 0.f);
+            ir->vertex(x, y);
+            ir->color(1.f, 0.f, 0.f);
+            ir->vertex(x + vx, y + vy);
+            minX = std::min(minX, x); maxX = std::max(maxX, x);
+            minY = std::min(minY, y); maxY = std::max(maxY, y);
+        }
+        ir->endPrimitive();
+        // Merged with velocities into the same draw
+        ir->beginPrimitive(ImmediateDraw::Primitive::LineLoop);
+        {
+            ir->color(0.f, 1.f, 0.f);
+            ir->vertex(minX, minY);
+            ir->vertex(maxX, minY);
+            ir->vertex(maxX, maxY);
+            ir->vertex(minX, maxY);
+        }
+        ir->endPrimitive();
+    }
+
+    void drawLineField()
+    {   // Dense overlay that is merged into a single draw call
+        constexpr uint32_t lineCount = 100000;
+        constexpr float goldenAngle = 2.39996323f;
+        ir->setRasterizationState(magma::renderstate::lineCullNoneCcw);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Lines);
+        for (uint32_t i = 0; i < lineCount; ++i)
+        {
+            const float radius = sqrtf(i / (float)lineCount);
+            const float x = cosf(i * goldenAngle) * radius;
+            const float y = sinf(i * goldenAngle) * radius;
+            ir->color(radius, 1.f - radius, 0.5f, 0.25f);
+            ir->vertex(x, y);
+            ir->vertex(x * 0.98f, y * 0.98f);
+        }
+        ir->endPrimitive();
     }
 
     void drawPoints()
     {
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_POINT_LIST);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Points);
         {
             ir->color(1.f, 0.f, 0.f);
             ir->pointSize(3.0f);
@@ -97,7 +188,7 @@ public:
 
     void drawLines()
     {
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_LINE_LIST);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Lines);
         {
             ir->color(1.f, 0.f, 0.f);
             ir->vertex(-0.332f, 0.961f);
@@ -114,7 +205,7 @@ public:
 
     void drawLineStrip()
     {
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_LINE_STRIP);
+        ir->beginPrimitive(ImmediateDraw::Primitive::LineStrip);
         {
             ir->color(1.f, 1.f, 0.f);
             ir->vertex(0.266f, 0.754f);
@@ -130,7 +221,7 @@ public:
 
     void drawLineLoop()
     {
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_LINE_STRIP);
+        ir->beginPrimitive(ImmediateDraw::Primitive::LineLoop);
         {
             ir->color(1.f, 0.f, 0.f);
             ir->vertex(-0.875f, 0.359f);
@@ -145,14 +236,14 @@ public:
             ir->color(1.f, 0.f, 1.f);
             ir->vertex(-0.719f, 0.398f);
         }
-        ir->endPrimitive(true);
+        ir->endPrimitive();
     }
 
     void drawPolygon()
-    {   // Polygons are not present in Vulkan, have to be emulated by triangle fan
+    {   // Polygons are not present in Vulkan, converted to triangle list
         ir->setRasterizationState(negateViewport ? magma::renderstate::fillCullBackCw
                                                  : magma::renderstate::fillCullBackCcw);
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Polygon);
         {
             ir->color(0.f, 0.5f, 0.5f);
             ir->vertex(-0.277f, 0.277f);
@@ -165,34 +256,34 @@ public:
     }
 
     void drawQuads()
-    {   // Quads are not present in Vulkan, have to be emulated by triangle strips
+    {   // Quads are not present in Vulkan, converted to triangle list
         ir->setRasterizationState(negateViewport ? magma::renderstate::lineCullBackCcw
                                                  : magma::renderstate::lineCullBackCw);
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Quads);
         {
             ir->color(1.f, 0.f, 0.f);
             ir->vertex(0.301f, 0.476f);
             ir->vertex(0.438f, 0.273f);
-            ir->vertex(0.434f, 0.543f);
             ir->vertex(0.586f, 0.406f);
+            ir->vertex(0.434f, 0.543f);
         }
         ir->endPrimitive();
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Quads);
         {
             ir->color(0.f, 1.f, 0.f);
             ir->vertex(0.66f, 0.27f);
             ir->vertex(0.878f, 0.27f);
-            ir->vertex(0.66f, 0.476f);
             ir->vertex(0.949f, 0.476f);
+            ir->vertex(0.66f, 0.476f);
         }
         ir->endPrimitive();
     }
 
     void drawQuadStrip()
-    {   // Quad strip not present in Vulkan, have to be emulated by triangle strip
+    {   // Quad strip not present in Vulkan, converted to triangle list
         ir->setRasterizationState(negateViewport ? magma::renderstate::lineCullBackCw
                                                  : magma::renderstate::lineCullBackCcw);
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+        ir->beginPrimitive(ImmediateDraw::Primitive::QuadStrip);
         {
             ir->color(0.f, 0.f, 0.5f);
             ir->vertex(-0.746f, -0.203f);
@@ -211,7 +302,7 @@ public:
     {
         ir->setRasterizationState(negateViewport ? magma::renderstate::fillCullBackCcw
                                                  : magma::renderstate::fillCullBackCw);
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Triangles);
         {
             ir->color(1.f, 0.f, 0.f);
             ir->vertex(0.227f, 0.f);
@@ -228,7 +319,7 @@ public:
         ir->endPrimitive();
         ir->setRasterizationState(magma::renderstate::lineCullBackCcw);
         ir->color(0.f, 0.f, 1.f);
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        ir->beginPrimitive(ImmediateDraw::Primitive::Triangles);
         {
             ir->vertex(0.73f, -0.275f);
             ir->vertex(0.949f, -0.275f);
@@ -241,7 +332,7 @@ public:
     {
         ir->setRasterizationState(negateViewport ? magma::renderstate::lineCullBackCw
                                                  : magma::renderstate::lineCullBackCcw);
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+        ir->beginPrimitive(ImmediateDraw::Primitive::TriangleStrip);
         {
             ir->color(1.f, 0.f, 0.f);
             ir->vertex(-0.938f, -0.75f);
@@ -260,7 +351,7 @@ public:
         ir->setLineWidth(3.f);
         ir->setRasterizationState(negateViewport ? magma::renderstate::lineCullBackCw
                                                  : magma::renderstate::lineCullBackCcw);
-        ir->beginPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN);
+        ir->beginPrimitive(ImmediateDraw::Primitive::TriangleFan);
         {
             ir->color(0.f, 0.f, 0.f);
             ir->vertex(0.586f, -0.75f);
@@ -274,16 +365,24 @@ public:
     }
 
     void recordCommandBuffer(uint32_t index)
-    {
+    {   // Dynamic state isn't inherited by secondary command buffer
+        auto& secondaryCmdBuffer = secondaryCommandBuffers[index];
+        secondaryCmdBuffer->reset();
+        secondaryCmdBuffer->beginInherited(renderPass, 0, framebuffers[index]);
+        {
+            secondaryCmdBuffer->setViewport(0, 0, width, negateViewport ? -int32_t(height) : height);
+            secondaryCmdBuffer->setScissor(0, 0, width, height);
+            ir->draw(secondaryCmdBuffer, index);
+        }
+        secondaryCmdBuffer->end();
         auto& cmdBuffer = commandBuffers[index];
         cmdBuffer->reset();
         cmdBuffer->begin();
         {
-            cmdBuffer->beginRenderPass(ir->getRenderPass(), framebuffers[index], {magma::clear::gray});
+            cmdBuffer->beginRenderPass(renderPass, framebuffers[index], {magma::clear::gray},
+                VkRect2D{{0, 0}, {width, height}}, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
             {
-                cmdBuffer->setViewport(0, 0, width, negateViewport ? -int32_t(height) : height);
-                cmdBuffer->setScissor(0, 0, width, height);
-                ir->commitPrimitives(cmdBuffer, false);
+                cmdBuffer->executeCommands(secondaryCmdBuffer);
             }
             cmdBuffer->endRenderPass();
         }
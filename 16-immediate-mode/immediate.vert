@@ -0,0 +1,21 @@
+#version 450
+
+layout(push_constant) uniform PushConstants {
+    mat4 transform;
+};
+
+layout(location = 0) in vec4 position; // w - point size
+layout(location = 1) in vec4 color;
+
+layout(location = 0) out vec4 oColor;
+out gl_PerVertex {
+    vec4 gl_Position;
+    float gl_PointSize;
+};
+
+void main()
+{
+    gl_Position = transform * vec4(position.xyz, 1.);
+    gl_PointSize = position.w;
+    oColor = color;
+}
@@ -1,9 +1,18 @@
 #include <fstream>
+#include <list>
+#include <mutex>
+#include <shaderc/shaderc.h>
 #include "../framework/vulkanApp.h"
 #include "../framework/utilities.h"
+#include "../framework/dynamicResolution.h"
 #include "watchdog.h"
+#include "spirvCache.h"
 
 // Build this application with Release configuration as shaderc_combined.lib was built in release mode.
+#ifndef SHADERC_VERSION
+#define SHADERC_VERSION "unknown" // Defined by Makefile, otherwise clear shader cache after compiler upgrade
+#endif
+// Space toggles adaptive resolution, Tab switches upscale filter.
 
 class ShaderToyApp : public VulkanApp
 {
@@ -19,48 +28,91 @@ class ShaderToyApp : public VulkanApp
         magma::descriptor::UniformBuffer builtinUniforms = 0;
     } setTable;
 
+    struct RetiredPipeline
+    {
+        std::unique_ptr<magma::GraphicsPipeline> pipeline;
+        uint32_t frame;
+    };
+
     std::unique_ptr<FileWatchdog> watchdog;
-    std::unique_ptr<magma::aux::ShaderCompiler> glslCompiler;
+    std::unique_ptr<SpirvCache> spirvCache;
+    shaderc_compiler_t glslCompiler = nullptr;
+    shaderc_compile_options_t compileOptions = nullptr;
+    std::string compileOptionsString;
     std::shared_ptr<magma::ShaderModule> vertexShader;
     std::shared_ptr<magma::ShaderModule> fragmentShader;
     std::unique_ptr<magma::UniformBuffer<BuiltInUniforms>> builtinUniforms;
     std::unique_ptr<magma::DescriptorSet> descriptorSet;
     std::unique_ptr<magma::GraphicsPipeline> graphicsPipeline;
+    std::unique_ptr<magma::GraphicsPipeline> readyPipeline;
+    std::list<RetiredPipeline> retiredPipelines;
+    std::mutex pipelineAccess;
+    std::unique_ptr<DynamicResolution> dynamicResolution;
 
-    std::atomic<bool> rebuildCommandBuffers;
+    std::vector<bool> outdatedCommandBuffers;
     int mouseX = 0;
     int mouseY = 0;
     bool dragging = false;
+    uint32_t lastPrintFrame = 0;
 
 public:
     ShaderToyApp(const AppEntry& entry):
-        VulkanApp(entry, TEXT("17 - ShaderToy"), 512, 512),
-        rebuildCommandBuffers(false)
+        VulkanApp(entry, TEXT("17 - ShaderToy"), 512, 512)
     {
         initialize();
+        initializeCompiler();
+        createDynamicResolution();
         vertexShader = compileShader("quad.vert");
         fragmentShader = compileShader("shader.frag");
-        initializeWatchdog();
         createUniformBuffer();
         setupDescriptorSet();
-        setupPipeline();
-        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
-            recordCommandBuffer(i);
+        graphicsPipeline = createPipeline(vertexShader, fragmentShader);
+        outdatedCommandBuffers.resize(commandBuffers.size(), true);
+        initializeWatchdog();
         timer->run();
     }
 
+    ~ShaderToyApp()
+    {   // Callback uses members that would be destroyed before the watchdog
+        watchdog.reset();
+        shaderc_compile_options_release(compileOptions);
+        shaderc_compiler_release(glslCompiler);
+    }
+
     void render(uint32_t bufferIndex) override
     {
-        if (rebuildCommandBuffers)
-        {
-            waitFences[1 - bufferIndex]->wait();
-            setupPipeline();
-            for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
-                recordCommandBuffer(i);
-            rebuildCommandBuffers = false;
+        swapPipeline();
+        if (dynamicResolution->update())
+            invalidateCommandBuffers();
+        if (outdatedCommandBuffers[bufferIndex])
+        {   // Swapchain image has been acquired, so its previous submission is retired
+            recordCommandBuffer(bufferIndex);
+            outdatedCommandBuffers[bufferIndex] = false;
         }
         updateUniforms();
         submitCommandBuffer(bufferIndex);
+        dynamicResolution->submitted(bufferIndex);
+        printStatistics();
+    }
+
+    void onKeyDown(char key, int repeat, uint32_t flags) override
+    {
+        switch (key)
+        {
+        case AppKey::Space:
+            dynamicResolution->setAdaptive(!dynamicResolution->getAdaptive());
+            std::cout << "adaptive resolution " << (dynamicResolution->getAdaptive() ? "on" : "off") << std::endl;
+            invalidateCommandBuffers();
+            break;
+        case AppKey::Tab:
+            if (DynamicResolution::Filter::Bilinear == dynamicResolution->getFilter())
+                dynamicResolution->setFilter(DynamicResolution::Filter::EdgeAware);
+            else
+                dynamicResolution->setFilter(DynamicResolution::Filter::Bilinear);
+            invalidateCommandBuffers();
+            break;
+        }
+        VulkanApp::onKeyDown(key, repeat, flags);
     }
 
     void onMouseMove(int x, int y) override
@@ -85,49 +137,150 @@ public:
     void onResize(uint32_t width, uint32_t height) override
     {
         VulkanApp::onResize(width, height);
-        rebuildCommandBuffers = true;
+        dynamicResolution->resize({width, height});
+        // Viewport is dynamic, so pipeline remains valid
+        invalidateCommandBuffers();
+    }
+
+    void invalidateCommandBuffers()
+    {   // Re-record lazily before the next submission of each buffer
+        std::fill(outdatedCommandBuffers.begin(), outdatedCommandBuffers.end(), true);
+    }
+
+    void swapPipeline()
+    {
+        {
+            std::lock_guard<std::mutex> guard(pipelineAccess);
+            if (readyPipeline)
+            {   // Command buffers recorded with the old pipeline may still be in flight
+                retiredPipelines.push_back({std::move(graphicsPipeline), frameCount});
+                graphicsPipeline = std::move(readyPipeline);
+                invalidateCommandBuffers();
+            }
+        }
+        // There can't be more frames in flight than swapchain images
+        const uint32_t maxFramesInFlight = swapchain->getImageCount();
+        while (!retiredPipelines.empty() &&
+            frameCount - retiredPipelines.front().frame >= maxFramesInFlight)
+        {
+            retiredPipelines.pop_front();
+        }
     }
 
     void updateUniforms()
     {
         magma::map(builtinUniforms,
             [this](auto *builtin)
-            {
+            {   // Shader sees offscreen target as the screen
                 static float totalTime = 0.0f;
                 totalTime += timer->secondsElapsed();
-                builtin->iResolution.x = static_cast<float>(width);
-                builtin->iResolution.y = static_cast<float>(height);
-                builtin->iMouse.x = static_cast<float>(mouseX);
-                builtin->iMouse.y = static_cast<float>(mouseY);
+                const VkExtent2D renderExtent = dynamicResolution->getRenderExtent();
+                builtin->iResolution.x = static_cast<float>(renderExtent.width);
+                builtin->iResolution.y = static_cast<float>(renderExtent.height);
+                builtin->iMouse.x = mouseX * renderExtent.width/(float)width;
+                builtin->iMouse.y = mouseY * renderExtent.height/(float)height;
                 builtin->iTime = totalTime;
             });
     }
 
+    void printStatistics()
+    {   // Print once in a while to not flood the console
+        constexpr uint32_t printInterval = 100; // In frames
+        if (frameCount - lastPrintFrame >= printInterval)
+        {
+            const VkExtent2D renderExtent = dynamicResolution->getRenderExtent();
+            std::cout << "GPU time: " << dynamicResolution->getGpuTime() << " ms, "
+                << "render scale: " << dynamicResolution->getScale()
+                << " (" << renderExtent.width << "x" << renderExtent.height << ")" << std::endl;
+            lastPrintFrame = frameCount;
+        }
+    }
+
+    void createDynamicResolution()
+    {   // Path tracer is fill-rate bound, so trade resolution for stable frame rate
+        constexpr float frameTimeBudget = 12.f; // In milliseconds
+        dynamicResolution = std::make_unique<DynamicResolution>(device, descriptorPool,
+            renderPass, pipelineCache,
+            "quad",
+            VkExtent2D{width, height},
+            (uint32_t)commandBuffers.size(),
+            frameTimeBudget);
+        if (!dynamicResolution->timestampsSupported())
+            std::cout << "timestamps not supported, render scale is fixed" << std::endl;
+    }
+
+    void initializeCompiler()
+    {
+        glslCompiler = shaderc_compiler_initialize();
+        compileOptions = shaderc_compile_options_initialize();
+        constexpr shaderc_optimization_level optimizationLevel = shaderc_optimization_level_performance;
+        shaderc_compile_options_set_optimization_level(compileOptions, optimizationLevel);
+        // Cached SPIR-V depends on compile options, compiler build and SPIR-V version it emits
+        unsigned version, revision;
+        shaderc_get_spv_version(&version, &revision);
+        compileOptionsString = "optimization=" + std::to_string(optimizationLevel) +
+            " shaderc=" SHADERC_VERSION
+            " spirv=" + std::to_string(version) + "." + std::to_string(revision);
+        spirvCache = std::make_unique<SpirvCache>("shadercache");
+    }
+
     std::shared_ptr<magma::ShaderModule> compileShader(const std::string& filename)
     {
-        std::shared_ptr<magma::ShaderModule> shaderModule;
         std::ifstream file(filename);
-        if (file.is_open())
+        if (!file.is_open())
+            throw std::runtime_error("failed to open file \"" + std::string(filename) + "\"");
+        const std::string source((std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>());
+        const bool vertexStage = filename.find(".vert") != std::string::npos;
+        const VkShaderStageFlagBits stage = vertexStage ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+        const char *entrypoint = "main";
+        const uint64_t key = spirvCache->computeKey(source, stage, entrypoint, compileOptionsString);
+        auto entry = spirvCache->find(key);
+        if (entry)
         {
-            std::string source((std::istreambuf_iterator<char>(file)),
-                std::istreambuf_iterator<char>());
-            std::cout << "compiling shader \"" << filename << "\"" << std::endl;
-            if (!glslCompiler)
-                glslCompiler = std::make_unique<magma::aux::ShaderCompiler>(device, nullptr);
-            if (filename.find(".vert") != std::string::npos)
-                shaderModule = glslCompiler->compileShader(source, "main", VK_SHADER_STAGE_VERTEX_BIT);
-            else
-                shaderModule = glslCompiler->compileShader(source, "main", VK_SHADER_STAGE_FRAGMENT_BIT);
+            std::cout << "loading cached shader \"" << filename << "\"" << std::endl;
+            return createShaderModule(entry->getBytecode(), entry->getBytecodeSize());
         }
-        else
+        std::cout << "compiling shader \"" << filename << "\"" << std::endl;
+        shaderc_compilation_result_t result = shaderc_compile_into_spv(glslCompiler,
+            source.data(), source.size(),
+            vertexStage ? shaderc_vertex_shader : shaderc_fragment_shader,
+            filename.c_str(), entrypoint, compileOptions);
+        if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success)
         {
-            throw std::runtime_error("failed to open file \"" + std::string(filename) + "\"");
+            const std::string errorMessage = shaderc_result_get_error_message(result);
+            shaderc_result_release(result);
+            throw std::runtime_error(errorMessage);
         }
+        const uint32_t *bytecode = reinterpret_cast<const uint32_t *>(shaderc_result_get_bytes(result));
+        const std::size_t bytecodeSize = shaderc_result_get_length(result);
+        if (!spirvCache->store(key, bytecode, bytecodeSize))
+            std::cout << "failed to cache shader \"" << filename << "\"" << std::endl;
+        std::shared_ptr<magma::ShaderModule> shaderModule;
+        try
+        {
+            shaderModule = createShaderModule(bytecode, bytecodeSize);
+        } catch (...)
+        {
+            shaderc_result_release(result);
+            throw;
+        }
+        shaderc_result_release(result);
         return shaderModule;
     }
 
+    std::shared_ptr<magma::ShaderModule> createShaderModule(const uint32_t *bytecode, std::size_t bytecodeSize) const
+    {
+        constexpr bool reflect = true;
+        return std::make_shared<magma::ShaderModule>(device,
+            reinterpret_cast<const magma::SpirvWord *>(bytecode), bytecodeSize, 0,
+            device->getHostAllocator(), reflect, 0);
+    }
+
     void initializeWatchdog()
     {
+        // Called from the watchdog's worker thread, so both shader
+        // compilation and pipeline build are off the render thread.
         auto onModified = [this](const std::string& filename) -> void
         {
             try
@@ -136,15 +289,20 @@ public:
                     vertexShader = compileShader(filename);
                 else
                     fragmentShader = compileShader(filename);
-                rebuildCommandBuffers = true;
+                auto pipeline = createPipeline(vertexShader, fragmentShader);
+                std::lock_guard<std::mutex> guard(pipelineAccess);
+                // Pipeline that hasn't been swapped in yet is never used by the GPU
+                readyPipeline = std::move(pipeline);
             } catch (const std::exception& exception)
             {
                 std::cout << exception.what();
             }
         };
 
-        constexpr std::chrono::milliseconds pollFrequency(500);
-        watchdog = std::make_unique<FileWatchdog>(pollFrequency);
+        // Editors may emit several events per save
+        constexpr std::chrono::milliseconds debounceDelay(50);
+        constexpr std::chrono::milliseconds pollFrequency(500); // If inotify isn't available
+        watchdog = std::make_unique<FileWatchdog>(debounceDelay, pollFrequency);
         watchdog->watchFor("quad.vert", onModified);
         watchdog->watchFor("shader.frag", onModified);
     }
@@ -161,26 +319,29 @@ public:
             setTable, VK_SHADER_STAGE_FRAGMENT_BIT);
     }
 
-    void setupPipeline()
+    std::unique_ptr<magma::GraphicsPipeline> createPipeline(std::shared_ptr<magma::ShaderModule> vertexShader,
+        std::shared_ptr<magma::ShaderModule> fragmentShader) const
     {
         std::vector<magma::PipelineShaderStage> shaderStages = {
-            magma::PipelineShaderStage(vertexShader),
-            magma::PipelineShaderStage(fragmentShader)
+            magma::PipelineShaderStage(std::move(vertexShader)),
+            magma::PipelineShaderStage(std::move(fragmentShader))
         };
         auto layout = std::make_unique<magma::PipelineLayout>(descriptorSet->getLayout());
-        graphicsPipeline = std::make_unique<magma::GraphicsPipeline>(device,
+        return std::make_unique<magma::GraphicsPipeline>(device,
             shaderStages,
             magma::renderstate::nullVertexInput,
             magma::renderstate::triangleStrip,
             magma::TesselationState(),
-            magma::ViewportState(0, 0, width, height),
+            magma::ViewportState(0, 0, 1, 1), // Dynamic
             magma::renderstate::fillCullBackCcw,
             magma::renderstate::dontMultisample,
             magma::renderstate::depthAlwaysDontWrite,
             magma::renderstate::dontBlendRgb,
-            std::initializer_list<VkDynamicState>{},
+            std::initializer_list<VkDynamicState>{
+                VK_DYNAMIC_STATE_VIEWPORT,
+                VK_DYNAMIC_STATE_SCISSOR},
             std::move(layout),
-            renderPass, 0,
+            dynamicResolution->getRenderPass(), 0,
             nullptr,
             pipelineCache);
     }
@@ -190,13 +351,18 @@ public:
         auto& cmdBuffer = commandBuffers[index];
         cmdBuffer->reset(false);
         cmdBuffer->begin();
-        {
-            cmdBuffer->beginRenderPass(renderPass, framebuffers[index], {magma::clear::gray});
+        {   // Shade at render scale, viewport is set by dynamic resolution
+            dynamicResolution->beginScene(cmdBuffer, index, magma::clear::gray);
             {
                 cmdBuffer->bindDescriptorSet(graphicsPipeline, 0, descriptorSet);
                 cmdBuffer->bindPipeline(graphicsPipeline);
                 cmdBuffer->draw(4, 0);
             }
+            dynamicResolution->endScene(cmdBuffer, index);
+            cmdBuffer->beginRenderPass(renderPass, framebuffers[index], {magma::clear::gray});
+            {
+                dynamicResolution->upscale(cmdBuffer, {width, height});
+            }
             cmdBuffer->endRenderPass();
         }
         cmdBuffer->end();
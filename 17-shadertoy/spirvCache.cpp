@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <filesystem>
+#include "spirvCache.h"
+
+constexpr uint32_t cacheMagic = 0x43565053; // "SPVC"
+constexpr uint32_t cacheVersion = 1;
+constexpr uint32_t spirvMagic = 0x07230203;
+
+SpirvCache::SpirvCache(const std::string& directory):
+    directory(directory)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+}
+
+uint64_t SpirvCache::computeKey(const std::string& source, uint32_t stage,
+    const std::string& entrypoint, const std::string& options) const noexcept
+{   // Hash lengths as well to separate adjacent strings
+    uint64_t key = hash(source.data(), source.size());
+    const uint64_t sourceLength = source.size();
+    key = hash(&sourceLength, sizeof(sourceLength), key);
+    key = hash(&stage, sizeof(stage), key);
+    const uint64_t entrypointLength = entrypoint.size();
+    key = hash(entrypoint.data(), entrypoint.size(), key);
+    key = hash(&entrypointLength, sizeof(entrypointLength), key);
+    key = hash(options.data(), options.size(), key);
+    return key;
+}
+
+std::unique_ptr<SpirvCache::MappedEntry> SpirvCache::find(uint64_t key) const
+{
+    const std::string path = getEntryPath(key);
+    std::unique_ptr<MappedEntry> entry(new MappedEntry());
+    if (!entry->file.map(path))
+        return nullptr; // Cache miss
+    if (!validate(*entry, key))
+    {   // File has to be unmapped before removal on Windows
+        entry->file.unmap();
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return nullptr;
+    }
+    return entry;
+}
+
+bool SpirvCache::store(uint64_t key, const uint32_t *bytecode, std::size_t size) const
+{
+    Header header;
+    header.magic = cacheMagic;
+    header.version = cacheVersion;
+    header.key = key;
+    header.bytecodeHash = hash(bytecode, size);
+    header.bytecodeSize = size;
+    const std::string path = getEntryPath(key);
+    // Write to temporary file first, so that concurrent reader never sees partial entry
+    const std::string tempPath = path + "." +
+        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            return false;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+        file.write(reinterpret_cast<const char *>(bytecode), size);
+        if (!file.good())
+        {
+            file.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string SpirvCache::getEntryPath(uint64_t key) const
+{
+    std::ostringstream path;
+    path << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".spv";
+    return path.str();
+}
+
+bool SpirvCache::validate(const MappedEntry& entry, uint64_t key) const noexcept
+{
+    if (entry.file.size() < sizeof(Header))
+        return false;
+    Header header;
+    memcpy(&header, entry.file.data(), sizeof(Header));
+    if (header.magic != cacheMagic || header.version != cacheVersion || header.key != key)
+        return false;
+    const std::size_t bytecodeSize = entry.getBytecodeSize();
+    if (header.bytecodeSize != bytecodeSize ||
+        !bytecodeSize || bytecodeSize % sizeof(uint32_t))
+        return false;
+    const uint32_t *bytecode = entry.getBytecode();
+    if (bytecode[0] != spirvMagic)
+        return false;
+    return hash(bytecode, bytecodeSize) == header.bytecodeHash;
+}
+
+uint64_t SpirvCache::hash(const void *data, std::size_t size, uint64_t hash) noexcept
+{   // FNV-1a
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+const uint32_t *SpirvCache::MappedEntry::getBytecode() const noexcept
+{   // Mapping is page-aligned and header size is a multiple of SPIR-V word
+    return reinterpret_cast<const uint32_t *>(file.data() + sizeof(Header));
+}
+
+std::size_t SpirvCache::MappedEntry::getBytecodeSize() const noexcept
+{
+    return file.size() - sizeof(Header);
+}
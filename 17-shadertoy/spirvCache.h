@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <memory>
+#include "../framework/fileView.h"
+
+/* Content-addressed on-disk cache of SPIR-V bytecode. Entry is named
+   after the hash of everything that affects compiler output (source text,
+   shader stage, entry point and compiler options), so there is no need
+   to invalidate anything: modified source simply produces another key.
+   Entries are memory-mapped on lookup. Each entry stores the hash of
+   its bytecode, so truncated or otherwise corrupted file is detected
+   and evicted from the cache. */
+class SpirvCache
+{
+public:
+    class MappedEntry;
+
+    explicit SpirvCache(const std::string& directory);
+    uint64_t computeKey(const std::string& source,
+        uint32_t stage,
+        const std::string& entrypoint,
+        const std::string& options) const noexcept;
+    std::unique_ptr<MappedEntry> find(uint64_t key) const;
+    bool store(uint64_t key, const uint32_t *bytecode, std::size_t size) const;
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint64_t bytecodeHash;
+        uint64_t bytecodeSize;
+    };
+
+    std::string getEntryPath(uint64_t key) const;
+    bool validate(const MappedEntry& entry, uint64_t key) const noexcept;
+    static uint64_t hash(const void *data, std::size_t size,
+        uint64_t hash = 14695981039346656037ull) noexcept;
+
+    const std::string directory;
+};
+
+/* Read-only view of cache file. Bytecode remains valid
+   as long as the entry is alive. */
+class SpirvCache::MappedEntry
+{
+public:
+    const uint32_t *getBytecode() const noexcept;
+    std::size_t getBytecodeSize() const noexcept;
+
+private:
+    MappedEntry() = default;
+
+    utilities::FileView file;
+    friend SpirvCache;
+};
@@ -0,0 +1,244 @@
+#include <algorithm>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <cerrno>
+#include <map>
+#endif
+#include "watchdog.h"
+
+FileWatchdog::FileWatchdog(std::chrono::milliseconds debounceDelay,
+    std::chrono::milliseconds pollFrequency):
+    debounceDelay(debounceDelay),
+    pollFrequency(pollFrequency),
+    stop(false)
+{
+#ifdef __linux__
+    if (initializeNotify())
+        watchThread = std::thread(&FileWatchdog::watchNotify, this);
+    else
+#endif
+    watchThread = std::thread(&FileWatchdog::watchPoll, this);
+    workThread = std::thread(&FileWatchdog::work, this);
+}
+
+FileWatchdog::~FileWatchdog()
+{   // Wake up both threads and wait for them to finish
+    {
+        std::lock_guard<std::mutex> guard(taskListAccess);
+        stop = true;
+    }
+    taskSignal.notify_all();
+    stopSignal.notify_all();
+#ifdef __linux__
+    if (wakeupFd >= 0)
+    {
+        const uint64_t value = 1;
+        ssize_t written = write(wakeupFd, &value, sizeof(value));
+        (void)written;
+    }
+#endif
+    watchThread.join();
+    workThread.join();
+#ifdef __linux__
+    closeNotify();
+#endif
+}
+
+void FileWatchdog::watchFor(const std::string& filename, Callback callback)
+{
+    sys_stat st;
+    const int result = stat(filename.c_str(), &st);
+    if (0 == result)
+    {
+        Item item;
+        item.name = filename;
+        const size_t slash = filename.find_last_of("/\\");
+        item.directory = (slash != std::string::npos) ? filename.substr(0, slash) : ".";
+        item.baseName = (slash != std::string::npos) ? filename.substr(slash + 1) : filename;
+        item.onModified = std::move(callback);
+        item.lastModifiedTime = st.st_mtime;
+        item.lastSize = st.st_size;
+        item.watchDescriptor = -1;
+        item.pending = false;
+    #ifdef __linux__
+        if (inotifyFd >= 0)
+        {   /* Watch directory rather than file, as editors often
+               replace file by renaming of temporary one. */
+            item.watchDescriptor = inotify_add_watch(inotifyFd, item.directory.c_str(),
+                IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        }
+    #endif
+        std::lock_guard<std::mutex> guard(itemListAccess);
+        itemList.push_back(std::move(item));
+    }
+}
+
+#ifdef __linux__
+bool FileWatchdog::initializeNotify()
+{
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotifyFd >= 0 && epollFd >= 0 && wakeupFd >= 0)
+    {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = inotifyFd;
+        if (0 == epoll_ctl(epollFd, EPOLL_CTL_ADD, inotifyFd, &event))
+        {
+            event.data.fd = wakeupFd;
+            if (0 == epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeupFd, &event))
+                return true;
+        }
+    }
+    // Fall back to polling, watchFor() checks inotify descriptor
+    closeNotify();
+    return false;
+}
+
+void FileWatchdog::closeNotify() noexcept
+{
+    for (int *fd: {&epollFd, &inotifyFd, &wakeupFd})
+    {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+void FileWatchdog::watchNotify()
+{   // Time of the last event for each modified file
+    std::map<std::string, Clock::time_point> pendingList;
+    while (true)
+    {   // Sleep until event arrives or debounce delay expires
+        int timeout = -1;
+        if (!pendingList.empty())
+        {
+            Clock::time_point deadline = Clock::time_point::max();
+            for (const auto& pending: pendingList)
+                deadline = std::min(deadline, pending.second + debounceDelay);
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+            timeout = std::max(0, (int)remaining.count());
+        }
+        epoll_event events[2];
+        const int count = epoll_wait(epollFd, events, 2, timeout);
+        if (count < 0 && errno != EINTR)
+            break;
+        for (int i = 0; i < count; ++i)
+        {
+            if (events[i].data.fd == wakeupFd)
+                return;
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+            {
+                std::lock_guard<std::mutex> guard(itemListAccess);
+                for (char *ptr = buffer; ptr < buffer + length;)
+                {
+                    const inotify_event *event = reinterpret_cast<const inotify_event *>(ptr);
+                    if (event->len)
+                    {
+                        for (const Item& item: itemList)
+                        {
+                            if ((item.watchDescriptor == event->wd) && (item.baseName == event->name))
+                                pendingList[item.name] = Clock::now();
+                        }
+                    }
+                    ptr += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+        // Dispatch files that weren't touched during debounce delay
+        const Clock::time_point now = Clock::now();
+        for (auto it = pendingList.begin(); it != pendingList.end();)
+        {
+            if (now - it->second < debounceDelay)
+                ++it;
+            else
+            {
+                std::unique_lock<std::mutex> lock(itemListAccess);
+                auto item = std::find_if(itemList.begin(), itemList.end(),
+                    [it](const Item& item) { return item.name == it->first; });
+                if (item != itemList.end())
+                {
+                    const Callback onModified = item->onModified;
+                    lock.unlock();
+                    post(it->first, onModified);
+                }
+                it = pendingList.erase(it);
+            }
+        }
+    }
+}
+#endif // __linux__
+
+void FileWatchdog::watchPoll()
+{
+    while (true)
+    {   // Do not abuse processor time, but wake up immediately on destruction
+        {
+            std::unique_lock<std::mutex> lock(taskListAccess);
+            if (stopSignal.wait_for(lock, pollFrequency, [this] { return stop; }))
+                return;
+        }
+        std::list<Task> modifiedList;
+        {
+            const Clock::time_point now = Clock::now();
+            std::lock_guard<std::mutex> guard(itemListAccess);
+            for (Item& item: itemList)
+            {
+                sys_stat st;
+                const int result = stat(item.name.c_str(), &st);
+                if ((0 == result) && ((item.lastModifiedTime != st.st_mtime) || (item.lastSize != st.st_size)))
+                {   // File is still being written, restart debounce delay
+                    item.lastModifiedTime = st.st_mtime;
+                    item.lastSize = st.st_size;
+                    item.pending = true;
+                    item.pendingTime = now;
+                }
+                else if (item.pending && (now - item.pendingTime >= debounceDelay))
+                {   // Dispatch file that wasn't touched during debounce delay
+                    item.pending = false;
+                    modifiedList.push_back({item.name, item.onModified});
+                }
+            }
+        }
+        // Callbacks are invoked outside of lock
+        for (const Task& task: modifiedList)
+            post(task.name, task.onModified);
+    }
+}
+
+void FileWatchdog::work()
+{
+    std::unique_lock<std::mutex> lock(taskListAccess);
+    while (true)
+    {
+        taskSignal.wait(lock, [this] { return stop || !taskList.empty(); });
+        if (stop)
+            break;
+        const Task task = std::move(taskList.front());
+        taskList.pop_front();
+        lock.unlock();
+        task.onModified(task.name);
+        lock.lock();
+    }
+}
+
+void FileWatchdog::post(const std::string& name, const Callback& onModified)
+{
+    {
+        std::lock_guard<std::mutex> guard(taskListAccess);
+        // Skip if callback for this file is already queued
+        for (const Task& task: taskList)
+        {
+            if (task.name == name)
+                return;
+        }
+        taskList.push_back({name, onModified});
+    }
+    taskSignal.notify_one();
+}
@@ -5,6 +5,7 @@
 #include <list>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <functional>
 #include <chrono>
 
@@ -15,62 +16,67 @@ typedef struct _stat sys_stat;
 typedef struct stat sys_stat;
 #endif // _MSC_VER
 
+/* Watches files for modification and invokes callbacks on a worker thread
+   outside of any lock, so that callback may take a while (e.g. to compile shader).
+   On Linux, modifications are reported by inotify within milliseconds without
+   any CPU usage when idle; elsewhere files are periodically polled by stat().
+   Burst of events (e.g. editor writes temporary file and renames it) is debounced,
+   so that callback is invoked once per save. */
 class FileWatchdog
 {
+public:
+    typedef std::function<void(const std::string&)> Callback;
+
+    explicit FileWatchdog(std::chrono::milliseconds debounceDelay,
+        std::chrono::milliseconds pollFrequency);
+    ~FileWatchdog();
+    void watchFor(const std::string& filename, Callback callback);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
     struct Item
     {
         std::string name;
-        std::function<void(const std::string&)> onModified;
+        std::string directory;
+        std::string baseName;
+        Callback onModified;
         time_t lastModifiedTime;
+        long long lastSize;
+        int watchDescriptor;
+        bool pending; // Polled modification is waiting for debounce delay
+        Clock::time_point pendingTime;
     };
 
-    std::thread watchThread;
-    std::mutex itemListAccess;
-    std::list<Item> itemList;
-
-public:
-    FileWatchdog(const std::chrono::milliseconds pollFrequency)
+    struct Task
     {
-        watchThread = std::thread([this, pollFrequency]()
-        {   // Dedicated thread that periodically checks files for modification
-            while (true)
-            {   // Do not abuse processor time
-                std::this_thread::sleep_for(pollFrequency);
-                std::lock_guard<std::mutex> guard(itemListAccess);
-                for (Item& item : itemList)
-                {
-                    sys_stat st;
-                    const int result = stat(item.name.c_str(), &st);
-                    if (0 == result)
-                    {
-                        if (item.lastModifiedTime != st.st_mtime)
-                        {
-                            item.onModified(item.name);
-                            item.lastModifiedTime = st.st_mtime;
-                        }
-                    }
-                }
-            }
-        });
-    }
+        std::string name;
+        Callback onModified;
+    };
 
-    void watchFor(const std::string& filename, std::function<void(const std::string&)> callback)
-    {
-        sys_stat st;
-        const int result = stat(filename.c_str(), &st);
-        if (0 == result)
-        {
-            Item item;
-            item.name = filename;
-            item.onModified = callback;
-            item.lastModifiedTime = st.st_mtime;
-            std::lock_guard<std::mutex> guard(itemListAccess);
-            itemList.push_back(item);
-        }
-    }
+#ifdef __linux__
+    bool initializeNotify();
+    void closeNotify() noexcept;
+    void watchNotify();
+#endif
+    void watchPoll();
+    void work();
+    void post(const std::string& name, const Callback& onModified);
 
-    ~FileWatchdog()
-    {
-        watchThread.detach();
-    }
+    const std::chrono::milliseconds debounceDelay;
+    const std::chrono::milliseconds pollFrequency;
+    std::mutex itemListAccess;
+    std::list<Item> itemList;
+    std::mutex taskListAccess;
+    std::condition_variable taskSignal;
+    std::condition_variable stopSignal;
+    std::list<Task> taskList;
+    bool stop;
+#ifdef __linux__
+    int inotifyFd = -1;
+    int epollFd = -1;
+    int wakeupFd = -1;
+#endif
+    std::thread watchThread;
+    std::thread workThread;
 };
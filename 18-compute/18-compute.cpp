@@ -84,7 +84,7 @@ public:
 
     std::unique_ptr<magma::ComputePipeline> createComputePipeline(const char *filename, const char *entrypoint) const
     {
-        const aligned_vector<char> bytecode = utilities::loadBinaryFile(filename + std::string(".o"));
+        const utilities::FileView bytecode = utilities::loadBinaryFile(filename + std::string(".o"));
         auto computeShader = std::make_shared<magma::ShaderModule>(device, (const magma::SpirvWord *)bytecode.data(), bytecode.size());
         auto layout = std::make_unique<magma::PipelineLayout>(descriptorSet->getLayout());
         return std::make_unique<magma::ComputePipeline>(device,
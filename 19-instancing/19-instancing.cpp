@@ -1,39 +1,102 @@
+#include <cstring>
 #include "../framework/vulkanApp.h"
+#include "../framework/indirectStorageBuffer.h"
 #include "quadric/include/cube.h"
+#include "quadric/include/teapot.h"
+#include "city.h"
 
-inline float random()
+// Use Space to enable/disable frustum culling
+// Use Tab to switch between packed and matrix instance transforms
+// Use 1, 2, 3, 4 to change city size (~5K, 10K, 100K, 1M buildings)
+// Use Home to generate city with another seed
+// Use Enter to switch between cubes and teapots with LODs
+// Use End to enable/disable LOD selection
+class InstancingApp : public VulkanApp
 {
-    return float(rand()) / float(RAND_MAX);
-}
+    enum TransformLayout : uint32_t
+    {
+        Matrix = 0, Packed,
+        MaxLayouts
+    };
 
-inline float random(float min, float max)
-{
-    return min + (max - min) * random();
-}
+    enum MeshType : uint32_t
+    {
+        Cubes = 0, Teapots,
+        MaxMeshTypes
+    };
+
+    static constexpr uint32_t MaxLods = 4;
 
-class InstancingApp : public VulkanApp
-{
     struct alignas(16) UniformBlock
     {
         rapid::matrix view;
         rapid::matrix viewProj;
+        rapid::float4 meshScale;
+        rapid::float4 meshOffset;
+        rapid::float4 lodPixelSizes;
+        float screenScale;
+        uint32_t lodCount;
+        uint32_t instanceCount;
+        VkBool32 frustumCulling;
     };
 
+    struct LodStatistics
+    {
+        uint64_t triangles = 0;
+        uint64_t fullDetailTriangles = 0;
+    };
+
+    static_assert(sizeof(PackedTransform) == 16, "invalid packed transform size");
+
     struct DescriptorSetTable
     {
         magma::descriptor::UniformBuffer transforms = 0;
         magma::descriptor::StorageBuffer instanceTransforms = 1;
-    } setTable;
+        magma::descriptor::StorageBuffer visibleInstances = 2;
+    } setTables[MaxLayouts];
+
+    struct CullDescriptorSetTable
+    {
+        magma::descriptor::UniformBuffer transforms = 0;
+        magma::descriptor::StorageBuffer instanceTransforms = 1;
+        magma::descriptor::StorageBuffer visibleInstances = 2;
+        magma::descriptor::StorageBuffer drawCommands = 3;
+    } cullSetTables[MaxLayouts];
 
-    std::unique_ptr<quadric::Cube> mesh;
+    const uint32_t gridSizes[4] = {100, 140, 440, 1390};
+    // Subdivision degree of each teapot LOD
+    const uint16_t teapotSubdivisions[MaxLods] = {16, 8, 4, 2};
+    // Projected size in pixels below which next LOD is selected
+    const rapid::float4 lodPixelSizes = rapid::float4(160.f, 60.f, 20.f, 0.f);
+
+    std::unique_ptr<quadric::Cube> cube;
+    std::unique_ptr<quadric::Teapot> teapots[MaxLods];
+    uint32_t indexCounts[MaxMeshTypes][MaxLods] = {};
     std::unique_ptr<magma::UniformBuffer<UniformBlock>> uniformBuffer;
-    std::unique_ptr<magma::StorageBuffer> instanceTransforms;
-    std::unique_ptr<magma::DescriptorSet> descriptorSet;
-    std::unique_ptr<magma::GraphicsPipeline> graphicsPipeline;
+    std::unique_ptr<magma::SrcTransferBuffer> stagingBuffer;
+    uint8_t *stagingData = nullptr;
+    std::unique_ptr<magma::StorageBuffer> instanceTransforms[MaxLayouts];
+    std::unique_ptr<magma::StorageBuffer> visibleInstances;
+    std::unique_ptr<IndirectStorageBuffer> drawCommands;
+    std::vector<std::unique_ptr<magma::DstTransferBuffer>> readbackBuffers;
+    std::unique_ptr<magma::DescriptorSet> descriptorSets[MaxLayouts];
+    std::unique_ptr<magma::DescriptorSet> cullDescriptorSets[MaxLayouts];
+    std::unique_ptr<magma::GraphicsPipeline> graphicsPipelines[MaxLayouts][MaxMeshTypes];
+    std::unique_ptr<magma::ComputePipeline> cullPipelines[MaxLayouts];
 
     rapid::matrix view;
     rapid::matrix proj;
+    float screenScale = 0.f;
+    uint32_t gridSize = 100;
+    uint32_t seed = 0x5EED;
     uint32_t instanceCount = 0;
+    TransformLayout transformLayout = TransformLayout::Packed;
+    MeshType meshType = MeshType::Cubes;
+    bool frustumCulling = true;
+    bool lodSelection = true;
+    LodStatistics lodStatistics;
+    float frameTime = 0.f;
+    uint32_t frames = 0;
 
 public:
     InstancingApp(const AppEntry& entry):
@@ -41,12 +104,13 @@ public:
     {
         initialize();
         setupView();
-        createMesh();
+        createMeshes();
         createUniformBuffer();
-        //srand(time(nullptr));
-        instanceCount = buildVulkanCity();
-        setupDescriptorSet();
-        setupPipeline();
+        instanceCount = buildVulkanCity(gridSize, seed);
+        createCullingBuffers();
+        createReadbackBuffers();
+        setupDescriptorSets();
+        setupPipelines();
         for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
             recordCommandBuffer(i);
         timer->run();
@@ -54,8 +118,39 @@ public:
 
     void render(uint32_t bufferIndex) override
     {
-        updatePerspectiveTransform();
+        const float milliseconds = timer->millisecondsElapsed();
+        readLodStatistics(bufferIndex);
+        updatePerspectiveTransform(milliseconds);
         submitCommandBuffer(bufferIndex);
+        updateStatistics(milliseconds);
+    }
+
+    void onKeyDown(char key, int repeat, uint32_t flags) override
+    {
+        switch (key)
+        {
+        case AppKey::Space:
+            frustumCulling = !frustumCulling;
+            break;
+        case AppKey::Tab:
+            transformLayout = (TransformLayout::Packed == transformLayout) ? TransformLayout::Matrix : TransformLayout::Packed;
+            rerecordCommandBuffers();
+            break;
+        case AppKey::Enter:
+            meshType = (MeshType::Cubes == meshType) ? MeshType::Teapots : MeshType::Cubes;
+            rerecordCommandBuffers();
+            break;
+        case AppKey::End:
+            lodSelection = !lodSelection;
+            rerecordCommandBuffers();
+            break;
+        case AppKey::Home: rebuildVulkanCity(gridSize, seed + 1); break;
+        case '1': rebuildVulkanCity(gridSizes[0], seed); break;
+        case '2': rebuildVulkanCity(gridSizes[1], seed); break;
+        case '3': rebuildVulkanCity(gridSizes[2], seed); break;
+        case '4': rebuildVulkanCity(gridSizes[3], seed); break;
+        }
+        VulkanApp::onKeyDown(key, repeat, flags);
     }
 
     void onResize(uint32_t width, uint32_t height) override
@@ -67,34 +162,95 @@ public:
     }
 
     void setupView()
-    {
-        const rapid::vector3 eye(0.f, 130.f, 520.f);
+    {   // Move camera away for large cities
+        const float scale = gridSize / 100.f;
+        const rapid::vector3 eye(0.f, 130.f * scale, 520.f * scale);
         const rapid::vector3 center(0.f, 30.f, 0.f);
         const rapid::vector3 up(0.f, 1.f, 0.f);
         constexpr float fov = rapid::radians(20.f);
         const float aspect = width/(float)height;
-        constexpr float zn = 1.f, zf = 1000.f;
+        const float zn = 1.f, zf = 1000.f * scale;
         view = rapid::lookAtRH(eye, center, up);
         proj = rapid::perspectiveFovRH(fov, aspect, zn, zf);
+        // Converts size at unit distance to pixels
+        screenScale = height * .5f / std::tan(fov * .5f);
     }
 
-    void updatePerspectiveTransform()
+    void updatePerspectiveTransform(float milliseconds)
     {
         constexpr float speed = 0.01f;
         static float angle = 0.f;
-        angle += timer->millisecondsElapsed() * speed;
+        angle += milliseconds * speed;
         const rapid::matrix rotation = rapid::rotationY(rapid::radians(angle));
         magma::map(uniformBuffer,
             [this, &rotation](auto *block)
             {
                 block->view = rotation * view;
                 block->viewProj = block->view * proj;
+                if (MeshType::Teapots == meshType)
+                {   // Approximate bounds of Utah teapot
+                    block->meshScale = rapid::float4(1.f/3.2f, 1.f/1.575f, 1.f/2.f, 1.f);
+                    block->meshOffset = rapid::float4(-0.2f/3.2f, -1.f, 0.f, 0.f);
+                }
+                else
+                {
+                    block->meshScale = rapid::float4(1.f, 1.f, 1.f, 1.f);
+                    block->meshOffset = rapid::float4(0.f, 0.f, 0.f, 0.f);
+                }
+                block->lodPixelSizes = lodPixelSizes;
+                block->screenScale = screenScale;
+                block->lodCount = getLodCount();
+                block->instanceCount = instanceCount;
+                block->frustumCulling = frustumCulling;
+            });
+    }
+
+    void updateStatistics(float milliseconds)
+    {   // Frame time includes presentation wait, so it reflects GPU load
+        frameTime += milliseconds;
+        if (++frames < 100)
+            return;
+        const float averageFrameTime = frameTime / frames;
+        std::tstring caption = TEXT("19 - Vulkan city: ") + std::to_tstring(instanceCount) + TEXT(" buildings, ");
+        caption += (TransformLayout::Packed == transformLayout) ? TEXT("packed") : TEXT("matrix");
+        caption += frustumCulling ? TEXT(", culling on, ") : TEXT(", culling off, ");
+        caption += lodSelection ? TEXT("LOD on, ") : TEXT("LOD off, ");
+        // Triangles submitted per frame with selected LODs versus full detail
+        caption += std::to_tstring(lodStatistics.triangles / frames / 1000) + TEXT("K tris (");
+        caption += std::to_tstring(lodStatistics.fullDetailTriangles / frames / 1000) + TEXT("K without LOD), ");
+        caption += std::to_tstring(averageFrameTime) + TEXT(" ms");
+        setWindowCaption(caption);
+        lodStatistics = LodStatistics();
+        frameTime = 0.f;
+        frames = 0;
+    }
+
+    void createDescriptorPool() override
+    {   // Graphics and culling descriptor sets for each transform layout
+        constexpr uint32_t maxDescriptorSets = 2 * TransformLayout::MaxLayouts;
+        descriptorPool = std::make_shared<magma::DescriptorPool>(device, maxDescriptorSets,
+            std::initializer_list<VkDescriptorPoolSize>{
+                magma::descriptor::UniformBufferPoolSize(maxDescriptorSets),
+                magma::descriptor::StorageBufferPoolSize(5 * TransformLayout::MaxLayouts)
             });
     }
 
-    void createMesh()
+    void createMeshes()
     {
-        mesh = std::make_unique<quadric::Cube>(cmdBufferCopy);
+        cube = std::make_unique<quadric::Cube>(cmdBufferCopy);
+        indexCounts[MeshType::Cubes][0] = cube->getIndexBuffer()->getIndexCount();
+        for (uint32_t lod = 0; lod < MaxLods; ++lod)
+        {
+            teapots[lod] = std::make_unique<quadric::Teapot>(teapotSubdivisions[lod], cmdBufferCopy);
+            indexCounts[MeshType::Teapots][lod] = teapots[lod]->getIndexBuffer()->getIndexCount();
+        }
+    }
+
+    uint32_t getLodCount() const noexcept
+    {   // Cube is too simple to have LODs
+        if (MeshType::Cubes == meshType || !lodSelection)
+            return 1;
+        return MaxLods;
     }
 
     void createUniformBuffer()
@@ -102,99 +258,211 @@ public:
         uniformBuffer = std::make_unique<magma::UniformBuffer<UniformBlock>>(device);
     }
 
-    uint32_t buildVulkanCity()
+    uint32_t buildVulkanCity(uint32_t gridSize, uint32_t seed)
     {
-        constexpr uint32_t GridX = 100;
-        constexpr uint32_t GridZ = 100;
-        constexpr float CityRadius = std::min(GridX, GridZ) * 0.48f;
-        constexpr float DowntownRadius = 10.0f;
-        constexpr float CellSize = 3.f;
-        constexpr float HouseMin = .5f;
-        constexpr float HouseMax = 2.f;
-        constexpr float cx = (GridX - 1) * .5f;
-        constexpr float cz = (GridZ - 1) * .5f;
+        Timer generationTimer;
+        generationTimer.run();
+        CityGenerator city(gridSize, seed);
+        const uint32_t buildingCount = city.countBuildings();
+        const VkDeviceSize matrixSize = buildingCount * sizeof(rapid::matrix);
+        const VkDeviceSize packedSize = buildingCount * sizeof(PackedTransform);
+        if (!stagingBuffer || stagingBuffer->getMemory()->getSize() < matrixSize + packedSize)
+        {   // Staging buffer stays mapped and is re-allocated only for larger city
+            stagingBuffer.reset();
+            stagingBuffer = std::make_unique<magma::SrcTransferBuffer>(device, matrixSize + packedSize);
+            stagingData = reinterpret_cast<uint8_t *>(stagingBuffer->getMemory()->map());
+        }
+        // Worker threads write directly to mapped memory
+        city.generate(reinterpret_cast<rapid::matrix *>(stagingData),
+            reinterpret_cast<PackedTransform *>(stagingData + matrixSize));
+        const float generationTime = generationTimer.millisecondsElapsed();
+        instanceTransforms[TransformLayout::Matrix] = std::make_unique<magma::StorageBuffer>(device, matrixSize);
+        instanceTransforms[TransformLayout::Packed] = std::make_unique<magma::StorageBuffer>(device, packedSize);
+        cmdBufferCopy->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        {
+            cmdBufferCopy->copyBuffer(stagingBuffer, instanceTransforms[TransformLayout::Matrix], 0, 0, matrixSize);
+            cmdBufferCopy->copyBuffer(stagingBuffer, instanceTransforms[TransformLayout::Packed], matrixSize, 0, packedSize);
+        }
+        cmdBufferCopy->end();
+        submitCopyBufferCommands();
+        std::cout << buildingCount << " buildings (seed " << seed << ") generated in " << generationTime << " ms"
+            << ", matrix transforms: " << matrixSize / 1024 << " KB"
+            << ", packed transforms: " << packedSize / 1024 << " KB" << std::endl;
+        return buildingCount;
+    }
 
-        const float maxDist = std::sqrt(cx * cx + cz * cz);
-        std::vector<rapid::matrix> transforms;
+    void rebuildVulkanCity(uint32_t gridSize, uint32_t seed)
+    {
+        if ((gridSize == this->gridSize) && (seed == this->seed))
+            return;
+        device->waitIdle();
+        for (uint32_t i = 0; i < TransformLayout::MaxLayouts; ++i)
+        {   // Release descriptor sets before pool re-creation
+            descriptorSets[i].reset();
+            cullDescriptorSets[i].reset();
+        }
+        this->gridSize = gridSize;
+        this->seed = seed;
+        instanceCount = buildVulkanCity(gridSize, seed);
+        createCullingBuffers();
+        createDescriptorPool();
+        setupDescriptorSets();
+        setupView();
+        rerecordCommandBuffers();
+    }
+
+    void createCullingBuffers()
+    {   // Compacted list of instance indices that passed frustum test, range per LOD
+        visibleInstances = std::make_unique<magma::StorageBuffer>(device, MaxLods * instanceCount * sizeof(uint32_t));
+        drawCommands = std::make_unique<IndirectStorageBuffer>(device, MaxLods * sizeof(VkDrawIndexedIndirectCommand));
+    }
 
-        for (uint32_t z = 0; z < GridZ; ++z)
+    void createReadbackBuffers()
+    {   // Draw commands are copied back to compute submitted triangles
+        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
         {
-            for (uint32_t x = 0; x < GridX; ++x)
-            {   // Streets, unused places
-                if ((x % 15) == 0 || (z % 25) == 0)
-                    continue;
-                if (random() < 0.2f)
-                    continue;
-
-                float dx = x - cx;
-                float dz = z - cz;
-                float d = std::sqrt(dx * dx + dz * dz);
-
-                // Non-uniform city limits
-                float angle = std::atan2(dz, dx);
-                float nonUniformRadius = CityRadius * (1.f
-                    + 0.18f * std::sin(angle * 2.f + 1.4f)
-                    + 0.10f * std::sin(angle * 5.f + 3.2f)
-                    + 0.06f * std::sin(angle * 11.f + 0.7f));
-                nonUniformRadius += random(-2.f, 2.f);
-                if (d > nonUniformRadius)
-                    continue;
-
-                // Gaussian falloff
-                float t = std::exp(-(d * d) / (2.f * DowntownRadius * DowntownRadius));
-                float height;
-                float h = random();
-                if (h < t * 0.2f)
-                    height = random(10.f, 40.f); // Skyscrapers
-                else
-                    height = random(1.f, 8.f);
-
-                // Building bounds
-                const float sx = random(HouseMin, HouseMax);
-                const float sz = random(HouseMin, HouseMax);
-                float mx = (CellSize - sx) * 0.5f;
-                float mz = (CellSize - sz) * 0.5f;
-                // Random offset
-                float ox = dx * CellSize + random(-mx, mx);
-                float oz = dz * CellSize + random(-mz, mz);
-
-                // Calculate building's transform
-                rapid::matrix scale = rapid::scaling(sx, height * .5f, sz);
-                rapid::matrix translation = rapid::translation(ox, height * .5f, oz);
-                rapid::matrix world = scale * translation;
-                transforms.push_back(world);
+            auto buffer = std::make_unique<magma::DstTransferBuffer>(device, MaxLods * sizeof(VkDrawIndexedIndirectCommand));
+            magma::map<VkDrawIndexedIndirectCommand>(buffer,
+                [](VkDrawIndexedIndirectCommand *drawCommands)
+                {   // Nothing was drawn yet
+                    memset(drawCommands, 0, MaxLods * sizeof(VkDrawIndexedIndirectCommand));
+                });
+            readbackBuffers.push_back(std::move(buffer));
+        }
+    }
+
+    void readLodStatistics(uint32_t bufferIndex)
+    {   // Previous submission of command buffer has been completed
+        magma::map<VkDrawIndexedIndirectCommand>(readbackBuffers[bufferIndex],
+            [this](const VkDrawIndexedIndirectCommand *drawCommands)
+            {
+                const uint64_t fullDetailTriangleCount = drawCommands[0].indexCount / 3;
+                for (uint32_t lod = 0; lod < MaxLods; ++lod)
+                {
+                    const uint64_t instanceCount = drawCommands[lod].instanceCount;
+                    lodStatistics.triangles += instanceCount * drawCommands[lod].indexCount / 3;
+                    lodStatistics.fullDetailTriangles += instanceCount * fullDetailTriangleCount;
+                }
+            });
+    }
+
+    void setupDescriptorSets()
+    {
+        for (uint32_t i = 0; i < TransformLayout::MaxLayouts; ++i)
+        {
+            const char *vertexShaderFileName = (TransformLayout::Packed == i) ? "buildingPacked" : "building";
+            const char *cullShaderFileName = (TransformLayout::Packed == i) ? "cullPacked" : "cull";
+            setTables[i].transforms = uniformBuffer;
+            setTables[i].instanceTransforms = instanceTransforms[i];
+            setTables[i].visibleInstances = visibleInstances;
+            descriptorSets[i] = std::make_unique<magma::DescriptorSet>(descriptorPool,
+                setTables[i], VK_SHADER_STAGE_VERTEX_BIT,
+                nullptr, 0, shaderReflectionFactory, vertexShaderFileName);
+            cullSetTables[i].transforms = uniformBuffer;
+            cullSetTables[i].instanceTransforms = instanceTransforms[i];
+            cullSetTables[i].visibleInstances = visibleInstances;
+            cullSetTables[i].drawCommands = drawCommands;
+            cullDescriptorSets[i] = std::make_unique<magma::DescriptorSet>(descriptorPool,
+                cullSetTables[i], VK_SHADER_STAGE_COMPUTE_BIT,
+                nullptr, 0, shaderReflectionFactory, cullShaderFileName);
+        }
+    }
+
+    void setupPipelines()
+    {
+        for (uint32_t i = 0; i < TransformLayout::MaxLayouts; ++i)
+        {
+            const char *vertexShaderFileName = (TransformLayout::Packed == i) ? "buildingPacked" : "building";
+            const char *cullShaderFileName = (TransformLayout::Packed == i) ? "cullPacked" : "cull";
+            auto cullLayout = std::make_unique<magma::PipelineLayout>(cullDescriptorSets[i]->getLayout());
+            cullPipelines[i] = std::make_unique<ComputePipeline>(device,
+                cullShaderFileName, std::move(cullLayout), pipelineCache);
+            // Cube and teapot have different vertex formats
+            constexpr magma::push::VertexConstantRange<uint32_t> pushConstantRange;
+            auto layout = std::make_shared<magma::PipelineLayout>(descriptorSets[i]->getLayout(), pushConstantRange);
+            for (uint32_t j = 0; j < MeshType::MaxMeshTypes; ++j)
+            {
+                graphicsPipelines[i][j] = std::make_unique<GraphicsPipeline>(device,
+                    vertexShaderFileName, "diffuse",
+                    (MeshType::Teapots == j) ? teapots[0]->getVertexInput() : cube->getVertexInput(),
+                    magma::renderstate::triangleList,
+                    negateViewport ? magma::renderstate::fillCullBackCcw
+                                   : magma::renderstate::fillCullBackCw,
+                    magma::renderstate::dontMultisample,
+                    magma::renderstate::depthLessOrEqual,
+                    magma::renderstate::dontBlendRgb,
+                    layout,
+                    renderPass, 0,
+                    pipelineCache);
             }
         }
+    }
+
+    void cullInstances(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+    {   // Reset draw parameters, visible instance count will be accumulated by compute shader
+        VkDrawIndexedIndirectCommand drawIndexed[MaxLods];
+        for (uint32_t lod = 0; lod < MaxLods; ++lod)
+        {
+            drawIndexed[lod].indexCount = indexCounts[meshType][lod];
+            drawIndexed[lod].instanceCount = 0;
+            drawIndexed[lod].firstIndex = 0;
+            drawIndexed[lod].vertexOffset = 0;
+            drawIndexed[lod].firstInstance = 0; // Vertex shader offsets visible list of LOD
+        }
+        cmdBuffer->updateBuffer(drawCommands, sizeof(drawIndexed), drawIndexed);
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            magma::BufferMemoryBarrier(drawCommands.get(),
+                magma::MemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)));
+        // Test bounding box of each instance against view frustum and select LOD
+        constexpr uint32_t workgroupSize = 64;
+        cmdBuffer->bindDescriptorSet(cullPipelines[transformLayout], 0, cullDescriptorSets[transformLayout]);
+        cmdBuffer->bindPipeline(cullPipelines[transformLayout]);
+        cmdBuffer->dispatch((instanceCount + workgroupSize - 1) / workgroupSize, 1, 1);
+        // Ensure that visible lists and draw parameters are written before indirect draw and readback
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+            {
+                {drawCommands.get(), magma::MemoryBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT)},
+                {visibleInstances.get(), magma::MemoryBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)}
+            });
+    }
 
-        const VkDeviceSize bufferSize = transforms.size() * sizeof(rapid::matrix);
-        instanceTransforms = std::make_unique<magma::StorageBuffer>(cmdBufferCopy, bufferSize, transforms.data());
-        return (uint32_t)transforms.size();
+    template<class Mesh>
+    void drawLod(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, const std::unique_ptr<Mesh>& mesh, uint32_t lod)
+    {   // Instance count is defined by culling pass
+        const uint32_t firstVisible = lod * instanceCount;
+        cmdBuffer->pushConstantBlock(graphicsPipelines[transformLayout][meshType]->getLayout(), VK_SHADER_STAGE_VERTEX_BIT, firstVisible);
+        cmdBuffer->bindVertexBuffer(0, mesh->getVertexBuffer());
+        cmdBuffer->bindIndexBuffer(mesh->getIndexBuffer());
+        cmdBuffer->drawIndexedIndirect(drawCommands, 1, lod * sizeof(VkDrawIndexedIndirectCommand));
+    }
+
+    void drawVisibleInstances(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+    {   // One instanced draw per LOD
+        if (MeshType::Cubes == meshType)
+            drawLod(cmdBuffer, cube, 0);
+        else
+        {
+            for (uint32_t lod = 0; lod < getLodCount(); ++lod)
+                drawLod(cmdBuffer, teapots[lod], lod);
+        }
     }
 
-    void setupDescriptorSet()
+    void readbackDrawCommands(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t index)
     {
-        setTable.transforms = uniformBuffer;
-        setTable.instanceTransforms = instanceTransforms;
-        descriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
-            setTable, VK_SHADER_STAGE_VERTEX_BIT,
-            nullptr, 0, shaderReflectionFactory, "building");
+        cmdBuffer->copyBuffer(drawCommands, readbackBuffers[index]);
+        cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            magma::BufferMemoryBarrier(readbackBuffers[index].get(), magma::barrier::buffer::transferWriteHostRead));
     }
 
-    void setupPipeline()
+    void rerecordCommandBuffers()
     {
-        auto layout = std::make_unique<magma::PipelineLayout>(descriptorSet->getLayout());
-        graphicsPipeline = std::make_unique<GraphicsPipeline>(device,
-            "building", "diffuse",
-            mesh->getVertexInput(),
-            magma::renderstate::triangleList,
-            negateViewport ? magma::renderstate::fillCullBackCcw
-                           : magma::renderstate::fillCullBackCw,
-            magma::renderstate::dontMultisample,
-            magma::renderstate::depthLessOrEqual,
-            magma::renderstate::dontBlendRgb,
-            std::move(layout),
-            renderPass, 0,
-            pipelineCache);
+        device->waitIdle();
+        for (uint32_t i = 0; i < (uint32_t)commandBuffers.size(); ++i)
+        {
+            commandBuffers[i]->reset();
+            recordCommandBuffer(i);
+        }
     }
 
     void recordCommandBuffer(uint32_t index)
@@ -202,6 +470,7 @@ public:
         auto& cmdBuffer = commandBuffers[index];
         cmdBuffer->begin();
         {
+            cullInstances(cmdBuffer);
             cmdBuffer->beginRenderPass(renderPass, framebuffers[index],
                 {
                     magma::ClearColor(0.35f, 0.53f, 0.7f, 1.f),
@@ -210,11 +479,12 @@ public:
             {
                 cmdBuffer->setViewport(0, 0, width, negateViewport ? -int32_t(height) : height);
                 cmdBuffer->setScissor(0, 0, width, height);
-                cmdBuffer->bindDescriptorSet(graphicsPipeline, 0, descriptorSet);
-                cmdBuffer->bindPipeline(graphicsPipeline);
-                mesh->drawInstanced(cmdBuffer, instanceCount);
+                cmdBuffer->bindDescriptorSet(graphicsPipelines[transformLayout][meshType], 0, descriptorSets[transformLayout]);
+                cmdBuffer->bindPipeline(graphicsPipelines[transformLayout][meshType]);
+                drawVisibleInstances(cmdBuffer);
             }
             cmdBuffer->endRenderPass();
+            readbackDrawCommands(cmdBuffer, index);
         }
         cmdBuffer->end();
     }
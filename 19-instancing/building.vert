@@ -3,11 +3,33 @@
 layout(binding = 0) uniform ViewTransforms {
     mat4 view;
     mat4 viewProj;
+    vec4 meshScale; // Fits mesh bounds into unit cube
+    vec4 meshOffset;
+};
+
+#ifdef PACKED_TRANSFORMS
+struct PackedTransform
+{
+    vec3 position;
+    uint scaleXZ; // half2
 };
 
+layout(binding = 1) readonly buffer InstanceTransforms {
+   PackedTransform instanceTransforms[];
+};
+#else
 layout(binding = 1) readonly buffer InstanceTransforms {
    mat4 instanceTransforms[];
 };
+#endif // PACKED_TRANSFORMS
+
+layout(binding = 2) readonly buffer VisibleInstances {
+   uint visibleInstances[];
+};
+
+layout(push_constant) uniform PushConstants {
+    uint firstVisible; // Visible list of LOD
+};
 
 layout(location = 0) in vec4 position;
 layout(location = 1) in vec4 normal;
@@ -19,13 +41,30 @@ out gl_PerVertex {
 };
 
 void main()
-{
-    mat4 world = instanceTransforms[gl_InstanceIndex];
+{   // First instance is zero, as non-zero one requires drawIndirectFirstInstance feature
+    uint instance = visibleInstances[firstVisible + gl_InstanceIndex];
+    vec4 localPos = vec4(position.xyz * meshScale.xyz + meshOffset.xyz, 1.);
+    vec3 localNormal = normal.xyz / meshScale.xyz;
+#ifdef PACKED_TRANSFORMS
+    PackedTransform transform = instanceTransforms[instance];
+    vec2 scaleXZ = unpackHalf2x16(transform.scaleXZ);
+    // Vertical scale is equal to the height of the center
+    vec3 scale = vec3(scaleXZ.x, transform.position.y, scaleXZ.y);
+    vec4 worldPos = vec4(localPos.xyz * scale + transform.position, 1.);
+    // Inverse transpose of diagonal scale matrix
+    vec3 worldNormal = localNormal / scale;
+
+    oViewPos = (view * worldPos).xyz;
+    oViewNormal = normalize(mat3(view) * worldNormal);
+    gl_Position = viewProj * worldPos;
+#else
+    mat4 world = instanceTransforms[instance];
     mat4 worldView = view * world;
     mat3 normalMatrix = transpose(inverse(mat3(worldView)));
     mat4 worldViewProj = viewProj * world;
 
-    oViewPos = (worldView * position).xyz;
-    oViewNormal = normalize(normalMatrix * normal.xyz);
-    gl_Position = worldViewProj * position;
+    oViewPos = (worldView * localPos).xyz;
+    oViewNormal = normalize(normalMatrix * localNormal);
+    gl_Position = worldViewProj * localPos;
+#endif // PACKED_TRANSFORMS
 }
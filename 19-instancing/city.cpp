@@ -0,0 +1,178 @@
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include "city.h"
+
+namespace
+{
+constexpr float CellSize = 3.f;
+constexpr float HouseMin = .5f;
+constexpr float HouseMax = 2.f;
+
+inline uint32_t hash(uint32_t x)
+{   // https://nullprogram.com/blog/2018/07/31/
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+class CellRandom
+{   // N-th number of the cell is a hash of (seed, x, z, n)
+public:
+    CellRandom(uint32_t seed, uint32_t x, uint32_t z):
+        key(hash(seed ^ hash(x ^ hash(z)))) {}
+    float operator()()
+    {   // [0, 1) with 24 bits of precision
+        return (hash(key + counter++) >> 8) * (1.f / 16777216.f);
+    }
+    float operator()(float min, float max)
+    {
+        return min + (max - min) * (*this)();
+    }
+
+private:
+    const uint32_t key;
+    uint32_t counter = 0;
+};
+
+inline uint16_t floatToHalf(float value)
+{   // Round to nearest, denormals are flushed to zero
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = int32_t((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = (bits & 0x7FFFFF) + 0x1000;
+    if (mantissa & 0x800000)
+    {   // Mantissa overflow after rounding
+        mantissa = 0;
+        ++exponent;
+    }
+    if (exponent <= 0)
+        return sign;
+    if (exponent >= 31)
+        return sign | 0x7C00; // Infinity
+    return sign | uint16_t(exponent << 10) | uint16_t(mantissa >> 13);
+}
+} // namespace
+
+CityGenerator::CityGenerator(uint32_t gridSize, uint32_t seed):
+    gridSize(gridSize),
+    seed(seed),
+    cityRadius(gridSize * 0.48f),
+    downtownRadius(10.f * gridSize / 100.f),
+    center((gridSize - 1) * .5f)
+{}
+
+uint32_t CityGenerator::countBuildings()
+{
+    rowOffsets.assign(gridSize + 1, 0);
+    forEachRow([this](uint32_t z)
+    {
+        Building building;
+        uint32_t count = 0;
+        for (uint32_t x = 0; x < gridSize; ++x)
+        {
+            if (placeBuilding(x, z, building))
+                ++count;
+        }
+        rowOffsets[z + 1] = count;
+    });
+    // Prefix sum gives output offset of each row
+    for (uint32_t z = 0; z < gridSize; ++z)
+        rowOffsets[z + 1] += rowOffsets[z];
+    return rowOffsets.back();
+}
+
+void CityGenerator::generate(rapid::matrix *transforms, PackedTransform *packedTransforms) const
+{
+    assert(rowOffsets.size() == gridSize + 1);
+    forEachRow([this, transforms, packedTransforms](uint32_t z)
+    {
+        Building building;
+        uint32_t i = rowOffsets[z];
+        for (uint32_t x = 0; x < gridSize; ++x)
+        {
+            if (!placeBuilding(x, z, building))
+                continue;
+            const float halfHeight = building.height * .5f;
+            if (transforms)
+            {   // Calculate building's transform
+                const rapid::matrix scale = rapid::scaling(building.width, halfHeight, building.depth);
+                const rapid::matrix translation = rapid::translation(building.x, halfHeight, building.z);
+                transforms[i] = scale * translation;
+            }
+            if (packedTransforms)
+            {   // Same transform in packed form
+                packedTransforms[i].position = rapid::float3(building.x, halfHeight, building.z);
+                packedTransforms[i].scaleXZ = floatToHalf(building.width) | (uint32_t(floatToHalf(building.depth)) << 16);
+            }
+            ++i;
+        }
+    });
+}
+
+bool CityGenerator::placeBuilding(uint32_t x, uint32_t z, Building& building) const
+{   // Streets, unused places
+    if ((x % 15) == 0 || (z % 25) == 0)
+        return false;
+    CellRandom random(seed, x, z);
+    if (random() < 0.2f)
+        return false;
+
+    const float dx = x - center;
+    const float dz = z - center;
+    const float d = std::sqrt(dx * dx + dz * dz);
+
+    // Non-uniform city limits
+    const float angle = std::atan2(dz, dx);
+    float nonUniformRadius = cityRadius * (1.f
+        + 0.18f * std::sin(angle * 2.f + 1.4f)
+        + 0.10f * std::sin(angle * 5.f + 3.2f)
+        + 0.06f * std::sin(angle * 11.f + 0.7f));
+    nonUniformRadius += random(-2.f, 2.f);
+    if (d > nonUniformRadius)
+        return false;
+
+    // Gaussian falloff
+    const float t = std::exp(-(d * d) / (2.f * downtownRadius * downtownRadius));
+    const float h = random();
+    if (h < t * 0.2f)
+        building.height = random(10.f, 40.f); // Skyscrapers
+    else
+        building.height = random(1.f, 8.f);
+
+    // Building bounds
+    building.width = random(HouseMin, HouseMax);
+    building.depth = random(HouseMin, HouseMax);
+    const float mx = (CellSize - building.width) * 0.5f;
+    const float mz = (CellSize - building.depth) * 0.5f;
+    // Random offset
+    building.x = dx * CellSize + random(-mx, mx);
+    building.z = dz * CellSize + random(-mz, mz);
+    return true;
+}
+
+template<class RowFunction>
+void CityGenerator::forEachRow(RowFunction&& rowFunction) const
+{   // Split rows between hardware threads
+    const uint32_t threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), gridSize));
+    const uint32_t rowsPerThread = (gridSize + threadCount - 1) / threadCount;
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+    for (uint32_t first = 0; first < gridSize; first += rowsPerThread)
+    {
+        const uint32_t last = std::min(first + rowsPerThread, gridSize);
+        threads.emplace_back([&rowFunction, first, last]()
+        {
+            for (uint32_t z = first; z < last; ++z)
+                rowFunction(z);
+        });
+    }
+    for (auto& thread: threads)
+        thread.join();
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "rapid/rapid.h"
+
+// Each building transform is a non-uniform scale plus translation.
+// Buildings stand on the ground, so vertical scale is equal to the
+// height of the center and doesn't have to be stored separately.
+struct PackedTransform
+{
+    rapid::float3 position;
+    uint32_t scaleXZ; // half2
+};
+
+/* Procedural city generator. Grid rows are processed in parallel,
+   each cell draws numbers from counter-based generator keyed by
+   seed and cell coordinates, so output doesn't depend on
+   the number of threads and is identical on every run. */
+class CityGenerator
+{
+public:
+    explicit CityGenerator(uint32_t gridSize, uint32_t seed);
+    uint32_t getGridSize() const noexcept { return gridSize; }
+    uint32_t getSeed() const noexcept { return seed; }
+    // Should be called before generate() to compute output offsets of each row
+    uint32_t countBuildings();
+    // Any of the output arrays may be null
+    void generate(rapid::matrix *transforms, PackedTransform *packedTransforms) const;
+
+private:
+    struct Building
+    {
+        float x, z;
+        float width, depth;
+        float height;
+    };
+
+    bool placeBuilding(uint32_t x, uint32_t z, Building& building) const;
+    template<class RowFunction>
+    void forEachRow(RowFunction&& rowFunction) const;
+
+    const uint32_t gridSize;
+    const uint32_t seed;
+    const float cityRadius;
+    const float downtownRadius;
+    const float center;
+    std::vector<uint32_t> rowOffsets;
+};
@@ -20,11 +20,28 @@ else
 endif
 LDFLAGS=$(LIB_DIR) -l$(MAGMA) -lpthread -lxcb -lxcb-randr -lvulkan
 #LDFLAGS=$(LIB_DIR) -l$(MAGMA) -lpthread -lX11 -lXrandr -lvulkan
+# Zstandard supercompression of KTX2 textures
+ZSTD ?= 0
+ifeq ($(ZSTD), 1)
+	CFLAGS+=-DKTX2_ZSTD
+	LDFLAGS+=-lzstd
+endif
 
 FRAMEWORK=../framework
 FRAMEWORK_OBJS= \
+	$(FRAMEWORK)/computePipeline.o \
+	$(FRAMEWORK)/dynamicResolution.o \
+	$(FRAMEWORK)/environmentPrefilter.o \
+	$(FRAMEWORK)/fileView.o \
 	$(FRAMEWORK)/graphicsPipeline.o \
+	$(FRAMEWORK)/immediateDraw.o \
+	$(FRAMEWORK)/ktx2Texture.o \
 	$(FRAMEWORK)/main.o \
+	$(FRAMEWORK)/mipmapGenerator.o \
+	$(FRAMEWORK)/pipelineStatistics.o \
+	$(FRAMEWORK)/progressiveTexture.o \
+	$(FRAMEWORK)/stagingRing.o \
+	$(FRAMEWORK)/textureStreamer.o \
 	$(FRAMEWORK)/utilities.o \
 	$(FRAMEWORK)/vulkanApp.o \
 	$(FRAMEWORK)/xcbApp.o
@@ -38,3 +55,6 @@ FRAMEWORK_OBJS= \
 
 %.o: %.frag
 	$(GLSLC) -V $*.frag -o $*.o
+
+%.o: %.comp
+	$(GLSLC) -V $*.comp -o $*.o
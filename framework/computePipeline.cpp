@@ -0,0 +1,31 @@
+#include "computePipeline.h"
+#include "utilities.h"
+
+ComputePipeline::ComputePipeline(std::shared_ptr<magma::Device> device,
+    const char *shaderFileName,
+    magma::variant_ptr<magma::PipelineLayout> layout,
+    const std::unique_ptr<magma::PipelineCache>& pipelineCache /* nullptr */,
+    std::shared_ptr<magma::Specialization> specialization /* nullptr */):
+    magma::ComputePipeline(device,
+        loadShader(device, shaderFileName, std::move(specialization)),
+        std::move(layout),
+        nullptr, // allocator
+        pipelineCache)
+{}
+
+magma::PipelineShaderStage ComputePipeline::loadShader(std::shared_ptr<magma::Device> device,
+    const char *fileName, std::shared_ptr<magma::Specialization> specialization) const
+{
+    const std::string shaderFileName = fileName + std::string(".o");
+    // Bytecode is mapped instead of being read to the heap, view is page-aligned for SPIR-V words
+    const utilities::FileView bytecode = utilities::loadBinaryFile(shaderFileName);
+    if (bytecode.size() % sizeof(magma::SpirvWord))
+        throw std::runtime_error("size of \"" + shaderFileName + "\" bytecode must be a multiple of SPIR-V word");
+    auto allocator = device->getHostAllocator();
+    constexpr bool reflect = true;
+    std::shared_ptr<magma::ShaderModule> module(std::make_shared<magma::ShaderModule>(std::move(device),
+        reinterpret_cast<const magma::SpirvWord *>(bytecode.data()), bytecode.size(), 0,
+        std::move(allocator), reflect, 0));
+    const char *const entrypoint = module->getReflection()->getEntryPointName(0);
+    return magma::ComputeShaderStage(std::move(module), entrypoint, std::move(specialization));
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "magma/magma.h"
+
+class ComputePipeline : public magma::ComputePipeline
+{
+public:
+    explicit ComputePipeline(std::shared_ptr<magma::Device> device,
+        const char *shaderFileName,
+        magma::variant_ptr<magma::PipelineLayout> layout,
+        const std::unique_ptr<magma::PipelineCache>& pipelineCache = nullptr,
+        std::shared_ptr<magma::Specialization> specialization = nullptr);
+
+private:
+    magma::PipelineShaderStage loadShader(std::shared_ptr<magma::Device> device,
+        const char *fileName, std::shared_ptr<magma::Specialization> specialization) const;
+};
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cmath>
+#include "dynamicResolution.h"
+#include "graphicsPipeline.h"
+
+constexpr VkFormat colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
+constexpr float minScale = 0.25f;
+constexpr float maxScale = 1.f;
+// Don't react to the noise of a couple of frames
+constexpr uint32_t minSampleCount = 8;
+constexpr float smoothing = 0.1f;
+constexpr const char *upscaleShaderFileName = "../framework/upscale"; // Shared by samples
+
+DynamicResolution::DynamicResolution(std::shared_ptr<magma::Device> device,
+    std::shared_ptr<magma::DescriptorPool> descriptorPool,
+    const std::unique_ptr<magma::RenderPass>& renderPass,
+    const std::unique_ptr<magma::PipelineCache>& pipelineCache,
+    const char *vertexShaderFileName,
+    const VkExtent2D& extent,
+    uint32_t bufferCount,
+    float frameTimeBudget):
+    device(std::move(device)),
+    submitScales(bufferCount, NotMeasured),
+    extent(extent),
+    frameTimeBudget(frameTimeBudget),
+    timestampPeriod(0.f),
+    scale(maxScale),
+    gpuTime(NotMeasured),
+    sampleCount(0),
+    filter(Filter::Bilinear),
+    adaptive(false)
+{
+    const VkPhysicalDeviceProperties properties = this->device->getPhysicalDevice()->getProperties();
+    if (properties.limits.timestampComputeAndGraphics)
+    {
+        timestampPeriod = properties.limits.timestampPeriod;
+        for (uint32_t i = 0; i < bufferCount; ++i)
+            queryPools.push_back(std::make_unique<magma::TimestampQuery>(this->device, 2));
+        adaptive = true;
+    }
+    // Define that color attachment can be cleared, can store shader output and should be read-only image
+    const magma::AttachmentDescription colorAttachment(colorFormat, 1,
+        magma::op::clearStore, // Color clear, store
+        magma::op::dontCare, // Inapplicable
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL); // Should be read-only in the shader when a render pass instance ends
+    const magma::SubpassDescription subpass(magma::AttachmentReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL));
+    // Implicit external dependency ends at bottom of pipe, so upscale pass would not wait for layout transition
+    const magma::SubpassDependency upscaleDependency(0, VK_SUBPASS_EXTERNAL,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_ACCESS_SHADER_READ_BIT);
+    sceneRenderPass = std::make_shared<magma::RenderPass>(this->device,
+        std::initializer_list<magma::AttachmentDescription>{colorAttachment},
+        std::initializer_list<magma::SubpassDescription>{subpass},
+        std::initializer_list<magma::SubpassDependency>{upscaleDependency});
+    createTarget(extent);
+    bilinearSampler = std::make_unique<magma::Sampler>(this->device, magma::sampler::magMinMipLinearClampToEdge);
+    setTable.image = {colorView, bilinearSampler};
+    descriptorSet = std::make_unique<magma::DescriptorSet>(std::move(descriptorPool),
+        setTable, VK_SHADER_STAGE_FRAGMENT_BIT);
+    constexpr magma::push::FragmentConstantRange<UpscaleParameters> pushConstantRange;
+    auto layout = std::make_unique<magma::PipelineLayout>(descriptorSet->getLayout(), pushConstantRange);
+    upscalePipeline = std::make_unique<GraphicsPipeline>(this->device,
+        vertexShaderFileName, upscaleShaderFileName,
+        magma::renderstate::nullVertexInput,
+        magma::renderstate::triangleStrip,
+        magma::renderstate::fillCullNoneCcw,
+        magma::renderstate::dontMultisample,
+        magma::renderstate::depthAlwaysDontWrite,
+        magma::renderstate::dontBlendRgb,
+        std::move(layout),
+        renderPass, 0,
+        pipelineCache);
+}
+
+DynamicResolution::~DynamicResolution() {}
+
+void DynamicResolution::resize(const VkExtent2D& extent)
+{   // Expects that device is idle
+    framebuffer.reset();
+    colorView.reset();
+    createTarget(extent);
+    setTable.image = {colorView, bilinearSampler};
+    descriptorSet->update();
+    this->extent = extent;
+}
+
+void DynamicResolution::beginScene(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t bufferIndex,
+    const magma::ClearColor& clearColor)
+{
+    if (!queryPools.empty())
+    {   // Query is reset by the command buffer that uses it
+        cmdBuffer->resetQueryPool(queryPools[bufferIndex], 0, 2);
+        cmdBuffer->writeTimestamp(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPools[bufferIndex], 0);
+    }
+    const VkExtent2D renderExtent = getRenderExtent();
+    cmdBuffer->beginRenderPass(sceneRenderPass, framebuffer, {clearColor});
+    cmdBuffer->setViewport(0, 0, renderExtent.width, renderExtent.height);
+    cmdBuffer->setScissor(0, 0, renderExtent.width, renderExtent.height);
+}
+
+void DynamicResolution::endScene(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t bufferIndex)
+{
+    cmdBuffer->endRenderPass();
+    // Color writes and transition to read-only layout are made visible to upscale pass by external dependency
+    if (!queryPools.empty())
+        cmdBuffer->writeTimestamp(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPools[bufferIndex], 1);
+}
+
+void DynamicResolution::upscale(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, const VkExtent2D& extent) const
+{
+    const VkExtent2D renderExtent = getRenderExtent();
+    UpscaleParameters parameters;
+    parameters.scale.x = renderExtent.width/(float)this->extent.width;
+    parameters.scale.y = renderExtent.height/(float)this->extent.height;
+    parameters.texelSize.x = 1.f/this->extent.width;
+    parameters.texelSize.y = 1.f/this->extent.height;
+    parameters.invViewportSize.x = 1.f/extent.width;
+    parameters.invViewportSize.y = 1.f/extent.height;
+    parameters.filter = filter;
+    cmdBuffer->setViewport(0, 0, extent.width, extent.height);
+    cmdBuffer->setScissor(0, 0, extent.width, extent.height);
+    cmdBuffer->bindDescriptorSet(upscalePipeline, 0, descriptorSet);
+    cmdBuffer->bindPipeline(upscalePipeline);
+    cmdBuffer->pushConstantBlock(upscalePipeline->getLayout(), VK_SHADER_STAGE_FRAGMENT_BIT, parameters);
+    cmdBuffer->draw(4, 0);
+}
+
+void DynamicResolution::submitted(uint32_t bufferIndex)
+{
+    if (!queryPools.empty())
+        submitScales[bufferIndex] = scale;
+}
+
+bool DynamicResolution::update()
+{
+    for (uint32_t i = 0; i < (uint32_t)queryPools.size(); ++i)
+    {
+        if (NotMeasured == submitScales[i])
+            continue;
+        // Each timestamp followed by availability
+        const std::vector<magma::QueryPool::Result<uint64_t, uint64_t>> timestamps =
+            queryPools[i]->getResultsWithAvailability<uint64_t>(0, 2);
+        if (!timestamps[0].availability || !timestamps[1].availability)
+            continue; // Not ready
+        const float submitScale = submitScales[i];
+        submitScales[i] = NotMeasured;
+        if (submitScale != scale)
+            continue; // Measured at previous scale
+        const float time = (timestamps[1].result - timestamps[0].result) * timestampPeriod * 1e-6f;
+        gpuTime = (NotMeasured == gpuTime) ? time : gpuTime + (time - gpuTime) * smoothing;
+        ++sampleCount;
+    }
+    if (!adaptive || sampleCount < minSampleCount)
+        return false;
+    // Hysteresis: keep scale as long as GPU time is within [85%, 100%] of the budget
+    constexpr float headroom = 0.85f;
+    if (gpuTime <= frameTimeBudget && gpuTime >= frameTimeBudget * headroom)
+        return false;
+    // Fill-rate cost is proportional to the pixel count, i.e. to the scale squared
+    const float targetTime = frameTimeBudget * (1.f + headroom) * 0.5f;
+    const float factor = std::clamp(std::sqrt(targetTime/gpuTime), 0.8f, 1.1f); // Drop fast, recover slowly
+    float newScale = std::clamp(scale * factor, minScale, maxScale);
+    newScale = std::round(newScale * 64.f)/64.f;
+    if (newScale == scale)
+        return false;
+    scale = newScale;
+    gpuTime = NotMeasured;
+    sampleCount = 0;
+    return true;
+}
+
+void DynamicResolution::setAdaptive(bool adaptive) noexcept
+{
+    this->adaptive = adaptive && !queryPools.empty();
+    if (!this->adaptive)
+        scale = maxScale;
+    gpuTime = NotMeasured;
+    sampleCount = 0;
+}
+
+VkExtent2D DynamicResolution::getRenderExtent() const noexcept
+{
+    VkExtent2D renderExtent;
+    renderExtent.width = std::max(1u, static_cast<uint32_t>(extent.width * scale + 0.5f));
+    renderExtent.height = std::max(1u, static_cast<uint32_t>(extent.height * scale + 0.5f));
+    return renderExtent;
+}
+
+void DynamicResolution::createTarget(const VkExtent2D& extent)
+{
+    constexpr bool sampled = true;
+    std::unique_ptr<magma::Image> color = std::make_unique<magma::ColorAttachment>(device, colorFormat, extent, 1, 1, sampled);
+    colorView = std::make_shared<magma::UniqueImageView>(std::move(color));
+    // Framebuffer defines render pass, color image view and dimensions
+    framebuffer = std::unique_ptr<magma::Framebuffer>(new magma::Framebuffer(
+        sceneRenderPass, {colorView}));
+}
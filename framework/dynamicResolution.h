@@ -0,0 +1,84 @@
+#pragma once
+#include "magma/magma.h"
+#include "rapid/rapid.h"
+
+class GraphicsPipeline;
+
+/* Dynamic resolution for fill-rate bound samples. Scene is rendered into
+   offscreen target at reduced resolution and then upscaled onto the swapchain.
+   Target is allocated at full extent and scene occupies its top-left corner,
+   so change of render scale doesn't reallocate anything; it only requires
+   command buffers to be re-recorded. GPU time of the scene pass is measured
+   with timestamp queries (a query pool per command buffer, polled without waiting),
+   and render scale is driven towards the frame time budget. Upscale fragment
+   shader is a part of the framework (upscale.frag), vertex shader is provided
+   by the sample and should output full-screen quad. */
+class DynamicResolution
+{
+public:
+    enum class Filter : int32_t
+    {
+        Bilinear, EdgeAware
+    };
+
+    explicit DynamicResolution(std::shared_ptr<magma::Device> device,
+        std::shared_ptr<magma::DescriptorPool> descriptorPool,
+        const std::unique_ptr<magma::RenderPass>& renderPass,
+        const std::unique_ptr<magma::PipelineCache>& pipelineCache,
+        const char *vertexShaderFileName,
+        const VkExtent2D& extent,
+        uint32_t bufferCount,
+        float frameTimeBudget); // Milliseconds
+    ~DynamicResolution();
+    void resize(const VkExtent2D& extent);
+    void beginScene(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t bufferIndex,
+        const magma::ClearColor& clearColor);
+    void endScene(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t bufferIndex);
+    void upscale(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, const VkExtent2D& extent) const;
+    void submitted(uint32_t bufferIndex);
+    bool update();
+    void setAdaptive(bool adaptive) noexcept;
+    bool getAdaptive() const noexcept { return adaptive; }
+    void setFilter(Filter filter) noexcept { this->filter = filter; }
+    Filter getFilter() const noexcept { return filter; }
+    const std::shared_ptr<magma::RenderPass>& getRenderPass() const noexcept { return sceneRenderPass; }
+    VkExtent2D getRenderExtent() const noexcept;
+    float getScale() const noexcept { return scale; }
+    float getGpuTime() const noexcept { return gpuTime; }
+    bool timestampsSupported() const noexcept { return timestampPeriod > 0.f; }
+
+private:
+    struct UpscaleParameters
+    {
+        rapid::float2 scale; // Render extent / target extent
+        rapid::float2 texelSize; // 1 / target extent
+        rapid::float2 invViewportSize; // 1 / swapchain extent
+        Filter filter;
+    };
+
+    struct DescriptorSetTable
+    {
+        magma::descriptor::CombinedImageSampler image = 0;
+    } setTable;
+
+    void createTarget(const VkExtent2D& extent);
+
+    static constexpr float NotMeasured = -1.f;
+    std::shared_ptr<magma::Device> device;
+    std::shared_ptr<magma::ImageView> colorView;
+    std::shared_ptr<magma::RenderPass> sceneRenderPass;
+    std::unique_ptr<magma::Framebuffer> framebuffer;
+    std::unique_ptr<magma::Sampler> bilinearSampler;
+    std::unique_ptr<magma::DescriptorSet> descriptorSet;
+    std::unique_ptr<GraphicsPipeline> upscalePipeline;
+    std::vector<std::unique_ptr<magma::TimestampQuery>> queryPools;
+    std::vector<float> submitScales;
+    VkExtent2D extent;
+    const float frameTimeBudget;
+    float timestampPeriod;
+    float scale;
+    float gpuTime;
+    uint32_t sampleCount;
+    Filter filter;
+    bool adaptive;
+};
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <filesystem>
+#include "environmentPrefilter.h"
+#include "storageImageCube.h"
+#include "computePipeline.h"
+#include "ktx2Texture.h"
+
+constexpr uint32_t workgroupSize = 8;
+constexpr uint32_t projectionFaceSize = 64; // Radiance is band-limited by projection anyway
+constexpr uint32_t maxSpecularLevels = 6; // Roughness 0, 0.2 .. 1
+constexpr VkFormat prefilteredFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+constexpr VkDeviceSize texelSize = 8;
+
+EnvironmentPrefilter::EnvironmentPrefilter(std::shared_ptr<magma::Device> device,
+    std::shared_ptr<magma::ImageView> environment,
+    const std::unique_ptr<magma::PipelineCache>& pipelineCache /* nullptr */,
+    uint32_t irradianceSize /* 32 */,
+    uint32_t specularSize /* 0 */,
+    uint32_t sampleCount /* 256 */):
+    device(std::move(device)),
+    environment(std::move(environment)),
+    irradianceSize(irradianceSize),
+    specularSize(specularSize),
+    sampleCount(sampleCount),
+    projectionSize(projectionFaceSize)
+{
+    const std::shared_ptr<magma::Image>& environmentImage = this->environment->getImage();
+    const uint32_t environmentSize = environmentImage->getWidth();
+    if (!this->specularSize)
+        this->specularSize = environmentSize;
+    const uint32_t radianceLevels = MipmapGenerator::fullMipChainLevels({environmentSize, environmentSize});
+    if (environmentImage->getMipLevels() < radianceLevels)
+    {   // Otherwise projection and filtered importance sampling would be clamped to the base level
+        radianceImage = std::make_shared<StorageImageCube>(this->device, prefilteredFormat, environmentSize, radianceLevels);
+        radiance = std::make_shared<magma::SharedImageView>(radianceImage);
+        radianceBaseView = std::make_shared<magma::SharedImageView>(radianceImage, 0, 1);
+        mipmapGenerator = std::make_unique<MipmapGenerator>(this->device, radianceImage);
+    }
+    else
+        radiance = this->environment;
+    // Sample environment at the level which size is the closest to the size of projection
+    projectionLod = std::max(std::log2(environmentSize / (float)projectionSize), 0.f);
+    texelSolidAngle = 4.f * 3.141593f / (6.f * environmentSize * environmentSize);
+    uint32_t specularLevels = 1;
+    for (uint32_t size = this->specularSize; (size > 1) && (specularLevels < maxSpecularLevels); size >>= 1)
+        ++specularLevels;
+    irradianceImage = std::make_shared<StorageImageCube>(this->device, prefilteredFormat, irradianceSize, 1);
+    specularImage = std::make_shared<StorageImageCube>(this->device, prefilteredFormat, this->specularSize, specularLevels);
+    // Texture views include all mip levels, storage views are per level
+    irradiance = std::make_shared<magma::SharedImageView>(irradianceImage);
+    specular = std::make_shared<magma::SharedImageView>(specularImage);
+    irradianceStorageView = std::make_shared<magma::SharedImageView>(irradianceImage, 0, 1);
+    for (uint32_t level = 0; level < specularLevels; ++level)
+        specularLevelViews.push_back(std::make_shared<magma::SharedImageView>(specularImage, level, 1));
+    const uint32_t tileCount = projectionSize / workgroupSize;
+    const VkDeviceSize partialsSize = 6 * tileCount * tileCount * 9 * sizeof(float) * 4;
+    partials = std::make_unique<magma::StorageBuffer>(this->device, partialsSize);
+    linearSampler = std::make_unique<magma::Sampler>(this->device, magma::sampler::magMinMipLinearClampToEdge);
+    setupDescriptorSets();
+    setupPipelines(pipelineCache);
+}
+
+void EnvironmentPrefilter::prefilter(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    VkPipelineStageFlags dstStageMask /* VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT */) const
+{
+    const VkCommandBuffer commandBuffer = cmdBuffer->getHandle();
+    if (radianceImage)
+    {   // Base level of radiance is mirror reflection of environment
+        const VkImageMemoryBarrier barrier = imageBarrier(radianceImage,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+        SpecularConstants constants;
+        constants.faceSize = radianceImage->getWidth();
+        constants.sampleCount = 1;
+        constants.roughness = 0.f;
+        constants.texelSolidAngle = texelSolidAngle;
+        cmdBuffer->bindDescriptorSet(specularPipeline, 0, radianceDescriptorSet);
+        cmdBuffer->bindPipeline(specularPipeline);
+        cmdBuffer->pushConstantBlock(specularPipeline->getLayout(), VK_SHADER_STAGE_COMPUTE_BIT, constants);
+        const uint32_t groupCount = (constants.faceSize + workgroupSize - 1) / workgroupSize;
+        cmdBuffer->dispatch(groupCount, groupCount, 6);
+        // Blit the rest of mip chain, filters below sample all levels
+        mipmapGenerator->generate(cmdBuffer, VK_IMAGE_LAYOUT_GENERAL,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
+    {   // Previous contents are discarded
+        const VkImageMemoryBarrier barriers[2] = {
+            imageBarrier(irradianceImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT),
+            imageBarrier(specularImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT)
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 2, barriers);
+    }
+    // Project radiance onto spherical harmonics
+    ProjectionConstants projection;
+    projection.faceSize = projectionSize;
+    projection.lod = projectionLod;
+    const uint32_t tileCount = projectionSize / workgroupSize;
+    cmdBuffer->bindDescriptorSet(projectionPipeline, 0, projectionDescriptorSet);
+    cmdBuffer->bindPipeline(projectionPipeline);
+    cmdBuffer->pushConstantBlock(projectionPipeline->getLayout(), VK_SHADER_STAGE_COMPUTE_BIT, projection);
+    cmdBuffer->dispatch(tileCount, tileCount, 6);
+    // Levels of specular map are written independently, no barriers in between
+    cmdBuffer->bindPipeline(specularPipeline);
+    uint32_t size = specularSize;
+    const uint32_t levelCount = (uint32_t)specularLevelViews.size();
+    for (uint32_t level = 0; level < levelCount; ++level)
+    {
+        SpecularConstants constants;
+        constants.faceSize = size;
+        constants.sampleCount = sampleCount;
+        constants.roughness = levelCount > 1 ? level / float(levelCount - 1) : 0.f;
+        constants.texelSolidAngle = texelSolidAngle;
+        cmdBuffer->bindDescriptorSet(specularPipeline, 0, specularDescriptorSets[level]);
+        cmdBuffer->pushConstantBlock(specularPipeline->getLayout(), VK_SHADER_STAGE_COMPUTE_BIT, constants);
+        const uint32_t groupCount = (size + workgroupSize - 1) / workgroupSize;
+        cmdBuffer->dispatch(groupCount, groupCount, 6);
+        size = std::max(size >> 1, 1u);
+    }
+    // Irradiance depends on partial sums of projection
+    cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        magma::BufferMemoryBarrier(partials.get(), magma::MemoryBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)));
+    IrradianceConstants constants;
+    constants.faceSize = irradianceSize;
+    constants.partialCount = 6 * tileCount * tileCount;
+    cmdBuffer->bindDescriptorSet(irradiancePipeline, 0, irradianceDescriptorSet);
+    cmdBuffer->bindPipeline(irradiancePipeline);
+    cmdBuffer->pushConstantBlock(irradiancePipeline->getLayout(), VK_SHADER_STAGE_COMPUTE_BIT, constants);
+    const uint32_t groupCount = (irradianceSize + workgroupSize - 1) / workgroupSize;
+    cmdBuffer->dispatch(groupCount, groupCount, 6);
+    {   // Transition to read-only layout for sampling
+        const VkImageMemoryBarrier barriers[2] = {
+            imageBarrier(irradianceImage, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT),
+            imageBarrier(specularImage, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStageMask,
+            0, 0, nullptr, 0, nullptr, 2, barriers);
+    }
+}
+
+void EnvironmentPrefilter::readback(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+{
+    readbackImage(cmdBuffer, irradianceImage, irradianceReadback);
+    readbackImage(cmdBuffer, specularImage, specularReadback);
+    cmdBuffer->pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        {
+            {irradianceReadback.buffer.get(), magma::barrier::buffer::transferWriteHostRead},
+            {specularReadback.buffer.get(), magma::barrier::buffer::transferWriteHostRead}
+        });
+}
+
+void EnvironmentPrefilter::save(const std::string& irradianceFilename, const std::string& specularFilename) const
+{   // Command buffer with readback should be completed
+    if (!irradianceReadback.buffer || !specularReadback.buffer)
+        throw std::runtime_error("prefiltered environment hasn't been read back");
+    magma::map<uint8_t>(irradianceReadback.buffer,
+        [&](uint8_t *data)
+        {
+            Ktx2Texture::save(irradianceFilename, prefilteredFormat, irradianceSize, irradianceSize, 6,
+                irradianceReadback.levelSizes, data);
+        });
+    magma::map<uint8_t>(specularReadback.buffer,
+        [&](uint8_t *data)
+        {
+            Ktx2Texture::save(specularFilename, prefilteredFormat, specularSize, specularSize, 6,
+                specularReadback.levelSizes, data);
+        });
+}
+
+bool EnvironmentPrefilter::cacheValid(const std::string& cacheFilename, const std::string& environmentFilename)
+{
+    std::error_code ec;
+    const auto cacheTime = std::filesystem::last_write_time(cacheFilename, ec);
+    if (ec)
+        return false;
+    const auto environmentTime = std::filesystem::last_write_time(environmentFilename, ec);
+    return !ec && (cacheTime >= environmentTime);
+}
+
+void EnvironmentPrefilter::setupDescriptorSets()
+{
+    const uint32_t specularLevels = (uint32_t)specularLevelViews.size();
+    const uint32_t radianceSets = radianceImage ? 1 : 0;
+    const uint32_t maxDescriptorSets = 2 + specularLevels + radianceSets;
+    descriptorPool = std::make_shared<magma::DescriptorPool>(device, maxDescriptorSets,
+        std::initializer_list<VkDescriptorPoolSize>{
+            magma::descriptor::CombinedImageSamplerPoolSize(1 + specularLevels + radianceSets),
+            magma::descriptor::StorageBufferPoolSize(2),
+            magma::descriptor::StorageImagePoolSize(1 + specularLevels + radianceSets)
+        });
+    if (radianceImage)
+    {   // Has the same layout as sets of specular levels
+        radianceSetTable.environment = {environment, linearSampler};
+        radianceSetTable.specular = radianceBaseView;
+        radianceDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
+            radianceSetTable, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+    projectionSetTable.environment = {radiance, linearSampler};
+    projectionSetTable.partials = partials;
+    projectionDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
+        projectionSetTable, VK_SHADER_STAGE_COMPUTE_BIT);
+    irradianceSetTable.partials = partials;
+    irradianceSetTable.irradiance = irradianceStorageView;
+    irradianceDescriptorSet = std::make_unique<magma::DescriptorSet>(descriptorPool,
+        irradianceSetTable, VK_SHADER_STAGE_COMPUTE_BIT);
+    for (uint32_t level = 0; level < specularLevels; ++level)
+    {   // Descriptor set refers to its table, so tables aren't moved
+        specularSetTables.push_back(std::make_unique<SpecularSetTable>());
+        SpecularSetTable& setTable = *specularSetTables.back();
+        setTable.environment = {radiance, linearSampler};
+        setTable.specular = specularLevelViews[level];
+        specularDescriptorSets.push_back(std::make_unique<magma::DescriptorSet>(descriptorPool,
+            setTable, VK_SHADER_STAGE_COMPUTE_BIT));
+    }
+}
+
+void EnvironmentPrefilter::setupPipelines(const std::unique_ptr<magma::PipelineCache>& pipelineCache)
+{
+    constexpr magma::push::ComputeConstantRange<ProjectionConstants> projectionConstantRange;
+    auto projectionLayout = std::make_unique<magma::PipelineLayout>(projectionDescriptorSet->getLayout(), projectionConstantRange);
+    projectionPipeline = std::make_unique<ComputePipeline>(device,
+        "shProjection", std::move(projectionLayout), pipelineCache);
+    constexpr magma::push::ComputeConstantRange<IrradianceConstants> irradianceConstantRange;
+    auto irradianceLayout = std::make_unique<magma::PipelineLayout>(irradianceDescriptorSet->getLayout(), irradianceConstantRange);
+    irradiancePipeline = std::make_unique<ComputePipeline>(device,
+        "irradiance", std::move(irradianceLayout), pipelineCache);
+    constexpr magma::push::ComputeConstantRange<SpecularConstants> specularConstantRange;
+    auto specularLayout = std::make_unique<magma::PipelineLayout>(specularDescriptorSets.front()->getLayout(), specularConstantRange);
+    specularPipeline = std::make_unique<ComputePipeline>(device,
+        "specularFilter", std::move(specularLayout), pipelineCache);
+}
+
+void EnvironmentPrefilter::readbackImage(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    const std::shared_ptr<magma::Image>& image, Readback& readback) const
+{   // Levels follow each other in buffer, faces of level too
+    std::vector<VkBufferImageCopy> regions;
+    readback.levelSizes.clear();
+    VkDeviceSize offset = 0;
+    uint32_t size = image->getWidth();
+    for (uint32_t level = 0; level < image->getMipLevels(); ++level)
+    {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 6};
+        region.imageExtent = {size, size, 1};
+        regions.push_back(region);
+        const VkDeviceSize levelSize = size * size * 6 * texelSize;
+        readback.levelSizes.push_back(levelSize);
+        offset += levelSize;
+        size = std::max(size >> 1, 1u);
+    }
+    readback.buffer = std::make_unique<magma::DstTransferBuffer>(device, offset);
+    const VkCommandBuffer commandBuffer = cmdBuffer->getHandle();
+    VkImageMemoryBarrier barrier = imageBarrier(image,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+    vkCmdCopyImageToBuffer(commandBuffer, image->getHandle(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        readback.buffer->getHandle(), (uint32_t)regions.size(), regions.data());
+    barrier = imageBarrier(image,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+VkImageMemoryBarrier EnvironmentPrefilter::imageBarrier(const std::shared_ptr<magma::Image>& image,
+    VkImageLayout oldLayout, VkImageLayout newLayout,
+    VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) const noexcept
+{
+    VkImageMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image->getHandle();
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, image->getMipLevels(), 0, 6};
+    return barrier;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <string>
+#include "magma/magma.h"
+#include "mipmapGenerator.h"
+
+/* Prefilters environment cube map on GPU for image based lighting,
+   so that iterating on environments doesn't need offline tools.
+   Diffuse map stores irradiance, that is evaluated from radiance
+   projected onto spherical harmonics: each workgroup of projection
+   reduces its tile of the face to partial sums, and irradiance shader
+   sums partials and convolves them with cosine lobe. Specular map
+   stores radiance convolved with GGX lobe, roughness increases with
+   mip level. Projection and dispatches of all specular levels don't
+   depend on each other, so faces and levels are filtered concurrently.
+   Both sample radiance from its mip chain (filtered importance sampling).
+   If environment has no full mip chain (e.g. single-level BC cube map),
+   it is expanded into half float cube map first: base level is written
+   by specular filter at zero roughness, other levels are blitted.
+   Results may be read back and saved as KTX2 files, which are loaded
+   instead of prefiltering while they are newer than the environment.
+   Shaders (shProjection, irradiance, specularFilter) are provided
+   by the sample. */
+class EnvironmentPrefilter
+{
+public:
+    explicit EnvironmentPrefilter(std::shared_ptr<magma::Device> device,
+        std::shared_ptr<magma::ImageView> environment,
+        const std::unique_ptr<magma::PipelineCache>& pipelineCache = nullptr,
+        uint32_t irradianceSize = 32,
+        uint32_t specularSize = 0, // Size of environment
+        uint32_t sampleCount = 256); // Per texel of specular map
+    void prefilter(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) const;
+    void readback(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer);
+    void save(const std::string& irradianceFilename, const std::string& specularFilename) const;
+    const std::shared_ptr<magma::ImageView>& getIrradiance() const noexcept { return irradiance; }
+    const std::shared_ptr<magma::ImageView>& getSpecular() const noexcept { return specular; }
+    static bool cacheValid(const std::string& cacheFilename, const std::string& environmentFilename);
+
+private:
+    struct ProjectionSetTable
+    {
+        magma::descriptor::CombinedImageSampler environment = 0;
+        magma::descriptor::StorageBuffer partials = 1;
+    };
+
+    struct IrradianceSetTable
+    {
+        magma::descriptor::StorageBuffer partials = 0;
+        magma::descriptor::StorageImage irradiance = 1;
+    };
+
+    struct SpecularSetTable
+    {
+        magma::descriptor::CombinedImageSampler environment = 0;
+        magma::descriptor::StorageImage specular = 1;
+    };
+
+    struct ProjectionConstants
+    {
+        uint32_t faceSize;
+        float lod;
+    };
+
+    struct IrradianceConstants
+    {
+        uint32_t faceSize;
+        uint32_t partialCount;
+    };
+
+    struct SpecularConstants
+    {
+        uint32_t faceSize;
+        uint32_t sampleCount;
+        float roughness;
+        float texelSolidAngle;
+    };
+
+    struct Readback
+    {
+        std::unique_ptr<magma::DstTransferBuffer> buffer;
+        std::vector<VkDeviceSize> levelSizes;
+    };
+
+    void setupDescriptorSets();
+    void setupPipelines(const std::unique_ptr<magma::PipelineCache>& pipelineCache);
+    void readbackImage(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        const std::shared_ptr<magma::Image>& image, Readback& readback) const;
+    VkImageMemoryBarrier imageBarrier(const std::shared_ptr<magma::Image>& image,
+        VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) const noexcept;
+
+    std::shared_ptr<magma::Device> device;
+    std::shared_ptr<magma::ImageView> environment;
+    std::shared_ptr<magma::Image> radianceImage; // If environment has no mip chain
+    std::shared_ptr<magma::ImageView> radiance; // Either environment or view of its mip chain
+    std::shared_ptr<magma::ImageView> radianceBaseView;
+    std::unique_ptr<MipmapGenerator> mipmapGenerator;
+    std::shared_ptr<magma::Image> irradianceImage;
+    std::shared_ptr<magma::Image> specularImage;
+    std::shared_ptr<magma::ImageView> irradiance;
+    std::shared_ptr<magma::ImageView> specular;
+    std::shared_ptr<magma::ImageView> irradianceStorageView;
+    std::vector<std::shared_ptr<magma::ImageView>> specularLevelViews;
+    std::unique_ptr<magma::StorageBuffer> partials;
+    std::unique_ptr<magma::Sampler> linearSampler;
+    std::shared_ptr<magma::DescriptorPool> descriptorPool;
+    ProjectionSetTable projectionSetTable;
+    IrradianceSetTable irradianceSetTable;
+    SpecularSetTable radianceSetTable;
+    std::vector<std::unique_ptr<SpecularSetTable>> specularSetTables;
+    std::unique_ptr<magma::DescriptorSet> projectionDescriptorSet;
+    std::unique_ptr<magma::DescriptorSet> irradianceDescriptorSet;
+    std::unique_ptr<magma::DescriptorSet> radianceDescriptorSet;
+    std::vector<std::unique_ptr<magma::DescriptorSet>> specularDescriptorSets;
+    std::unique_ptr<magma::ComputePipeline> projectionPipeline;
+    std::unique_ptr<magma::ComputePipeline> irradiancePipeline;
+    std::unique_ptr<magma::ComputePipeline> specularPipeline;
+    Readback irradianceReadback;
+    Readback specularReadback;
+    uint32_t irradianceSize;
+    uint32_t specularSize;
+    uint32_t sampleCount;
+    uint32_t projectionSize;
+    float projectionLod;
+    float texelSolidAngle;
+};
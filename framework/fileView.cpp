@@ -0,0 +1,135 @@
+#include <stdexcept>
+#include <utility>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+#include "fileView.h"
+
+namespace utilities
+{
+FileView::FileView(const std::string& filename, Access access /* Sequential */)
+{
+    if (!map(filename, access))
+        throw std::runtime_error("failed to open file \"" + filename + "\"");
+}
+
+FileView::FileView(FileView&& other) noexcept:
+    bytes(other.bytes),
+    length(other.length)
+#ifdef _WIN32
+   ,file(other.file),
+    mapping(other.mapping)
+#endif
+{
+    other.bytes = nullptr;
+    other.length = 0;
+#ifdef _WIN32
+    other.file = nullptr;
+    other.mapping = nullptr;
+#endif
+}
+
+FileView& FileView::operator=(FileView&& other) noexcept
+{
+    if (this != &other)
+    {
+        unmap();
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+    #ifdef _WIN32
+        std::swap(file, other.file);
+        std::swap(mapping, other.mapping);
+    #endif
+    }
+    return *this;
+}
+
+FileView::~FileView()
+{
+    unmap();
+}
+
+bool FileView::map(const std::string& filename, Access access /* Sequential */) noexcept
+{
+    unmap();
+#ifdef _WIN32
+    const DWORD flags = (Access::Sequential == access) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+    HANDLE hFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | flags, nullptr);
+    if (INVALID_HANDLE_VALUE == hFile)
+        return false;
+    file = hFile;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize))
+    {
+        unmap();
+        return false;
+    }
+    if (!fileSize.QuadPart)
+        return true; // Empty file can't be mapped
+    mapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+        bytes = reinterpret_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!bytes)
+    {
+        unmap();
+        return false;
+    }
+    length = static_cast<std::size_t>(fileSize.QuadPart);
+#else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+        close(fd);
+        return false;
+    }
+    if (!st.st_size)
+    {   // Empty file can't be mapped
+        close(fd);
+        return true;
+    }
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // Mapping keeps reference to the file
+    if (MAP_FAILED == ptr)
+        return false;
+    if (Access::Sequential == access)
+    {   // Read ahead aggressively and start reading right away
+        madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+        madvise(ptr, st.st_size, MADV_WILLNEED);
+    }
+    else
+        madvise(ptr, st.st_size, MADV_RANDOM);
+    bytes = reinterpret_cast<const uint8_t *>(ptr);
+    length = static_cast<std::size_t>(st.st_size);
+#endif // _WIN32
+    return true;
+}
+
+void FileView::unmap() noexcept
+{
+#ifdef _WIN32
+    if (bytes)
+        UnmapViewOfFile(bytes);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file)
+        CloseHandle(file);
+    file = nullptr;
+    mapping = nullptr;
+#else
+    if (bytes)
+        munmap(const_cast<uint8_t *>(bytes), length);
+#endif // _WIN32
+    bytes = nullptr;
+    length = 0;
+}
+} // namespace utilities
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace utilities
+{
+/* Read-only view of the file mapped into address space of the process.
+   Pages are loaded by the OS on first access, so there is no intermediate
+   heap copy: loaders parse headers and copy contents to staging buffers
+   directly from the view. Access pattern is a hint for the OS read-ahead.
+   View is page-aligned, so its data can be reinterpreted as SPIR-V words. */
+class FileView
+{
+public:
+    enum class Access
+    {
+        Sequential, Random
+    };
+
+    FileView() noexcept = default;
+    explicit FileView(const std::string& filename,
+        Access access = Access::Sequential);
+    FileView(FileView&& other) noexcept;
+    FileView& operator=(FileView&& other) noexcept;
+    ~FileView();
+    bool map(const std::string& filename,
+        Access access = Access::Sequential) noexcept;
+    void unmap() noexcept;
+    const uint8_t *data() const noexcept { return bytes; }
+    std::size_t size() const noexcept { return length; }
+    bool empty() const noexcept { return 0 == length; }
+
+private:
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    const uint8_t *bytes = nullptr;
+    std::size_t length = 0;
+#ifdef _WIN32
+    void *file = nullptr;
+    void *mapping = nullptr;
+#endif
+};
+} // namespace utilities
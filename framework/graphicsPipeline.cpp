@@ -1,5 +1,5 @@
-#include <fstream>
 #include "graphicsPipeline.h"
+#include "utilities.h"
 
 GraphicsPipeline::GraphicsPipeline(std::shared_ptr<magma::Device> device,
     const char *vertexShaderFileName,
@@ -40,10 +40,8 @@ magma::PipelineShaderStage GraphicsPipeline::loadShader(
     std::shared_ptr<magma::Device> device, const char *fileName) const
 {
     const std::string shaderFileName = fileName + std::string(".o");
-    std::ifstream file(shaderFileName, std::ios::in | std::ios::binary);
-    if (!file.is_open())
-        throw std::runtime_error("file \"" + shaderFileName + "\" not found");
-    std::vector<char> bytecode((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    // Bytecode is mapped instead of being read to the heap, view is page-aligned for SPIR-V words
+    const utilities::FileView bytecode = utilities::loadBinaryFile(shaderFileName);
     if (bytecode.size() % sizeof(magma::SpirvWord))
         throw std::runtime_error("size of \"" + shaderFileName + "\" bytecode must be a multiple of SPIR-V word");
     auto allocator = device->getHostAllocator();
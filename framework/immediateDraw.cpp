@@ -0,0 +1,275 @@
+#include <cstring>
+#include <algorithm>
+#include "immediateDraw.h"
+#include "graphicsPipeline.h"
+
+ImmediateDraw::ImmediateDraw(std::shared_ptr<magma::Device> device,
+    const std::unique_ptr<magma::RenderPass>& renderPass,
+    const std::unique_ptr<magma::PipelineCache>& pipelineCache,
+    const char *vertexShaderFileName,
+    const char *fragmentShaderFileName,
+    uint32_t frameSlotCount /* 1 */,
+    uint32_t initialVertexCount /* 1024 */):
+    device(std::move(device)),
+    renderPass(renderPass),
+    pipelineCache(pipelineCache),
+    vertexShaderFileName(vertexShaderFileName),
+    fragmentShaderFileName(fragmentShaderFileName),
+    frameSlots(frameSlotCount),
+    rasterizationState(magma::renderstate::fillCullNoneCcw),
+    lineWidth(1.f),
+    transform(rapid::identity()),
+    currentColor(1.f, 1.f, 1.f, 1.f),
+    currentPointSize(1.f),
+    primitive(Primitive::Points),
+    firstVertex(0),
+    primitiveCount(0),
+    insidePrimitive(false)
+{
+    constexpr magma::push::VertexConstantRange<rapid::matrix> pushConstantRange;
+    layout = std::make_shared<magma::PipelineLayout>(this->device, pushConstantRange);
+    // Fan or quad produces more indices than vertices
+    vertices.reserve(initialVertexCount);
+    indices.reserve(initialVertexCount * 2);
+}
+
+ImmediateDraw::~ImmediateDraw() {}
+
+void ImmediateDraw::setRasterizationState(const magma::RasterizationState& state) noexcept
+{
+    MAGMA_ASSERT(!insidePrimitive);
+    rasterizationState = state;
+}
+
+void ImmediateDraw::beginPrimitive(Primitive primitive)
+{
+    MAGMA_ASSERT(!insidePrimitive);
+    this->primitive = primitive;
+    firstVertex = (uint32_t)vertices.size();
+    insidePrimitive = true;
+}
+
+void ImmediateDraw::vertex(float x, float y, float z /* 0 */)
+{
+    MAGMA_ASSERT(insidePrimitive);
+    vertices.push_back({rapid::float4(x, y, z, currentPointSize), currentColor});
+}
+
+void ImmediateDraw::endPrimitive()
+{
+    MAGMA_ASSERT(insidePrimitive);
+    insidePrimitive = false;
+    const uint32_t vertexCount = (uint32_t)vertices.size() - firstVertex;
+    if (!vertexCount)
+        return;
+    ++primitiveCount;
+    VkPrimitiveTopology topology;
+    switch (primitive)
+    {
+    case Primitive::Points:
+        topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+        break;
+    case Primitive::Lines:
+    case Primitive::LineStrip:
+    case Primitive::LineLoop:
+        topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+        break;
+    default:
+        topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    }
+    const uint32_t pipelineIndex = lookupPipeline(topology);
+    const uint32_t firstIndex = (uint32_t)indices.size();
+    convertPrimitive(firstVertex, vertexCount);
+    const uint32_t indexCount = (uint32_t)indices.size() - firstIndex;
+    if (!indexCount)
+        return;
+    if (!batches.empty())
+    {   // Merge with the previous draw if state is the same
+        Batch& last = batches.back();
+        if ((last.pipelineIndex == pipelineIndex) &&
+            (memcmp(&last.transform, &transform, sizeof(rapid::matrix)) == 0))
+        {
+            last.indexCount += indexCount;
+            return;
+        }
+    }
+    batches.push_back({pipelineIndex, firstIndex, indexCount, transform});
+}
+
+void ImmediateDraw::upload(uint32_t frameSlot /* 0 */)
+{   /* Buffers grow geometrically, so that reallocation is rare.
+       Should not be called while draws of the same frame slot are in flight. */
+    if (vertices.empty())
+        return;
+    const VkDeviceSize vertexDataSize = vertices.size() * sizeof(Vertex);
+    const VkDeviceSize indexDataSize = indices.size() * sizeof(uint32_t);
+    const bool stagedPool = device->getPhysicalDevice()->features()->supportsDeviceLocalHostVisibleMemory();
+    std::unique_ptr<magma::DynamicVertexBuffer>& vertexBuffer = frameSlots[frameSlot].vertexBuffer;
+    std::unique_ptr<magma::DynamicIndexBuffer>& indexBuffer = frameSlots[frameSlot].indexBuffer;
+    if (!vertexBuffer || (vertexBuffer->getMemory()->getSize() < vertexDataSize))
+    {
+        const VkDeviceSize size = vertexBuffer ? std::max(vertexBuffer->getMemory()->getSize() * 2, vertexDataSize) : vertexDataSize;
+        vertexBuffer = std::make_unique<magma::DynamicVertexBuffer>(device, size, stagedPool);
+    }
+    if (!indexBuffer || (indexBuffer->getMemory()->getSize() < indexDataSize))
+    {
+        const VkDeviceSize size = indexBuffer ? std::max(indexBuffer->getMemory()->getSize() * 2, indexDataSize) : indexDataSize;
+        indexBuffer = std::make_unique<magma::DynamicIndexBuffer>(device, size, VK_INDEX_TYPE_UINT32, stagedPool);
+    }
+    magma::map<Vertex>(vertexBuffer,
+        [this](Vertex *data)
+        {
+            memcpy(data, vertices.data(), vertices.size() * sizeof(Vertex));
+        });
+    magma::map<uint32_t>(indexBuffer,
+        [this](uint32_t *data)
+        {
+            memcpy(data, indices.data(), indices.size() * sizeof(uint32_t));
+        });
+}
+
+void ImmediateDraw::draw(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t frameSlot /* 0 */) const
+{
+    if (batches.empty())
+        return;
+    const FrameSlot& slot = frameSlots[frameSlot];
+    cmdBuffer->bindVertexBuffer(0, slot.vertexBuffer);
+    cmdBuffer->bindIndexBuffer(slot.indexBuffer);
+    uint32_t boundPipeline = ~0u;
+    for (const Batch& batch: batches)
+    {
+        const std::unique_ptr<GraphicsPipeline>& pipeline = pipelines[batch.pipelineIndex].pipeline;
+        if (batch.pipelineIndex != boundPipeline)
+        {
+            cmdBuffer->bindPipeline(pipeline);
+            boundPipeline = batch.pipelineIndex;
+        }
+        cmdBuffer->pushConstantBlock(layout, VK_SHADER_STAGE_VERTEX_BIT, batch.transform);
+        cmdBuffer->drawIndexed(batch.indexCount, batch.firstIndex, 0);
+    }
+}
+
+void ImmediateDraw::reset() noexcept
+{   // Capacity is retained for the next frame
+    MAGMA_ASSERT(!insidePrimitive);
+    vertices.clear();
+    indices.clear();
+    batches.clear();
+    primitiveCount = 0;
+}
+
+VkDeviceSize ImmediateDraw::getUploadSize() const noexcept
+{
+    return vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t);
+}
+
+uint32_t ImmediateDraw::lookupPipeline(VkPrimitiveTopology topology)
+{
+    for (uint32_t i = 0; i < (uint32_t)pipelines.size(); ++i)
+    {
+        const PipelineEntry& entry = pipelines[i];
+        if ((entry.topology == topology) &&
+            (entry.polygonMode == rasterizationState.polygonMode) &&
+            (entry.cullMode == rasterizationState.cullMode) &&
+            (entry.frontFace == rasterizationState.frontFace) &&
+            (entry.lineWidth == lineWidth))
+        {
+            return i;
+        }
+    }
+    static constexpr magma::VertexInputStructure<Vertex, 2> vertexInput(
+        {
+            MAGMA_VERTEX_ATTRIBUTE(Vertex, position, 0),
+            MAGMA_VERTEX_ATTRIBUTE(Vertex, color, 1),
+        });
+    magma::RasterizationState state = rasterizationState;
+    state.lineWidth = lineWidth;
+    const magma::InputAssemblyState inputAssemblyState =
+        (VK_PRIMITIVE_TOPOLOGY_POINT_LIST == topology) ? magma::renderstate::pointList :
+        (VK_PRIMITIVE_TOPOLOGY_LINE_LIST == topology) ? magma::renderstate::lineList :
+        magma::renderstate::triangleList;
+    PipelineEntry entry;
+    entry.topology = topology;
+    entry.polygonMode = state.polygonMode;
+    entry.cullMode = state.cullMode;
+    entry.frontFace = state.frontFace;
+    entry.lineWidth = lineWidth;
+    entry.pipeline = std::make_unique<GraphicsPipeline>(device,
+        vertexShaderFileName, fragmentShaderFileName,
+        vertexInput,
+        inputAssemblyState,
+        state,
+        magma::renderstate::dontMultisample,
+        magma::renderstate::depthAlwaysDontWrite,
+        magma::renderstate::blendNormalRgb,
+        layout,
+        renderPass, 0,
+        pipelineCache);
+    pipelines.push_back(std::move(entry));
+    return (uint32_t)pipelines.size() - 1;
+}
+
+void ImmediateDraw::convertPrimitive(uint32_t first, uint32_t count)
+{   // Emulate primitives missing in Vulkan with lists
+    switch (primitive)
+    {
+    case Primitive::Points:
+        for (uint32_t i = 0; i < count; ++i)
+            indices.push_back(first + i);
+        break;
+    case Primitive::Lines:
+    case Primitive::Triangles:
+    {   // Incomplete primitive would shift the following ones in merged batch
+        const uint32_t vertexCount = (Primitive::Lines == primitive) ? 2 : 3;
+        count -= count % vertexCount;
+        for (uint32_t i = 0; i < count; ++i)
+            indices.push_back(first + i);
+        break;
+    }
+    case Primitive::LineStrip:
+    case Primitive::LineLoop:
+        for (uint32_t i = 1; i < count; ++i)
+        {
+            indices.push_back(first + i - 1);
+            indices.push_back(first + i);
+        }
+        if ((Primitive::LineLoop == primitive) && (count > 2))
+        {   // Close the loop
+            indices.push_back(first + count - 1);
+            indices.push_back(first);
+        }
+        break;
+    case Primitive::TriangleStrip:
+        for (uint32_t i = 2; i < count; ++i)
+        {   // Every odd triangle has reversed order to preserve winding
+            const bool odd = i & 1;
+            indices.push_back(first + i - (odd ? 1 : 2));
+            indices.push_back(first + i - (odd ? 2 : 1));
+            indices.push_back(first + i);
+        }
+        break;
+    case Primitive::TriangleFan:
+    case Primitive::Polygon:
+        for (uint32_t i = 2; i < count; ++i)
+        {
+            indices.push_back(first);
+            indices.push_back(first + i - 1);
+            indices.push_back(first + i);
+        }
+        break;
+    case Primitive::Quads:
+        for (uint32_t i = 3; i < count; i += 4)
+        {
+            const uint32_t v = first + i - 3;
+            indices.insert(indices.end(), {v, v + 1, v + 2, v, v + 2, v + 3});
+        }
+        break;
+    case Primitive::QuadStrip:
+        for (uint32_t i = 3; i < count; i += 2)
+        {   // Quad is formed by vertices 0, 1, 3, 2
+            const uint32_t v = first + i - 3;
+            indices.insert(indices.end(), {v, v + 1, v + 3, v, v + 3, v + 2});
+        }
+        break;
+    }
+}
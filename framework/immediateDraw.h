@@ -0,0 +1,104 @@
+#pragma once
+#include "magma/magma.h"
+#include "rapid/rapid.h"
+
+class GraphicsPipeline;
+
+/* Immediate mode layer for debug drawing. Unlike magma::aux::ImmediateRender,
+   primitives are converted to indexed point, line and triangle lists on the CPU,
+   so consecutive primitives that share the same state are merged into a single draw.
+   Vertices are accumulated in arena that grows geometrically; vertex and index buffers
+   are reallocated only on upload, never in the middle of recording of primitives.
+   Render pass and pipeline cache are referenced to build pipelines on demand.
+   To draw dynamic content every frame, there is a ring of frame slots, each with
+   its own buffers, so that uploading of the next frame doesn't stall the previous ones. */
+class ImmediateDraw
+{
+public:
+    enum class Primitive : uint8_t
+    {
+        Points, Lines, LineStrip, LineLoop,
+        Triangles, TriangleStrip, TriangleFan,
+        Quads, QuadStrip, Polygon
+    };
+
+    struct Vertex
+    {
+        rapid::float4 position; // w - point size
+        rapid::float4 color;
+    };
+
+    explicit ImmediateDraw(std::shared_ptr<magma::Device> device,
+        const std::unique_ptr<magma::RenderPass>& renderPass,
+        const std::unique_ptr<magma::PipelineCache>& pipelineCache,
+        const char *vertexShaderFileName,
+        const char *fragmentShaderFileName,
+        uint32_t frameSlotCount = 1,
+        uint32_t initialVertexCount = 1024);
+    ~ImmediateDraw();
+    void setRasterizationState(const magma::RasterizationState& state) noexcept;
+    void setLineWidth(float width) noexcept { lineWidth = width; }
+    void setTransform(const rapid::matrix& transform) noexcept { this->transform = transform; }
+    void color(float r, float g, float b, float a = 1.f) noexcept { currentColor = rapid::float4(r, g, b, a); }
+    void pointSize(float size) noexcept { currentPointSize = size; }
+    void beginPrimitive(Primitive primitive);
+    void vertex(float x, float y, float z = 0.f);
+    void endPrimitive();
+    void upload(uint32_t frameSlot = 0);
+    void draw(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t frameSlot = 0) const;
+    void reset() noexcept;
+    uint32_t getFrameSlotCount() const noexcept { return (uint32_t)frameSlots.size(); }
+    uint32_t getVertexCount() const noexcept { return (uint32_t)vertices.size(); }
+    uint32_t getPrimitiveCount() const noexcept { return primitiveCount; }
+    uint32_t getDrawCount() const noexcept { return (uint32_t)batches.size(); }
+    VkDeviceSize getUploadSize() const noexcept;
+
+private:
+    struct PipelineEntry
+    {
+        VkPrimitiveTopology topology;
+        VkPolygonMode polygonMode;
+        VkCullModeFlags cullMode;
+        VkFrontFace frontFace;
+        float lineWidth;
+        std::unique_ptr<GraphicsPipeline> pipeline;
+    };
+
+    struct FrameSlot
+    {
+        std::unique_ptr<magma::DynamicVertexBuffer> vertexBuffer;
+        std::unique_ptr<magma::DynamicIndexBuffer> indexBuffer;
+    };
+
+    struct Batch
+    {
+        uint32_t pipelineIndex;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        rapid::matrix transform;
+    };
+
+    uint32_t lookupPipeline(VkPrimitiveTopology topology);
+    void convertPrimitive(uint32_t firstVertex, uint32_t vertexCount);
+
+    std::shared_ptr<magma::Device> device;
+    const std::unique_ptr<magma::RenderPass>& renderPass;
+    const std::unique_ptr<magma::PipelineCache>& pipelineCache;
+    const char *vertexShaderFileName;
+    const char *fragmentShaderFileName;
+    std::shared_ptr<magma::PipelineLayout> layout;
+    std::vector<PipelineEntry> pipelines;
+    std::vector<FrameSlot> frameSlots;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<Batch> batches;
+    magma::RasterizationState rasterizationState;
+    float lineWidth;
+    rapid::matrix transform;
+    rapid::float4 currentColor;
+    float currentPointSize;
+    Primitive primitive;
+    uint32_t firstVertex;
+    uint32_t primitiveCount;
+    bool insidePrimitive;
+};
@@ -0,0 +1,20 @@
+#pragma once
+#include "magma/magma.h"
+
+/* Device local buffer for indirect draw commands that are
+   written by compute shader (e.g. by GPU culling pass).
+   Transfer destination usage allows to reset draw parameters
+   with vkCmdUpdateBuffer()/vkCmdFillBuffer() before dispatch. */
+class IndirectStorageBuffer : public magma::Buffer
+{
+public:
+    explicit IndirectStorageBuffer(std::shared_ptr<magma::Device> device, VkDeviceSize size,
+        std::shared_ptr<magma::Allocator> allocator = nullptr):
+        magma::Buffer(std::move(device), size, 0, // flags
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            magma::Buffer::Initializer(),
+            magma::Sharing(),
+            std::move(allocator))
+    {}
+};
@@ -0,0 +1,249 @@
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#ifdef KTX2_ZSTD
+#include <zstd.h>
+#endif
+#include "ktx2Texture.h"
+#include "utilities.h"
+
+namespace
+{
+const uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+struct Header
+{
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    // Index
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct LevelIndex
+{
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Header) == 80, "invalid size of KTX2 header");
+static_assert(sizeof(LevelIndex) == 24, "invalid size of KTX2 level index");
+
+// Basic data format descriptor of RGBA float format with one sample per channel
+struct DataFormatDescriptor
+{
+    uint32_t totalSize;
+    uint32_t vendorIdDescriptorType;
+    uint32_t versionNumberBlockSize;
+    uint32_t colorModelPrimariesTransferFlags;
+    uint8_t texelBlockDimension[4];
+    uint8_t bytesPlane[8];
+    struct Sample
+    {
+        uint32_t bitOffsetLengthChannelType;
+        uint32_t samplePosition;
+        uint32_t sampleLower;
+        uint32_t sampleUpper;
+    } samples[4];
+};
+
+static_assert(sizeof(DataFormatDescriptor) == 92, "invalid size of KTX2 data format descriptor");
+} // namespace
+
+Ktx2Texture::Ktx2Texture(const std::string& filename):
+    file(filename, utilities::FileView::Access::Sequential),
+    size(0)
+{
+    if ((file.size() < sizeof(Header)) || memcmp(file.data(), identifier, sizeof(identifier)))
+        throw std::runtime_error("\"" + filename + "\" is not a KTX2 file");
+    Header header;
+    memcpy(&header, file.data(), sizeof(Header));
+    format = static_cast<VkFormat>(header.vkFormat);
+    width = header.pixelWidth;
+    height = std::max(header.pixelHeight, 1u);
+    layerCount = std::max(header.layerCount, 1u);
+    faceCount = header.faceCount;
+    array = header.layerCount > 0;
+    supercompression = static_cast<Supercompression>(header.supercompressionScheme);
+    if ((VK_FORMAT_UNDEFINED == format) || (Supercompression::BasisLZ == supercompression))
+        throw std::runtime_error("Basis Universal texture \"" + filename + "\" is not supported");
+    if (header.pixelDepth > 0)
+        throw std::runtime_error("volume texture \"" + filename + "\" is not supported");
+    if ((faceCount != 1 && faceCount != 6) || (array && 6 == faceCount))
+        throw std::runtime_error("invalid face count of texture \"" + filename + "\"");
+    switch (supercompression)
+    {
+    case Supercompression::None:
+        break;
+    case Supercompression::Zstandard:
+    #ifdef KTX2_ZSTD
+        break;
+    #else
+        throw std::runtime_error("Zstandard supercompression of \"" + filename + "\" is not enabled");
+    #endif
+    default:
+        throw std::runtime_error("unsupported supercompression of texture \"" + filename + "\"");
+    }
+    // Level index immediately follows the header, starting from the base level
+    const uint32_t levelCount = std::max(header.levelCount, 1u);
+    if (file.size() < sizeof(Header) + levelCount * sizeof(LevelIndex))
+        throw std::runtime_error("unexpected end of file \"" + filename + "\"");
+    const LevelIndex *levelIndex = reinterpret_cast<const LevelIndex *>(file.data() + sizeof(Header));
+    levels.reserve(levelCount);
+    for (uint32_t i = 0; i < levelCount; ++i)
+    {
+        Level level;
+        level.byteOffset = levelIndex[i].byteOffset;
+        level.byteLength = levelIndex[i].byteLength;
+        level.uncompressedByteLength = (Supercompression::None == supercompression) ?
+            levelIndex[i].byteLength : levelIndex[i].uncompressedByteLength;
+        if (level.byteOffset + level.byteLength > file.size())
+            throw std::runtime_error("unexpected end of file \"" + filename + "\"");
+        // Level sizes are multiples of texel block size
+        level.stagingOffset = size;
+        size += level.uncompressedByteLength;
+        levels.push_back(level);
+    }
+}
+
+std::unique_ptr<magma::ImageView> Ktx2Texture::upload(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    const std::unique_ptr<magma::SrcTransferBuffer>& buffer, VkDeviceSize bufferOffset, uint8_t *data) const
+{
+    inflate(data);
+    // Level contains images of all layers and faces, but mip chains are described layer by layer
+    magma::Mipmap mipMap;
+    mipMap.reserve(layerCount * faceCount * levels.size());
+    const uint32_t imageCount = layerCount * faceCount;
+    for (uint32_t image = 0; image < imageCount; ++image)
+    {
+        for (uint32_t i = 0; i < (uint32_t)levels.size(); ++i)
+        {
+            const Level& level = levels[i];
+            const VkDeviceSize imageSize = level.uncompressedByteLength / imageCount;
+            mipMap.emplace_back(
+                std::max(width >> i, 1u),
+                std::max(height >> i, 1u),
+                level.stagingOffset + image * imageSize);
+        }
+    }
+    // Upload texture data from buffer
+    const magma::Image::CopyLayout bufferLayout{bufferOffset, 0, 0};
+    std::unique_ptr<magma::Image> image;
+    if (array)
+        image = std::make_unique<magma::Image2DArray>(cmdBuffer, format, layerCount, buffer, mipMap, bufferLayout);
+    else if (6 == faceCount)
+        image = std::make_unique<magma::ImageCube>(cmdBuffer, format, buffer, mipMap, bufferLayout);
+    else
+        image = std::make_unique<magma::Image2D>(cmdBuffer, format, buffer, mipMap, bufferLayout);
+    return std::make_unique<magma::UniqueImageView>(std::move(image));
+}
+
+void Ktx2Texture::save(const std::string& filename, VkFormat format,
+    uint32_t width, uint32_t height, uint32_t faceCount,
+    const std::vector<VkDeviceSize>& levelSizes, const uint8_t *data)
+{
+    uint32_t channelSize;
+    switch (format)
+    {
+    case VK_FORMAT_R16G16B16A16_SFLOAT: channelSize = 2; break;
+    case VK_FORMAT_R32G32B32A32_SFLOAT: channelSize = 4; break;
+    default:
+        throw std::runtime_error("unsupported format of KTX2 texture \"" + filename + "\"");
+    }
+    constexpr uint32_t channelIds[4] = {0, 1, 2, 15}; // R, G, B, A
+    constexpr uint32_t qualifierFloatSigned = 0x80 | 0x40;
+    DataFormatDescriptor dfd = {};
+    dfd.totalSize = sizeof(DataFormatDescriptor);
+    dfd.versionNumberBlockSize = 2 | ((sizeof(DataFormatDescriptor) - sizeof(uint32_t)) << 16);
+    dfd.colorModelPrimariesTransferFlags = 1 | (1 << 8) | (1 << 16); // RGBSDA, BT.709, linear
+    dfd.bytesPlane[0] = static_cast<uint8_t>(channelSize * 4);
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        DataFormatDescriptor::Sample& sample = dfd.samples[i];
+        sample.bitOffsetLengthChannelType = (i * channelSize * 8) | ((channelSize * 8 - 1) << 16) |
+            ((channelIds[i] | qualifierFloatSigned) << 24);
+        sample.sampleLower = 0xBF800000; // -1.0f
+        sample.sampleUpper = 0x3F800000; // 1.0f
+    }
+    const uint32_t levelCount = (uint32_t)levelSizes.size();
+    Header header = {};
+    memcpy(header.identifier, identifier, sizeof(identifier));
+    header.vkFormat = format;
+    header.typeSize = channelSize;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.faceCount = faceCount;
+    header.levelCount = levelCount;
+    header.dfdByteOffset = sizeof(Header) + levelCount * sizeof(LevelIndex);
+    header.dfdByteLength = sizeof(DataFormatDescriptor);
+    // Levels are stored from the smallest one, each aligned to texel size
+    const VkDeviceSize alignment = channelSize * 4;
+    std::vector<LevelIndex> levelIndex(levelCount);
+    std::vector<VkDeviceSize> srcOffsets(levelCount);
+    VkDeviceSize srcOffset = 0;
+    for (uint32_t i = 0; i < levelCount; ++i)
+    {
+        srcOffsets[i] = srcOffset;
+        srcOffset += levelSizes[i];
+    }
+    VkDeviceSize offset = header.dfdByteOffset + header.dfdByteLength;
+    for (uint32_t i = levelCount; i-- > 0;)
+    {
+        offset = (offset + alignment - 1) & ~(alignment - 1);
+        levelIndex[i].byteOffset = offset;
+        levelIndex[i].byteLength = levelSizes[i];
+        levelIndex[i].uncompressedByteLength = levelSizes[i];
+        offset += levelSizes[i];
+    }
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("failed to create file \"" + filename + "\"");
+    file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    file.write(reinterpret_cast<const char *>(levelIndex.data()), levelCount * sizeof(LevelIndex));
+    file.write(reinterpret_cast<const char *>(&dfd), sizeof(DataFormatDescriptor));
+    for (uint32_t i = levelCount; i-- > 0;)
+    {
+        const char padding[16] = {};
+        const VkDeviceSize position = static_cast<VkDeviceSize>(file.tellp());
+        file.write(padding, static_cast<std::streamsize>(levelIndex[i].byteOffset - position));
+        file.write(reinterpret_cast<const char *>(data + srcOffsets[i]), static_cast<std::streamsize>(levelSizes[i]));
+    }
+    if (!file)
+        throw std::runtime_error("failed to write file \"" + filename + "\"");
+}
+
+void Ktx2Texture::inflate(uint8_t *data) const
+{   // Base level is the largest one, so it is taken first
+    utilities::parallelFor((uint32_t)levels.size(),
+        [this, data](uint32_t i)
+        {
+            const Level& level = levels[i];
+            const uint8_t *src = file.data() + level.byteOffset;
+            uint8_t *dst = data + level.stagingOffset;
+        #ifdef KTX2_ZSTD
+            if (Supercompression::Zstandard == supercompression)
+            {
+                const size_t length = ZSTD_decompress(dst, static_cast<size_t>(level.uncompressedByteLength),
+                    src, static_cast<size_t>(level.byteLength));
+                if (ZSTD_isError(length) || (length != level.uncompressedByteLength))
+                    throw std::runtime_error("failed to inflate KTX2 texture");
+                return;
+            }
+        #endif // KTX2_ZSTD
+            memcpy(dst, src, static_cast<size_t>(level.byteLength));
+        });
+}
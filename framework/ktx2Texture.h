@@ -0,0 +1,61 @@
+#pragma once
+#include "magma/magma.h"
+#include "fileView.h"
+
+/* Loader of KTX 2.0 container with block compressed (BC1-BC7) texture.
+   Mip levels may be supercompressed with Zstandard, which shrinks BC
+   data on disk by about a half. Levels are inflated in parallel by
+   worker threads right into mapped staging memory (sub-allocation
+   of staging ring or dedicated buffer, if texture doesn't fit into
+   the ring), so there is no heap copy in between. Zstandard support requires to build with KTX2_ZSTD
+   defined (make ZSTD=1). BasisLZ and UASTC payloads need Basis
+   Universal transcoder, that isn't part of the framework, so
+   such textures are rejected. Uncompressed float textures can be
+   saved as KTX2 (e.g. to cache results of GPU processing). */
+class Ktx2Texture
+{
+public:
+    explicit Ktx2Texture(const std::string& filename);
+    std::unique_ptr<magma::ImageView> upload(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        const std::unique_ptr<magma::SrcTransferBuffer>& buffer,
+        VkDeviceSize bufferOffset,
+        uint8_t *data) const; // Mapped at bufferOffset, getSize() bytes
+    VkFormat getFormat() const noexcept { return format; }
+    uint32_t getWidth() const noexcept { return width; }
+    uint32_t getHeight() const noexcept { return height; }
+    uint32_t getLayerCount() const noexcept { return layerCount; }
+    uint32_t getFaceCount() const noexcept { return faceCount; }
+    uint32_t getMipLevels() const noexcept { return (uint32_t)levels.size(); }
+    VkDeviceSize getSize() const noexcept { return size; } // Inflated
+    static void save(const std::string& filename, VkFormat format,
+        uint32_t width, uint32_t height, uint32_t faceCount,
+        const std::vector<VkDeviceSize>& levelSizes, // Base level first
+        const uint8_t *data); // Levels follow each other, faces of level too
+
+private:
+    enum Supercompression : uint32_t
+    {
+        None = 0, BasisLZ, Zstandard, Zlib
+    };
+
+    struct Level
+    {
+        VkDeviceSize byteOffset; // In file
+        VkDeviceSize byteLength;
+        VkDeviceSize uncompressedByteLength;
+        VkDeviceSize stagingOffset;
+    };
+
+    void inflate(uint8_t *data) const;
+
+    utilities::FileView file;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    bool array;
+    Supercompression supercompression;
+    std::vector<Level> levels;
+    VkDeviceSize size;
+};
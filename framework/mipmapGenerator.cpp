@@ -0,0 +1,182 @@
+#include <algorithm>
+#include "mipmapGenerator.h"
+#include "computePipeline.h"
+
+constexpr uint32_t workgroupSize = 8;
+
+MipmapGenerator::MipmapGenerator(std::shared_ptr<magma::Device> device,
+    std::shared_ptr<magma::Image> image,
+    const std::unique_ptr<magma::PipelineCache>& pipelineCache /* nullptr */,
+    const char *downsampleShaderFileName /* nullptr */,
+    bool preferCompute /* false */):
+    device(std::move(device)),
+    image(std::move(image)),
+    method(Method::Blit)
+{
+    const std::shared_ptr<magma::PhysicalDevice> physicalDevice = this->device->getPhysicalDevice();
+    const VkFormatProperties properties = physicalDevice->getFormatProperties(this->image->getFormat());
+    constexpr VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    const bool blitSupported = (properties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+    // Storage image is written without format qualifier, so that one shader fits any format
+    const bool computeSupported = downsampleShaderFileName &&
+        (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) &&
+        (this->image->getUsage() & VK_IMAGE_USAGE_STORAGE_BIT) &&
+        (1 == this->image->getArrayLayers()) &&
+        physicalDevice->getFeatures().shaderStorageImageWriteWithoutFormat;
+    if (computeSupported && (preferCompute || !blitSupported))
+    {
+        method = Method::Compute;
+        setupDownsample(pipelineCache, downsampleShaderFileName);
+    }
+    else if (!blitSupported)
+        throw std::runtime_error("format of image doesn't support mipmap generation");
+}
+
+void MipmapGenerator::generate(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    VkImageLayout baseLevelLayout /* VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL */,
+    VkPipelineStageFlags srcStageMask /* VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT */,
+    VkAccessFlags srcAccessMask /* VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT */,
+    VkPipelineStageFlags dstStageMask /* VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT */) const
+{
+    if (image->getMipLevels() < 2)
+        return;
+    if (Method::Blit == method)
+        blitLevels(cmdBuffer, baseLevelLayout, srcStageMask, srcAccessMask, dstStageMask);
+    else
+        downsampleLevels(cmdBuffer, baseLevelLayout, srcStageMask, srcAccessMask, dstStageMask);
+}
+
+uint32_t MipmapGenerator::fullMipChainLevels(const VkExtent2D& extent) noexcept
+{
+    uint32_t levelCount = 1;
+    for (uint32_t size = std::max(extent.width, extent.height); size > 1; size >>= 1)
+        ++levelCount;
+    return levelCount;
+}
+
+void MipmapGenerator::setupDownsample(const std::unique_ptr<magma::PipelineCache>& pipelineCache,
+    const char *shaderFileName)
+{
+    const uint32_t mipLevels = image->getMipLevels();
+    for (uint32_t level = 0; level < mipLevels; ++level)
+        levelViews.push_back(std::make_shared<magma::SharedImageView>(image, level, 1));
+    // Point sampling, as shader fetches texels of the previous level
+    nearestSampler = std::make_unique<magma::Sampler>(device, magma::sampler::magMinMipNearestClampToEdge);
+    const uint32_t maxDescriptorSets = mipLevels - 1;
+    descriptorPool = std::make_shared<magma::DescriptorPool>(device, maxDescriptorSets,
+        std::initializer_list<VkDescriptorPoolSize>{
+            magma::descriptor::CombinedImageSamplerPoolSize(maxDescriptorSets),
+            magma::descriptor::StorageImagePoolSize(maxDescriptorSets)
+        });
+    for (uint32_t level = 1; level < mipLevels; ++level)
+    {   // Descriptor set refers to its table, so tables aren't moved
+        setTables.push_back(std::make_unique<DescriptorSetTable>());
+        DescriptorSetTable& setTable = *setTables.back();
+        setTable.srcLevel = {levelViews[level - 1], nearestSampler};
+        setTable.dstLevel = levelViews[level];
+        descriptorSets.push_back(std::make_unique<magma::DescriptorSet>(descriptorPool,
+            setTable, VK_SHADER_STAGE_COMPUTE_BIT));
+    }
+    auto layout = std::make_unique<magma::PipelineLayout>(descriptorSets.front()->getLayout());
+    downsamplePipeline = std::make_unique<ComputePipeline>(device,
+        shaderFileName, std::move(layout), pipelineCache);
+}
+
+void MipmapGenerator::blitLevels(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    VkImageLayout baseLevelLayout, VkPipelineStageFlags srcStageMask,
+    VkAccessFlags srcAccessMask, VkPipelineStageFlags dstStageMask) const
+{
+    const VkCommandBuffer commandBuffer = cmdBuffer->getHandle();
+    const uint32_t mipLevels = image->getMipLevels();
+    /* Base level becomes blit source; contents of other levels are discarded,
+       but they could still be sampled by the previous submission. */
+    const VkImageMemoryBarrier barriers[2] = {
+        levelBarrier(0, 1, baseLevelLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            srcAccessMask, VK_ACCESS_TRANSFER_READ_BIT),
+        levelBarrier(1, mipLevels - 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT)
+    };
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask | dstStageMask, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 2, barriers);
+    int32_t width = static_cast<int32_t>(image->getWidth());
+    int32_t height = static_cast<int32_t>(image->getHeight());
+    for (uint32_t level = 1; level < mipLevels; ++level)
+    {
+        VkImageBlit region;
+        region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, image->getArrayLayers()};
+        region.srcOffsets[0] = {0, 0, 0};
+        region.srcOffsets[1] = {width, height, 1};
+        width = std::max(width >> 1, 1);
+        height = std::max(height >> 1, 1);
+        region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, image->getArrayLayers()};
+        region.dstOffsets[0] = {0, 0, 0};
+        region.dstOffsets[1] = {width, height, 1};
+        vkCmdBlitImage(commandBuffer,
+            image->getHandle(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            image->getHandle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &region, VK_FILTER_LINEAR);
+        // Blitted level becomes source of the next one
+        const VkImageMemoryBarrier barrier = levelBarrier(level, 1,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    const VkImageMemoryBarrier barrier = levelBarrier(0, mipLevels,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask,
+        0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void MipmapGenerator::downsampleLevels(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    VkImageLayout baseLevelLayout, VkPipelineStageFlags srcStageMask,
+    VkAccessFlags srcAccessMask, VkPipelineStageFlags dstStageMask) const
+{
+    const VkCommandBuffer commandBuffer = cmdBuffer->getHandle();
+    const uint32_t mipLevels = image->getMipLevels();
+    const VkImageMemoryBarrier barriers[2] = {
+        levelBarrier(0, 1, baseLevelLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            srcAccessMask, VK_ACCESS_SHADER_READ_BIT),
+        levelBarrier(1, mipLevels - 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            0, VK_ACCESS_SHADER_WRITE_BIT)
+    };
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask | dstStageMask, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | dstStageMask,
+        0, 0, nullptr, 0, nullptr, 2, barriers);
+    cmdBuffer->bindPipeline(downsamplePipeline);
+    uint32_t width = image->getWidth();
+    uint32_t height = image->getHeight();
+    for (uint32_t level = 1; level < mipLevels; ++level)
+    {
+        width = std::max(width >> 1, 1u);
+        height = std::max(height >> 1, 1u);
+        cmdBuffer->bindDescriptorSet(downsamplePipeline, 0, descriptorSets[level - 1]);
+        cmdBuffer->dispatch((width + workgroupSize - 1) / workgroupSize, (height + workgroupSize - 1) / workgroupSize, 1);
+        // Written level becomes source of the next one
+        const VkImageMemoryBarrier barrier = levelBarrier(level, 1,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | dstStageMask,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+}
+
+VkImageMemoryBarrier MipmapGenerator::levelBarrier(uint32_t baseLevel, uint32_t levelCount,
+    VkImageLayout oldLayout, VkImageLayout newLayout,
+    VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) const noexcept
+{
+    VkImageMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image->getHandle();
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levelCount, 0, image->getArrayLayers()};
+    return barrier;
+}
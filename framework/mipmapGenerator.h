@@ -0,0 +1,63 @@
+#pragma once
+#include "magma/magma.h"
+
+/* Generates mip chain of 2D image on GPU, so that render targets and
+   images created at runtime get mip levels without CPU work. If format
+   supports linear filtering of blit source, each level is blitted from
+   the previous one, all array layers (or cube faces) at once. Otherwise,
+   levels are downsampled by compute shader (box filter, one dispatch per
+   level), that requires single-layer image with storage usage. Compute shader is provided by the sample: it reads previous level
+   from combined image sampler at binding 0 and writes next level to storage
+   image at binding 1. Views and descriptor sets of levels are created once,
+   so generate() can be recorded into command buffer that is submitted every
+   frame. When generation finishes, all levels are in shader read-only layout. */
+class MipmapGenerator
+{
+public:
+    enum class Method : uint8_t
+    {
+        Blit, Compute
+    };
+
+    explicit MipmapGenerator(std::shared_ptr<magma::Device> device,
+        std::shared_ptr<magma::Image> image,
+        const std::unique_ptr<magma::PipelineCache>& pipelineCache = nullptr,
+        const char *downsampleShaderFileName = nullptr, // Compute fallback
+        bool preferCompute = false);
+    void generate(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        VkImageLayout baseLevelLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VkPipelineStageFlags srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, // Stage that wrote base level
+        VkAccessFlags srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT) const; // Stage that samples mip chain
+    Method getMethod() const noexcept { return method; }
+    static uint32_t fullMipChainLevels(const VkExtent2D& extent) noexcept;
+
+private:
+    struct DescriptorSetTable
+    {
+        magma::descriptor::CombinedImageSampler srcLevel = 0;
+        magma::descriptor::StorageImage dstLevel = 1;
+    };
+
+    void setupDownsample(const std::unique_ptr<magma::PipelineCache>& pipelineCache,
+        const char *shaderFileName);
+    void blitLevels(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        VkImageLayout baseLevelLayout, VkPipelineStageFlags srcStageMask,
+        VkAccessFlags srcAccessMask, VkPipelineStageFlags dstStageMask) const;
+    void downsampleLevels(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        VkImageLayout baseLevelLayout, VkPipelineStageFlags srcStageMask,
+        VkAccessFlags srcAccessMask, VkPipelineStageFlags dstStageMask) const;
+    VkImageMemoryBarrier levelBarrier(uint32_t baseLevel, uint32_t levelCount,
+        VkImageLayout oldLayout, VkImageLayout newLayout,
+        VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) const noexcept;
+
+    std::shared_ptr<magma::Device> device;
+    std::shared_ptr<magma::Image> image;
+    std::vector<std::shared_ptr<magma::ImageView>> levelViews;
+    std::vector<std::unique_ptr<DescriptorSetTable>> setTables;
+    std::shared_ptr<magma::DescriptorPool> descriptorPool;
+    std::vector<std::unique_ptr<magma::DescriptorSet>> descriptorSets;
+    std::unique_ptr<magma::Sampler> nearestSampler;
+    std::unique_ptr<magma::ComputePipeline> downsamplePipeline;
+    Method method;
+};
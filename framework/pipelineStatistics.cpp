@@ -0,0 +1,76 @@
+#include "pipelineStatistics.h"
+
+// Counters are written by implementation in the order of flag bits
+constexpr VkQueryPipelineStatisticFlags statisticFlags =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+PipelineStatistics::PipelineStatistics(std::shared_ptr<magma::Device> device, uint32_t bufferCount):
+    device(std::move(device)),
+    submitFrames(bufferCount, NotSubmitted),
+    frame(NotSubmitted)
+{
+    for (uint32_t i = 0; i < bufferCount; ++i)
+        queryPools.push_back(std::make_unique<magma::PipelineStatisticsQuery>(this->device, statisticFlags));
+}
+
+bool PipelineStatistics::supported(std::shared_ptr<const magma::PhysicalDevice> physicalDevice)
+{
+    return physicalDevice->getFeatures().pipelineStatisticsQuery;
+}
+
+void PipelineStatistics::begin(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t bufferIndex)
+{   // Query is reset by the command buffer that uses it
+    cmdBuffer->resetQueryPool(queryPools[bufferIndex], 0, 1);
+    cmdBuffer->beginQuery(queryPools[bufferIndex], 0);
+}
+
+void PipelineStatistics::end(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t bufferIndex)
+{
+    cmdBuffer->endQuery(queryPools[bufferIndex], 0);
+}
+
+void PipelineStatistics::submitted(uint32_t bufferIndex, uint32_t frame)
+{
+    submitFrames[bufferIndex] = frame;
+}
+
+bool PipelineStatistics::resolve()
+{   /* Poll each query pool in flight without waiting.
+       Counters of the most recent frame win. */
+    bool newResult = false;
+    for (uint32_t i = 0; i < (uint32_t)queryPools.size(); ++i)
+    {
+        if (NotSubmitted == submitFrames[i])
+            continue;
+        // Six counters followed by availability
+        const magma::QueryPool::Result<Counters, uint64_t> result =
+            queryPools[i]->getResultsWithAvailability<Counters>(0, 1).front();
+        if (!result.availability)
+            continue; // Not ready
+        const uint32_t submitFrame = submitFrames[i];
+        submitFrames[i] = NotSubmitted;
+        if ((NotSubmitted == frame) || (submitFrame > frame))
+        {
+            counters = result.result;
+            frame = submitFrame;
+            newResult = true;
+        }
+    }
+    return newResult;
+}
+
+std::ostream& operator<<(std::ostream& os, const PipelineStatistics::Counters& counters)
+{
+    os << "IA vertices: " << counters.inputAssemblyVertices
+        << ", IA primitives: " << counters.inputAssemblyPrimitives
+        << ", VS invocations: " << counters.vertexShaderInvocations
+        << ", clipping invocations: " << counters.clippingInvocations
+        << ", clipping primitives: " << counters.clippingPrimitives
+        << ", FS invocations: " << counters.fragmentShaderInvocations;
+    return os;
+}
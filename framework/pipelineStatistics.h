@@ -0,0 +1,40 @@
+#pragma once
+#include <ostream>
+#include "magma/magma.h"
+
+/* Opt-in collector of pipeline statistics. Begin and end should be
+   recorded around the main render pass of a sample. There is a query pool
+   per command buffer, so recording doesn't reset results in flight.
+   Results are polled without waiting, hence they lag a few frames behind. */
+class PipelineStatistics
+{
+public:
+    struct Counters
+    {
+        uint64_t inputAssemblyVertices = 0;
+        uint64_t inputAssemblyPrimitives = 0;
+        uint64_t vertexShaderInvocations = 0;
+        uint64_t clippingInvocations = 0;
+        uint64_t clippingPrimitives = 0;
+        uint64_t fragmentShaderInvocations = 0;
+    };
+
+    explicit PipelineStatistics(std::shared_ptr<magma::Device> device, uint32_t bufferCount);
+    static bool supported(std::shared_ptr<const magma::PhysicalDevice> physicalDevice);
+    void begin(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t bufferIndex);
+    void end(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer, uint32_t bufferIndex);
+    void submitted(uint32_t bufferIndex, uint32_t frame);
+    bool resolve();
+    const Counters& getCounters() const noexcept { return counters; }
+    uint32_t getFrame() const noexcept { return frame; }
+
+private:
+    static constexpr uint32_t NotSubmitted = ~0u;
+    std::shared_ptr<magma::Device> device;
+    std::vector<std::unique_ptr<magma::PipelineStatisticsQuery>> queryPools;
+    std::vector<uint32_t> submitFrames;
+    Counters counters;
+    uint32_t frame;
+};
+
+std::ostream& operator<<(std::ostream& os, const PipelineStatistics::Counters& counters);
@@ -0,0 +1,84 @@
+#include <cstring>
+#include "progressiveTexture.h"
+#include "utilities.h"
+
+ProgressiveTexture::ProgressiveTexture(std::shared_ptr<magma::Device> device,
+    const std::string& filename,
+    std::shared_ptr<StagingRing> stagingRing,
+    const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    VkDeviceSize tailSize /* 16 * 1024 */):
+    device(std::move(device)),
+    stagingRing(std::move(stagingRing)),
+    file(filename)
+{   // Parse DDS header right in the mapped file
+    ctx.enable_dxt(true);
+    if (!ctx.load(file.data(), static_cast<unsigned>(file.size())))
+        throw std::runtime_error("failed to load DDS texture");
+    const uint32_t mipLevels = static_cast<uint32_t>(ctx.num_mipmaps(0));
+    const VkExtent2D extent = {
+        static_cast<uint32_t>(ctx.image_width(0, 0)),
+        static_cast<uint32_t>(ctx.image_height(0, 0))
+    };
+    const VkFormat format = utilities::getBlockCompressedFormat(ctx);
+    image = std::make_shared<magma::Image2D>(this->device, format, extent, mipLevels);
+    // Mip tail includes the smallest level at least
+    residentLevel = mipLevels - 1;
+    VkDeviceSize size = ctx.image_size(0, residentLevel);
+    while (residentLevel > 0 && (size + ctx.image_size(0, residentLevel - 1) <= tailSize))
+        size += ctx.image_size(0, --residentLevel);
+    copyLevels(cmdBuffer, residentLevel, mipLevels - residentLevel);
+}
+
+bool ProgressiveTexture::update(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+{
+    if (resident())
+    {   // Command buffer of the last level has been completed
+        buffer.reset();
+        return false;
+    }
+    copyLevels(cmdBuffer, residentLevel - 1, 1);
+    if (0 == --residentLevel)
+        file.unmap(); // Everything has been copied to staging ring
+    return true;
+}
+
+void ProgressiveTexture::copyLevels(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    uint32_t baseLevel, uint32_t levelCount)
+{   // Levels follow each other in DDS file, so they are copied to staging ring at once
+    const uint8_t *baseMipData = (const uint8_t *)ctx.image_data(0, baseLevel);
+    VkDeviceSize size = 0;
+    for (uint32_t level = baseLevel; level < baseLevel + levelCount; ++level)
+        size += ctx.image_size(0, level);
+    VkDeviceSize bufferOffset = 0;
+    uint8_t *data;
+    if (size <= stagingRing->getChunkSize())
+    {   // Leave space for another uploads in flight
+        const StagingRing::Allocation staging = stagingRing->allocate(size, cmdBuffer);
+        bufferOffset = staging.offset;
+        data = staging.data;
+        buffer.reset();
+    }
+    else
+    {   // If level doesn't fit into staging ring
+        buffer = std::make_unique<magma::SrcTransferBuffer>(device, size);
+        data = reinterpret_cast<uint8_t *>(buffer->getMemory()->map());
+    }
+    memcpy(data, baseMipData, static_cast<size_t>(size));
+    std::vector<VkBufferImageCopy> regions;
+    for (uint32_t level = baseLevel; level < baseLevel + levelCount; ++level)
+    {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = bufferOffset + ((const uint8_t *)ctx.image_data(0, level) - baseMipData);
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        region.imageExtent.width = static_cast<uint32_t>(ctx.image_width(0, level));
+        region.imageExtent.height = static_cast<uint32_t>(ctx.image_height(0, level));
+        region.imageExtent.depth = 1;
+        regions.push_back(region);
+    }
+    // Contents of resident levels are preserved by layout transitions
+    image->layoutTransition(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cmdBuffer);
+    const std::unique_ptr<magma::SrcTransferBuffer>& srcBuffer = buffer ? buffer : stagingRing->getBuffer();
+    vkCmdCopyBufferToImage(cmdBuffer->getHandle(), srcBuffer->getHandle(), image->getHandle(),
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+    image->layoutTransition(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, cmdBuffer);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "magma/magma.h"
+#include "fileView.h"
+#include "stagingRing.h"
+#include "gliml/gliml.h"
+
+/* DDS texture that is usable before all of its mip levels are uploaded.
+   Image is created with the full mip chain, but only the mip tail (the
+   smallest levels that fit into tailSize) is copied at load time, so time
+   to the first frame doesn't depend on texture size. Each update() copies
+   the next larger level. Levels below getMinLod() are undefined, so
+   sampling should be clamped to it, either by the sampler or in shader.
+   Levels larger than chunk of the staging ring are copied through
+   dedicated buffer, that is kept until the next update(), so command
+   buffer should be completed by then. Once texture is resident, either
+   the next update() or releaseStagingBuffer() releases it. */
+class ProgressiveTexture
+{
+public:
+    explicit ProgressiveTexture(std::shared_ptr<magma::Device> device,
+        const std::string& filename,
+        std::shared_ptr<StagingRing> stagingRing,
+        const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        VkDeviceSize tailSize = 16 * 1024);
+    bool update(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer);
+    const std::shared_ptr<magma::Image>& getImage() const noexcept { return image; }
+    float getMinLod() const noexcept { return static_cast<float>(residentLevel); }
+    bool resident() const noexcept { return 0 == residentLevel; }
+    void releaseStagingBuffer() noexcept { buffer.reset(); } // When the last update() has been completed
+
+private:
+    void copyLevels(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        uint32_t baseLevel, uint32_t levelCount);
+
+    std::shared_ptr<magma::Device> device;
+    std::shared_ptr<StagingRing> stagingRing;
+    utilities::FileView file;
+    gliml::context ctx; // Points to the file data
+    std::shared_ptr<magma::Image> image;
+    std::unique_ptr<magma::SrcTransferBuffer> buffer;
+    uint32_t residentLevel;
+};
@@ -0,0 +1,185 @@
+#include <stdexcept>
+#include "stagingRing.h"
+
+StagingRing::StagingRing(std::shared_ptr<magma::Device> device,
+    VkDeviceSize size /* 4 * 1024 * 1024 */):
+    device(std::move(device)),
+    data(nullptr),
+    size(size),
+    head(0),
+    submitSerial(0),
+    finishedSerial(0)
+{
+    const VkPhysicalDeviceProperties properties = this->device->getPhysicalDevice()->getProperties();
+    constexpr VkDeviceSize maxTexelBlockSize = 16; // BC2, BC3
+    alignment = std::max(properties.limits.optimalBufferCopyOffsetAlignment, maxTexelBlockSize);
+    chunkSize = (size/4) & ~(alignment - 1);
+    buffer = std::make_unique<magma::SrcTransferBuffer>(this->device, size);
+    // Memory stays mapped until buffer is destroyed
+    data = reinterpret_cast<uint8_t *>(buffer->getMemory()->map());
+}
+
+StagingRing::~StagingRing()
+{
+    wait();
+}
+
+StagingRing::Allocation StagingRing::allocate(VkDeviceSize size,
+    const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    const std::atomic<bool> *cancel /* nullptr */)
+{
+    MAGMA_ASSERT(size > 0);
+    if (size > this->size)
+        throw std::length_error("staging allocation exceeds size of the ring");
+    std::unique_lock<std::mutex> lock(mtx);
+    VkDeviceSize offset;
+    for (;;)
+    {
+        reclaim();
+        if (tryAllocate(size, offset))
+            break;
+        if (!submissions.empty())
+        {   // Wait for the oldest upload to complete
+            submissions.front().fence->wait();
+            continue;
+        }
+        // Ring is occupied by commands that are not submitted yet
+        if (std::none_of(regions.begin(), regions.end(),
+            [&cmdBuffer](const Region& region)
+            {   // Another thread will submit it
+                return region.owner && (region.owner != cmdBuffer.get()) && !region.serial;
+            }))
+            throw std::length_error("staging ring is filled by single command buffer");
+        if (cancel && *cancel)
+            throw std::runtime_error("staging allocation has been canceled");
+        submitCondition.wait(lock);
+    }
+    regions.push_back({offset, offset + size, cmdBuffer.get(), 0});
+    head = offset + size;
+    return {offset, data + offset};
+}
+
+void StagingRing::release(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (Region& region: regions)
+        {
+            if ((region.owner == cmdBuffer.get()) && !region.serial)
+                region.owner = nullptr;
+        }
+        reclaim();
+    }
+    submitCondition.notify_all();
+}
+
+void StagingRing::interrupt()
+{   // Lock ensures that allocation either checks the flag or already waits
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+    }
+    submitCondition.notify_all();
+}
+
+uint64_t StagingRing::submit(const std::shared_ptr<magma::Queue>& queue,
+    const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    bool wait /* false */)
+{
+    uint64_t serial;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::unique_ptr<magma::Fence> fence;
+        if (freeFences.empty())
+            fence = std::make_unique<magma::Fence>(device);
+        else
+        {
+            fence = std::move(freeFences.back());
+            freeFences.pop_back();
+        }
+        queue->submit(cmdBuffer, 0, nullptr, nullptr, fence);
+        serial = ++submitSerial;
+        for (Region& region: regions)
+        {   // Bind pending allocations to this submission
+            if ((region.owner == cmdBuffer.get()) && !region.serial)
+                region.serial = serial;
+        }
+        submissions.push_back({serial, std::move(fence)});
+        if (wait)
+        {
+            submissions.back().fence->wait();
+            reclaim();
+        }
+    }
+    submitCondition.notify_all();
+    return serial;
+}
+
+bool StagingRing::finished(uint64_t serial)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    reclaim();
+    return serial <= finishedSerial;
+}
+
+void StagingRing::wait(uint64_t serial /* std::numeric_limits<uint64_t>::max() */)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    while (!submissions.empty() && (submissions.front().serial <= serial))
+    {
+        submissions.front().fence->wait();
+        reclaim();
+    }
+}
+
+bool StagingRing::tryAllocate(VkDeviceSize size, VkDeviceSize& offset) const noexcept
+{
+    if (regions.empty())
+    {
+        offset = 0;
+        return true;
+    }
+    // Live regions are placed from tail to head, wrapping around
+    const VkDeviceSize tail = regions.front().begin;
+    const VkDeviceSize alignedHead = (head + alignment - 1) & ~(alignment - 1);
+    if (head > tail)
+    {
+        if (alignedHead + size <= this->size)
+        {
+            offset = alignedHead;
+            return true;
+        }
+        if (size <= tail)
+        {   // Wrap around
+            offset = 0;
+            return true;
+        }
+    }
+    else if ((head < tail) && (alignedHead + size <= tail))
+    {
+        offset = alignedHead;
+        return true;
+    }
+    return false;
+}
+
+void StagingRing::reclaim()
+{   // Fences are signaled in submission order
+    while (!submissions.empty() &&
+        (VK_SUCCESS == vkGetFenceStatus(device->getHandle(), submissions.front().fence->getHandle())))
+    {
+        Submission& submission = submissions.front();
+        finishedSerial = submission.serial;
+        submission.fence->reset();
+        freeFences.push_back(std::move(submission.fence));
+        submissions.pop_front();
+    }
+    while (!regions.empty())
+    {
+        const Region& region = regions.front();
+        if (region.owner && !(region.serial && (region.serial <= finishedSerial)))
+            break;
+        regions.pop_front();
+    }
+    if (regions.empty())
+        head = 0;
+}
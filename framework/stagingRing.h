@@ -0,0 +1,117 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include "magma/magma.h"
+
+/* Ring of persistently mapped host memory that all staging uploads
+   are sub-allocated from, instead of creating transfer buffer per load.
+   Sub-allocation is owned by the command buffer that reads it; when
+   this command buffer is submitted through the ring, sub-allocation is
+   bound to the fence of submission and reclaimed once fence is signaled.
+   Offsets are aligned to optimalBufferCopyOffsetAlignment (and to the
+   largest texel block size, as required by buffer-to-image copies).
+   If the ring is full, allocation waits for the oldest submission.
+   Ring is thread-safe, so loaders may fill it from worker threads.
+   Allocation that waits for another thread to submit its commands
+   may be canceled by flag, that is checked when interrupt() is called. */
+class StagingRing
+{
+public:
+    struct Allocation
+    {
+        VkDeviceSize offset;
+        uint8_t *data;
+    };
+
+    explicit StagingRing(std::shared_ptr<magma::Device> device,
+        VkDeviceSize size = 4 * 1024 * 1024);
+    ~StagingRing();
+    Allocation allocate(VkDeviceSize size,
+        const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        const std::atomic<bool> *cancel = nullptr);
+    void interrupt(); // Wakes up allocations to check their cancel flags
+    void release(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer); // Allocations of command buffer that won't be submitted
+    uint64_t submit(const std::shared_ptr<magma::Queue>& queue,
+        const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        bool wait = false);
+    bool finished(uint64_t serial);
+    void wait(uint64_t serial = std::numeric_limits<uint64_t>::max());
+    template<class Buffer>
+    void copyBuffer(const std::shared_ptr<magma::Queue>& queue,
+        const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        const void *srcData,
+        const Buffer& dstBuffer,
+        VkDeviceSize size,
+        VkDeviceSize dstOffset = 0);
+    const std::unique_ptr<magma::SrcTransferBuffer>& getBuffer() const noexcept { return buffer; }
+    VkDeviceSize getSize() const noexcept { return size; }
+    VkDeviceSize getAlignment() const noexcept { return alignment; }
+    VkDeviceSize getChunkSize() const noexcept { return chunkSize; }
+
+private:
+    struct Region
+    {
+        VkDeviceSize begin;
+        VkDeviceSize end;
+        const magma::CommandBuffer *owner; // nullptr if released
+        uint64_t serial; // Zero until owner is submitted
+    };
+
+    struct Submission
+    {
+        uint64_t serial;
+        std::unique_ptr<magma::Fence> fence;
+    };
+
+    bool tryAllocate(VkDeviceSize size, VkDeviceSize& offset) const noexcept;
+    void reclaim();
+
+    std::shared_ptr<magma::Device> device;
+    std::unique_ptr<magma::SrcTransferBuffer> buffer;
+    uint8_t *data;
+    const VkDeviceSize size;
+    VkDeviceSize alignment;
+    VkDeviceSize chunkSize;
+    VkDeviceSize head;
+    std::deque<Region> regions;
+    std::deque<Submission> submissions;
+    std::vector<std::unique_ptr<magma::Fence>> freeFences;
+    uint64_t submitSerial;
+    uint64_t finishedSerial;
+    std::mutex mtx;
+    std::condition_variable submitCondition;
+};
+
+/* Uploads data of any size in chunks of quarter of the ring.
+   Next chunk is copied to the ring while the previous one is
+   transferred, so peak staging memory doesn't depend on data size.
+   Returns when the last chunk is transferred. */
+template<class Buffer>
+inline void StagingRing::copyBuffer(const std::shared_ptr<magma::Queue>& queue,
+    const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    const void *srcData,
+    const Buffer& dstBuffer,
+    VkDeviceSize size,
+    VkDeviceSize dstOffset /* 0 */)
+{
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(srcData);
+    uint64_t serial = 0;
+    for (VkDeviceSize offset = 0; offset < size; offset += chunkSize)
+    {
+        const VkDeviceSize copySize = std::min(chunkSize, size - offset);
+        const Allocation chunk = allocate(copySize, cmdBuffer);
+        memcpy(chunk.data, src + offset, static_cast<std::size_t>(copySize));
+        if (serial)
+            wait(serial); // Command buffer can't be re-recorded while pending
+        cmdBuffer->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        cmdBuffer->copyBuffer(buffer, dstBuffer, chunk.offset, dstOffset + offset, copySize);
+        cmdBuffer->end();
+        serial = submit(queue, cmdBuffer);
+    }
+    wait(serial);
+}
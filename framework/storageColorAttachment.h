@@ -0,0 +1,27 @@
+#pragma once
+#include "magma/magma.h"
+
+/* Sampled color attachment with mip chain, which levels may also be
+   written by compute shader (e.g. to downsample render target instead
+   of blitting it). Transfer usage allows to blit mip chain as well,
+   so the same image fits either method of mipmap generation. */
+class StorageColorAttachment : public magma::Image
+{
+public:
+    explicit StorageColorAttachment(std::shared_ptr<magma::Device> device, VkFormat format,
+        const VkExtent2D& extent, uint32_t mipLevels,
+        std::shared_ptr<magma::Allocator> allocator = nullptr):
+        magma::Image(std::move(device), VK_IMAGE_TYPE_2D, format,
+            VkExtent3D{extent.width, extent.height, 1},
+            mipLevels,
+            1, // arrayLayers
+            1, // samples
+            VK_IMAGE_TILING_OPTIMAL,
+            0, // flags
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            magma::Image::Initializer(),
+            magma::Sharing(),
+            std::move(allocator))
+    {}
+};
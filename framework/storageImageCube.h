@@ -0,0 +1,27 @@
+#pragma once
+#include "magma/magma.h"
+
+/* Device local cube image with mip chain, which faces are written
+   by compute shader through per-level views (imageCube in GLSL).
+   Transfer usage allows to read results back to host (e.g. to cache
+   them on disk) and to blit mip chain from the base level. */
+class StorageImageCube : public magma::Image
+{
+public:
+    explicit StorageImageCube(std::shared_ptr<magma::Device> device, VkFormat format,
+        uint32_t dimension, uint32_t mipLevels,
+        std::shared_ptr<magma::Allocator> allocator = nullptr):
+        magma::Image(std::move(device), VK_IMAGE_TYPE_2D, format,
+            VkExtent3D{dimension, dimension, 1},
+            mipLevels,
+            6, // arrayLayers
+            1, // samples
+            VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            magma::Image::Initializer(),
+            magma::Sharing(),
+            std::move(allocator))
+    {}
+};
@@ -0,0 +1,353 @@
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include "textureStreamer.h"
+#include "utilities.h"
+
+TextureStreamer::TextureStreamer(std::shared_ptr<magma::Device> device,
+    std::shared_ptr<magma::Queue> queue,
+    std::shared_ptr<StagingRing> stagingRing,
+    uint32_t uploadCount /* 2 */):
+    device(std::move(device)),
+    queue(std::move(queue)),
+    stagingRing(std::move(stagingRing)),
+    uploads(uploadCount),
+    pendingCount(0),
+    stop(false)
+{
+    commandPool = std::make_unique<magma::CommandPool>(this->device, this->queue->getFamilyIndex());
+    auto cmdBuffers = commandPool->allocateCommandBuffers(VK_COMMAND_BUFFER_LEVEL_PRIMARY, uploadCount);
+    for (uint32_t i = 0; i < uploadCount; ++i)
+        uploads[i].cmdBuffer = cmdBuffers[i];
+    loaderThread = std::thread(&TextureStreamer::loaderLoop, this);
+    transferThread = std::thread(&TextureStreamer::transferLoop, this);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    loaderCondition.notify_all();
+    transferCondition.notify_all();
+    // Transfer thread may wait for staging memory, that is released only by update()
+    stagingRing->interrupt();
+    loaderThread.join();
+    transferThread.join();
+    for (Upload& upload: uploads)
+    {   // Staging buffer and image should outlive upload
+        if (Upload::State::Submitted == upload.state)
+            stagingRing->wait(upload.serial);
+    }
+}
+
+void TextureStreamer::load(const std::string& filename, Callback callback)
+{
+    ++pendingCount;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        requests.push_back({{filename}, false, false, std::move(callback)});
+    }
+    loaderCondition.notify_one();
+}
+
+void TextureStreamer::loadArray(const std::vector<std::string>& filenames, Callback callback,
+    bool parallel /* true */)
+{
+    ++pendingCount;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        requests.push_back({filenames, true, parallel, std::move(callback)});
+    }
+    loaderCondition.notify_one();
+}
+
+uint32_t TextureStreamer::update()
+{
+    std::vector<std::pair<Callback, std::unique_ptr<magma::ImageView>>> readyTextures;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (Upload& upload: uploads)
+        {
+            if (Upload::State::Recorded == upload.state)
+            {
+                upload.serial = stagingRing->submit(queue, upload.cmdBuffer);
+                upload.state = Upload::State::Submitted;
+            }
+            else if (Upload::State::Submitted == upload.state &&
+                stagingRing->finished(upload.serial))
+            {
+                readyTextures.emplace_back(std::move(upload.callback), std::move(upload.imageView));
+                upload.buffer.reset();
+                upload.state = Upload::State::Free;
+            }
+        }
+    }
+    if (readyTextures.empty())
+        return 0;
+    transferCondition.notify_one();
+    // Callbacks may request another textures
+    for (auto& texture: readyTextures)
+    {
+        texture.first(std::move(texture.second));
+        --pendingCount;
+    }
+    return (uint32_t)readyTextures.size();
+}
+
+std::unique_ptr<magma::ImageView> TextureStreamer::createPlaceholder(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+    const std::shared_ptr<StagingRing>& stagingRing, VkImageViewType viewType, uint32_t layerCount /* 1 */)
+{   // Mid-gray texel for each layer or face
+    const uint32_t texelCount = (VK_IMAGE_VIEW_TYPE_CUBE == viewType) ? 6 : layerCount;
+    const VkDeviceSize size = texelCount * sizeof(uint32_t);
+    const StagingRing::Allocation staging = stagingRing->allocate(size, cmdBuffer);
+    std::fill_n(reinterpret_cast<uint32_t *>(staging.data), texelCount, 0xFF808080);
+    magma::Mipmap mipMap;
+    for (uint32_t i = 0; i < texelCount; ++i)
+        mipMap.emplace_back(1, 1, (VkDeviceSize)(i * sizeof(uint32_t)));
+    const magma::Image::CopyLayout bufferLayout{staging.offset, 0, 0};
+    const std::unique_ptr<magma::SrcTransferBuffer>& buffer = stagingRing->getBuffer();
+    constexpr VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+    std::unique_ptr<magma::Image> image;
+    switch (viewType)
+    {
+    case VK_IMAGE_VIEW_TYPE_CUBE:
+        image = std::make_unique<magma::ImageCube>(cmdBuffer, format, buffer, mipMap, bufferLayout);
+        break;
+    case VK_IMAGE_VIEW_TYPE_2D_ARRAY:
+        image = std::make_unique<magma::Image2DArray>(cmdBuffer, format, layerCount, buffer, mipMap, bufferLayout);
+        break;
+    default:
+        image = std::make_unique<magma::Image2D>(cmdBuffer, format, buffer, mipMap, bufferLayout);
+    }
+    return std::make_unique<magma::UniqueImageView>(std::move(image));
+}
+
+void TextureStreamer::loaderLoop()
+{
+    for (;;)
+    {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            loaderCondition.wait(lock, [this] { return stop || !requests.empty(); });
+            if (stop)
+                return;
+            request = std::move(requests.front());
+            requests.pop_front();
+        }
+        try
+        {
+            std::unique_ptr<Texture> texture = decode(request);
+            std::lock_guard<std::mutex> lock(mtx);
+            textures.push_back(std::move(texture));
+        }
+        catch (const std::exception& e)
+        {   // Placeholder remains bound
+            std::cerr << e.what() << std::endl;
+            --pendingCount;
+            continue;
+        }
+        transferCondition.notify_one();
+    }
+}
+
+void TextureStreamer::transferLoop()
+{
+    for (;;)
+    {
+        std::unique_ptr<Texture> texture;
+        Upload *upload;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            transferCondition.wait(lock, [this] { return stop || (!textures.empty() && findFreeUpload()); });
+            if (stop)
+                return;
+            texture = std::move(textures.front());
+            textures.pop_front();
+            upload = findFreeUpload();
+            upload->state = Upload::State::Recording;
+        }
+        try
+        {
+            record(*texture, *upload);
+        }
+        catch (const std::exception& e)
+        {
+            if (!stop)
+                std::cerr << e.what() << std::endl;
+            stagingRing->release(upload->cmdBuffer);
+            std::lock_guard<std::mutex> lock(mtx);
+            upload->buffer.reset();
+            upload->imageView.reset();
+            upload->state = Upload::State::Free;
+            --pendingCount;
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        upload->state = Upload::State::Recorded;
+    }
+}
+
+std::unique_ptr<TextureStreamer::Texture> TextureStreamer::decode(const Request& request) const
+{
+    constexpr std::size_t pageSize = 4096;
+    std::unique_ptr<Texture> texture = std::make_unique<Texture>();
+    const std::string& front = request.filenames.front();
+    const std::string ktx2Ext = ".ktx2";
+    if (!request.array && (front.size() > ktx2Ext.size()) &&
+        (0 == front.compare(front.size() - ktx2Ext.size(), ktx2Ext.size(), ktx2Ext)))
+    {   // Levels will be inflated by transfer thread
+        texture->ktx2 = std::make_unique<Ktx2Texture>(front);
+        texture->format = texture->ktx2->getFormat();
+        texture->size = texture->ktx2->getSize();
+        texture->callback = request.callback;
+        return texture;
+    }
+    const uint32_t layerCount = magma::core::countof(request.filenames);
+    texture->files.resize(layerCount);
+    texture->contexts.resize(layerCount);
+    texture->layerSizes.resize(layerCount);
+    auto decodeLayer = [&request, &texture](uint32_t layer)
+    {   // Parse DDS header right in the mapped file
+        const std::string& filename = request.filenames[layer];
+        utilities::FileView& file = texture->files[layer];
+        file = utilities::FileView(filename, utilities::FileView::Access::Sequential);
+        gliml::context& ctx = texture->contexts[layer];
+        ctx.enable_dxt(true);
+        if (!ctx.load(file.data(), static_cast<unsigned>(file.size())))
+            throw std::runtime_error("failed to load DDS texture \"" + filename + "\"");
+        // Skip DDS header
+        const uint8_t *firstMipData = (const uint8_t *)ctx.image_data(0, 0);
+        const VkDeviceSize layerSize = file.size() - (firstMipData - file.data());
+        // Fault pages in, so that transfer thread copies from memory rather than from disk
+        volatile uint8_t touch = 0;
+        for (std::size_t offset = 0; offset < layerSize; offset += pageSize)
+            touch += firstMipData[offset];
+        texture->layerSizes[layer] = layerSize;
+    };
+    if (request.parallel)
+        utilities::parallelFor(layerCount, decodeLayer);
+    else
+    {
+        for (uint32_t layer = 0; layer < layerCount; ++layer)
+            decodeLayer(layer);
+    }
+    // Layers are placed one after another in staging memory
+    texture->layerOffsets.reserve(layerCount);
+    for (VkDeviceSize layerSize: texture->layerSizes)
+    {
+        texture->layerOffsets.push_back(texture->size);
+        texture->size += layerSize;
+    }
+    const gliml::context& first = texture->contexts.front();
+    texture->format = utilities::getBlockCompressedFormat(first);
+    for (const auto& ctx: texture->contexts)
+    {
+        if (utilities::getBlockCompressedFormat(ctx) != texture->format ||
+            ctx.image_width(0, 0) != first.image_width(0, 0) ||
+            ctx.image_height(0, 0) != first.image_height(0, 0))
+            throw std::runtime_error("layers of texture array have different format or dimensions");
+    }
+    texture->array = request.array;
+    texture->parallel = request.parallel;
+    texture->callback = request.callback;
+    return texture;
+}
+
+void TextureStreamer::record(Texture& texture, Upload& upload) const
+{
+    VkDeviceSize bufferOffset = 0;
+    uint8_t *data;
+    if (texture.size <= stagingRing->getChunkSize())
+    {   // Leave space for another uploads in flight
+        const StagingRing::Allocation staging = stagingRing->allocate(texture.size, upload.cmdBuffer, &stop);
+        bufferOffset = staging.offset;
+        data = staging.data;
+    }
+    else
+    {
+        upload.buffer = std::make_unique<magma::SrcTransferBuffer>(device, texture.size);
+        data = reinterpret_cast<uint8_t *>(upload.buffer->getMemory()->map());
+    }
+    const std::unique_ptr<magma::SrcTransferBuffer>& buffer = upload.buffer ? upload.buffer : stagingRing->getBuffer();
+    if (texture.ktx2)
+    {   // Levels of KTX2 container are inflated right into staging memory
+        upload.cmdBuffer->reset(false);
+        upload.cmdBuffer->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        {
+            upload.imageView = texture.ktx2->upload(upload.cmdBuffer, buffer, bufferOffset, data);
+        }
+        upload.cmdBuffer->end();
+        upload.callback = std::move(texture.callback);
+        return;
+    }
+    // Copy texture data of all layers to staging memory
+    const uint32_t layerCount = magma::core::countof(texture.contexts);
+    auto copyLayer = [&texture, data](uint32_t layer)
+    {
+        memcpy(data + texture.layerOffsets[layer], texture.contexts[layer].image_data(0, 0),
+            static_cast<size_t>(texture.layerSizes[layer]));
+    };
+    if (texture.parallel)
+        utilities::parallelFor(layerCount, copyLayer);
+    else
+    {
+        for (uint32_t layer = 0; layer < layerCount; ++layer)
+            copyLayer(layer);
+    }
+    // Setup texture data description
+    magma::Mipmap mipMap;
+    for (uint32_t layer = 0; layer < layerCount; ++layer)
+    {
+        const gliml::context& ctx = texture.contexts[layer];
+        const uint8_t *firstMipData = (const uint8_t *)ctx.image_data(0, 0);
+        for (int face = 0; face < ctx.num_faces(); ++face)
+        {
+            for (int level = 0; level < ctx.num_mipmaps(face); ++level)
+            {
+                const ptrdiff_t offset = (const uint8_t *)ctx.image_data(face, level) - firstMipData;
+                mipMap.emplace_back(
+                    ctx.image_width(face, level),
+                    ctx.image_height(face, level),
+                    texture.layerOffsets[layer] + (VkDeviceSize)offset);
+            }
+        }
+    }
+    // Upload texture data from buffer
+    const magma::Image::CopyLayout bufferLayout{bufferOffset, 0, 0};
+    std::unique_ptr<magma::Image> image;
+    upload.cmdBuffer->reset(false);
+    upload.cmdBuffer->begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    {
+        if (texture.array)
+        {
+            image = std::make_unique<magma::Image2DArray>(upload.cmdBuffer, texture.format,
+                layerCount, buffer, mipMap, bufferLayout);
+        }
+        else if (6 == texture.contexts.front().num_faces())
+        {
+            image = std::make_unique<magma::ImageCube>(upload.cmdBuffer, texture.format,
+                buffer, mipMap, bufferLayout);
+        }
+        else
+        {
+            image = std::make_unique<magma::Image2D>(upload.cmdBuffer, texture.format,
+                buffer, mipMap, bufferLayout);
+        }
+    }
+    upload.cmdBuffer->end();
+    upload.imageView = std::make_unique<magma::UniqueImageView>(std::move(image));
+    upload.callback = std::move(texture.callback);
+}
+
+TextureStreamer::Upload *TextureStreamer::findFreeUpload() noexcept
+{
+    for (Upload& upload: uploads)
+    {
+        if (Upload::State::Free == upload.state)
+            return &upload;
+    }
+    return nullptr;
+}
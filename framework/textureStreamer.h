@@ -0,0 +1,103 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <deque>
+#include "magma/magma.h"
+#include "fileView.h"
+#include "stagingRing.h"
+#include "ktx2Texture.h"
+#include "gliml/gliml.h"
+
+/* Background streaming of DDS textures. Loader thread maps files,
+   parses headers and faults pages in; transfer thread copies texture
+   data to staging ring and records upload commands. Queue submission
+   has to be externally synchronized and samples submit frames from the
+   render thread, so recorded uploads are submitted by update() that is
+   called from render() and never waits: when the upload is finished,
+   texture is handed over to the callback. Until then, sample
+   keeps placeholder bound, so the first frame doesn't wait for textures.
+   Files with .ktx2 extension are loaded as KTX2 containers.
+   Layers of texture array are mapped, parsed and copied to staging
+   memory concurrently, each at precomputed offset. */
+class TextureStreamer
+{
+public:
+    typedef std::function<void(std::unique_ptr<magma::ImageView>)> Callback;
+
+    explicit TextureStreamer(std::shared_ptr<magma::Device> device,
+        std::shared_ptr<magma::Queue> queue,
+        std::shared_ptr<StagingRing> stagingRing,
+        uint32_t uploadCount = 2); // Uploads in flight
+    ~TextureStreamer();
+    void load(const std::string& filename, Callback callback); // 2D texture or cubemap
+    void loadArray(const std::vector<std::string>& filenames, Callback callback,
+        bool parallel = true);
+    uint32_t update();
+    uint32_t getPendingCount() const noexcept { return pendingCount; }
+    static std::unique_ptr<magma::ImageView> createPlaceholder(const std::shared_ptr<magma::CommandBuffer>& cmdBuffer,
+        const std::shared_ptr<StagingRing>& stagingRing,
+        VkImageViewType viewType,
+        uint32_t layerCount = 1);
+
+private:
+    struct Request
+    {
+        std::vector<std::string> filenames;
+        bool array;
+        bool parallel;
+        Callback callback;
+    };
+
+    struct Texture
+    {
+        std::vector<utilities::FileView> files;
+        std::vector<gliml::context> contexts; // Point to the file data
+        std::vector<VkDeviceSize> layerSizes;
+        std::vector<VkDeviceSize> layerOffsets;
+        std::unique_ptr<Ktx2Texture> ktx2;
+        VkDeviceSize size = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        bool array = false;
+        bool parallel = false;
+        Callback callback;
+    };
+
+    struct Upload
+    {
+        enum class State : uint8_t
+        {
+            Free, Recording, Recorded, Submitted
+        };
+
+        State state = State::Free;
+        std::shared_ptr<magma::CommandBuffer> cmdBuffer;
+        uint64_t serial = 0;
+        std::unique_ptr<magma::SrcTransferBuffer> buffer; // If texture doesn't fit into staging ring
+        std::unique_ptr<magma::ImageView> imageView;
+        Callback callback;
+    };
+
+    void loaderLoop();
+    void transferLoop();
+    std::unique_ptr<Texture> decode(const Request& request) const;
+    void record(Texture& texture, Upload& upload) const;
+    Upload *findFreeUpload() noexcept;
+
+    std::shared_ptr<magma::Device> device;
+    std::shared_ptr<magma::Queue> queue;
+    std::shared_ptr<StagingRing> stagingRing;
+    std::unique_ptr<magma::CommandPool> commandPool; // Used by transfer thread only
+    std::vector<Upload> uploads;
+    std::deque<Request> requests;
+    std::deque<std::unique_ptr<Texture>> textures;
+    std::mutex mtx;
+    std::condition_variable loaderCondition;
+    std::condition_variable transferCondition;
+    std::thread loaderThread;
+    std::thread transferThread;
+    std::atomic<uint32_t> pendingCount;
+    std::atomic<bool> stop; // Also cancels staging allocation
+};
@@ -0,0 +1,53 @@
+#version 450
+
+#define BILINEAR 0
+#define EDGE_AWARE 1
+
+layout(binding = 0) uniform sampler2D image;
+
+layout(push_constant) uniform PushConstants {
+    vec2 scale; // render extent / image extent
+    vec2 texelSize;
+    vec2 invViewportSize;
+    int filterMode;
+};
+
+layout(location = 0) out vec4 oColor;
+
+vec3 fetch(vec2 uv)
+{   // don't sample outside of rendered region
+    vec2 halfTexel = texelSize * .5;
+    return texture(image, clamp(uv, halfTexel, scale - halfTexel)).rgb;
+}
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(.299, .587, .114));
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * invViewportSize * scale;
+    vec3 color = fetch(uv);
+    if (EDGE_AWARE == filterMode)
+    {
+        vec3 l = fetch(uv - vec2(texelSize.x, 0.));
+        vec3 r = fetch(uv + vec2(texelSize.x, 0.));
+        vec3 t = fetch(uv - vec2(0., texelSize.y));
+        vec3 b = fetch(uv + vec2(0., texelSize.y));
+        vec2 gradient = vec2(luma(r) - luma(l), luma(b) - luma(t));
+        float len = length(gradient);
+        if (len > 1./16.)
+        {   // filter along the edge rather than across it to reduce staircase
+            vec2 dir = vec2(-gradient.y, gradient.x)/len * texelSize;
+            color = (color * 2. + fetch(uv + dir) + fetch(uv - dir)) * .25;
+        }
+        // restore some of sharpness lost by bilinear filter,
+        // clamp to the neighbourhood to avoid ringing
+        vec3 neighbourhood = (l + r + t + b) * .25;
+        vec3 minColor = min(min(min(l, r), min(t, b)), color);
+        vec3 maxColor = max(max(max(l, r), max(t, b)), color);
+        color = clamp(color + (color - neighbourhood) * .5, minColor, maxColor);
+    }
+    oColor = vec4(color, 1.);
+}
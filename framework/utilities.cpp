@@ -7,20 +7,20 @@
 
 namespace utilities
 {
-aligned_vector<char> loadBinaryFile(const std::string& filename)
+// gliml defines S3TC formats only, but reports internal format of KTX files as is
+enum : int
 {
-    std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-    if (!file.is_open())
-    {
-        const std::string msg = std::string("failed to open file \"") + filename + std::string("\"");
-        throw std::runtime_error(msg.c_str());
-    }
-    const std::streamoff size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    aligned_vector<char> binary(static_cast<size_t>(size));
-    file.read(binary.data(), size);
-    file.close();
-    return binary;
+    GL_COMPRESSED_RED_RGTC1 = 0x8DBB,
+    GL_COMPRESSED_SIGNED_RED_RGTC1 = 0x8DBC,
+    GL_COMPRESSED_RG_RGTC2 = 0x8DBD,
+    GL_COMPRESSED_SIGNED_RG_RGTC2 = 0x8DBE,
+    GL_COMPRESSED_RGBA_BPTC_UNORM = 0x8E8C,
+    GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM = 0x8E8D
+};
+
+FileView loadBinaryFile(const std::string& filename)
+{   // Map instead of reading to avoid copy to the heap
+    return FileView(filename, FileView::Access::Sequential);
 }
 
 VkFormat getBlockCompressedFormat(const gliml::context& ctx)
@@ -34,6 +34,18 @@ VkFormat getBlockCompressedFormat(const gliml::context& ctx)
         return VK_FORMAT_BC2_UNORM_BLOCK;
     case GLIML_GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
         return VK_FORMAT_BC3_UNORM_BLOCK;
+    case GL_COMPRESSED_RED_RGTC1:
+        return VK_FORMAT_BC4_UNORM_BLOCK;
+    case GL_COMPRESSED_SIGNED_RED_RGTC1:
+        return VK_FORMAT_BC4_SNORM_BLOCK;
+    case GL_COMPRESSED_RG_RGTC2:
+        return VK_FORMAT_BC5_UNORM_BLOCK;
+    case GL_COMPRESSED_SIGNED_RG_RGTC2:
+        return VK_FORMAT_BC5_SNORM_BLOCK;
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        return VK_FORMAT_BC7_UNORM_BLOCK;
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        return VK_FORMAT_BC7_SRGB_BLOCK;
     default:
         throw std::invalid_argument("unknown block compressed format");
         return VK_FORMAT_UNDEFINED;
@@ -1,6 +1,11 @@
 #pragma once
 #include <memory>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <algorithm>
 #include <cassert>
 
 #ifdef _WIN32
@@ -9,6 +14,7 @@
 #include <vulkan/vulkan.h>
 
 #include "alignedAllocator.h"
+#include "fileView.h"
 #include "gliml/gliml.h"
 
 template<typename Type>
@@ -21,7 +27,7 @@ namespace magma
 
 namespace utilities
 {
-    aligned_vector<char> loadBinaryFile(const std::string& filename);
+    FileView loadBinaryFile(const std::string& filename);
 
     VkFormat getBlockCompressedFormat(const gliml::context& ctx);
     VkFormat getSupportedDepthFormat(std::shared_ptr<magma::PhysicalDevice> physicalDevice,
@@ -39,6 +45,42 @@ namespace utilities
         VkDebugUtilsMessageTypeFlagsEXT messageTypes, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData);
 #endif // VK_EXT_debug_utils
 
+    /* Calls func(index) for each index in [0, count) from worker
+       threads and the calling thread. First exception thrown by func
+       is rethrown when all workers are joined. */
+    template<class Func>
+    inline void parallelFor(uint32_t count, Func&& func)
+    {
+        std::atomic<uint32_t> next(0);
+        std::exception_ptr exception;
+        std::mutex mtx;
+        auto worker = [&]()
+        {
+            for (uint32_t i = next++; i < count; i = next++)
+            {
+                try
+                {
+                    func(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    if (!exception)
+                        exception = std::current_exception();
+                }
+            }
+        };
+        const uint32_t threadCount = std::min(count, std::max(std::thread::hardware_concurrency(), 1u));
+        std::vector<std::thread> workers;
+        for (uint32_t i = 1; i < threadCount; ++i)
+            workers.emplace_back(worker);
+        worker();
+        for (std::thread& thread: workers)
+            thread.join();
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+
     template<class Vertex, std::size_t Size>
     inline std::unique_ptr<magma::VertexBuffer> makeVertexBuffer(const Vertex (&vertices)[Size],
         magma::lent_ptr<magma::CommandBuffer> cmdBuffer,
@@ -89,6 +89,7 @@ void VulkanApp::initialize()
     createCommandBuffers();
     createSyncPrimitives();
     createDescriptorPool();
+    stagingRing = std::make_shared<StagingRing>(device);
     pipelineCache = std::make_unique<magma::PipelineCache>(device);
     shaderReflectionFactory = std::make_unique<ShaderReflectionFactory>(device);
 }
@@ -195,6 +196,10 @@ void VulkanApp::createLogicalDevice()
     features.samplerAnisotropy = VK_TRUE;
     features.textureCompressionBC = VK_TRUE;
     features.occlusionQueryPrecise = VK_TRUE;
+    // Opt-in for samples, so enabled only if supported
+    const VkPhysicalDeviceFeatures supportedFeatures = physicalDevice->getFeatures();
+    features.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+    features.shaderStorageImageWriteWithoutFormat = supportedFeatures.shaderStorageImageWriteWithoutFormat;
     magma::StructureChain extendedFeatures;
     enableFeatures(extendedFeatures);
 
@@ -430,15 +435,11 @@ void VulkanApp::submitCommandBuffer(uint32_t bufferIndex)
 }
 
 void VulkanApp::submitCopyImageCommands()
-{
-    waitFences[0]->reset();
-    graphicsQueue->submit(cmdImageCopy, 0, nullptr, nullptr, waitFences[0]);
-    waitFences[0]->wait();
+{   // Staging memory used by copy commands is reclaimed on completion
+    stagingRing->submit(graphicsQueue, cmdImageCopy, true);
 }
 
 void VulkanApp::submitCopyBufferCommands()
 {
-    waitFences[1]->reset();
-    transferQueue->submit(cmdBufferCopy, 0, nullptr, nullptr, waitFences[1]);
-    waitFences[1]->wait();
+    stagingRing->submit(transferQueue, cmdBufferCopy, true);
 }
@@ -9,6 +9,8 @@
 #include "magma/magma.h"
 #include "rapid/rapid.h"
 #include "graphicsPipeline.h"
+#include "computePipeline.h"
+#include "stagingRing.h"
 #include "shaderReflectionFactory.h"
 #include "timer.h"
 
@@ -78,6 +80,7 @@ protected:
     std::vector<std::shared_ptr<magma::CommandBuffer>> commandBuffers;
     std::shared_ptr<magma::CommandBuffer> cmdImageCopy;
     std::shared_ptr<magma::CommandBuffer> cmdBufferCopy;
+    std::shared_ptr<StagingRing> stagingRing;
 
     std::vector<std::unique_ptr<magma::Semaphore>> presentFinished;
     std::vector<std::unique_ptr<magma::Semaphore>> renderFinished;